@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPPNBT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace nbt
+{
+    namespace
+    {
+        typedef void (*ConvertFn)(uint8_t *dst, const uint8_t *src, size_t count);
+
+        // Scalar kernels, also used for the tails of the vector ones.
+        // be*toh is a no-op on big-endian hosts.
+        void convert16Scalar(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, src += 2, dst += 2)
+            {
+                uint16_t val;
+                memcpy(&val, src, 2);
+                val = be16toh(val);
+                memcpy(dst, &val, 2);
+            }
+        }
+
+        void convert32Scalar(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, src += 4, dst += 4)
+            {
+                uint32_t val;
+                memcpy(&val, src, 4);
+                val = be32toh(val);
+                memcpy(dst, &val, 4);
+            }
+        }
+
+        void convert64Scalar(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, src += 8, dst += 8)
+            {
+                uint64_t val;
+                memcpy(&val, src, 8);
+                val = be64toh(val);
+                memcpy(dst, &val, 8);
+            }
+        }
+
+#ifdef CPPNBT_X86_SIMD
+        // SSE2 has no byte shuffle: swap 16-bit halves with shifts, after
+        // reversing the 16-bit words of each element for wider types
+        __attribute__((target("sse2")))
+        inline __m128i swap16Sse2(__m128i v)
+        {
+            return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+
+        __attribute__((target("sse2")))
+        void convert16Sse2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8, src += 16, dst += 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), swap16Sse2(v));
+            }
+            convert16Scalar(dst, src, count - i);
+        }
+
+        __attribute__((target("sse2")))
+        void convert32Sse2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4, src += 16, dst += 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+                v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+                v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), swap16Sse2(v));
+            }
+            convert32Scalar(dst, src, count - i);
+        }
+
+        __attribute__((target("sse2")))
+        void convert64Sse2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 2 <= count; i += 2, src += 16, dst += 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+                v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+                v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), swap16Sse2(v));
+            }
+            convert64Scalar(dst, src, count - i);
+        }
+
+        // AVX2 reverses bytes within each element with one shuffle
+        __attribute__((target("avx2")))
+        void convertAvx2(uint8_t *dst, const uint8_t *src, size_t bytes,
+                         __m256i mask)
+        {
+            for (size_t i = 0; i + 32 <= bytes; i += 32)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                                    _mm256_shuffle_epi8(v, mask));
+            }
+        }
+
+        __attribute__((target("avx2")))
+        void convert16Avx2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            const __m256i mask = _mm256_setr_epi8(
+                1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+            size_t vec = count & ~(size_t)15;
+            convertAvx2(dst, src, vec * 2, mask);
+            convert16Sse2(dst + vec * 2, src + vec * 2, count - vec);
+        }
+
+        __attribute__((target("avx2")))
+        void convert32Avx2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            const __m256i mask = _mm256_setr_epi8(
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+            size_t vec = count & ~(size_t)7;
+            convertAvx2(dst, src, vec * 4, mask);
+            convert32Sse2(dst + vec * 4, src + vec * 4, count - vec);
+        }
+
+        __attribute__((target("avx2")))
+        void convert64Avx2(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            const __m256i mask = _mm256_setr_epi8(
+                7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+            size_t vec = count & ~(size_t)3;
+            convertAvx2(dst, src, vec * 8, mask);
+            convert64Sse2(dst + vec * 8, src + vec * 8, count - vec);
+        }
+#endif
+
+        struct Kernels
+        {
+            ConvertFn convert16;
+            ConvertFn convert32;
+            ConvertFn convert64;
+        };
+
+        Kernels selectKernels()
+        {
+            Kernels ret = { convert16Scalar, convert32Scalar, convert64Scalar };
+
+#ifdef CPPNBT_X86_SIMD
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2"))
+            {
+                ret.convert16 = convert16Avx2;
+                ret.convert32 = convert32Avx2;
+                ret.convert64 = convert64Avx2;
+            }
+            else if (__builtin_cpu_supports("sse2"))
+            {
+                ret.convert16 = convert16Sse2;
+                ret.convert32 = convert32Sse2;
+                ret.convert64 = convert64Sse2;
+            }
+#endif
+
+            return ret;
+        }
+
+        // Picked on first use, so static initializers elsewhere are safe
+        const Kernels &kernels()
+        {
+            static const Kernels ret = selectKernels();
+            return ret;
+        }
+    }
+
+    void convertBigEndian16(void *dst, const void *src, size_t count)
+    {
+        kernels().convert16(static_cast<uint8_t *>(dst),
+                            static_cast<const uint8_t *>(src), count);
+    }
+
+    void convertBigEndian32(void *dst, const void *src, size_t count)
+    {
+        kernels().convert32(static_cast<uint8_t *>(dst),
+                            static_cast<const uint8_t *>(src), count);
+    }
+
+    void convertBigEndian64(void *dst, const void *src, size_t count)
+    {
+        kernels().convert64(static_cast<uint8_t *>(dst),
+                            static_cast<const uint8_t *>(src), count);
+    }
+}
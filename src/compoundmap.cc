@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    const size_t CompoundMap::SCAN_LIMIT;
+
+
+    CompoundMap::const_iterator CompoundMap::find(const CompoundKey &key) const
+    {
+        const StringView &name = key.getName();
+        uint32_t hash = key.getHash();
+
+        if (_index.empty())
+        {
+            for (size_t i = 0; i < _hashes.size(); ++i)
+            {
+                if (_hashes[i] == hash && StringView(_entries[i].first) == name)
+                    return _entries.begin() + i;
+            }
+
+            return _entries.end();
+        }
+
+        size_t mask = _index.size() - 1;
+        for (size_t slot = hash & mask; _index[slot] != 0; slot = (slot + 1) & mask)
+        {
+            size_t i = _index[slot] - 1;
+            if (_hashes[i] == hash && StringView(_entries[i].first) == name)
+                return _entries.begin() + i;
+        }
+
+        return _entries.end();
+    }
+
+
+    Tag *CompoundMap::insert(const InternedString &key, Tag *tag)
+    {
+        const_iterator it = find(key);
+        if (it != _entries.end())
+        {
+            value_type &entry = _entries[it - _entries.begin()];
+            Tag *ret = entry.second;
+            entry.second = tag;
+            return ret;
+        }
+
+        _entries.push_back(value_type(key, tag));
+        _hashes.push_back(key.getHash());
+
+        if (_entries.size() > SCAN_LIMIT)
+        {
+            // Keep the index at most half full
+            if (_entries.size() * 2 > _index.size())
+                rebuildIndex(_entries.size() * 2);
+            else
+                addToIndex(_entries.size() - 1);
+        }
+
+        return NULL;
+    }
+
+
+    void CompoundMap::erase(const_iterator pos)
+    {
+        size_t i = pos - _entries.begin();
+        _entries.erase(_entries.begin() + i);
+        _hashes.erase(_hashes.begin() + i);
+
+        // Removal is rare, so the index is simply built again
+        if (_entries.size() > SCAN_LIMIT)
+            rebuildIndex(_index.size());
+        else
+            _index.clear();
+    }
+
+
+    void CompoundMap::clear()
+    {
+        _entries.clear();
+        _hashes.clear();
+        _index.clear();
+    }
+
+
+    void CompoundMap::reserve(size_t size)
+    {
+        _entries.reserve(size);
+        _hashes.reserve(size);
+    }
+
+
+    void CompoundMap::rebuildIndex(size_t slots)
+    {
+        size_t size = 32;
+        while (size < slots)
+            size *= 2;
+
+        _index.assign(size, 0);
+
+        for (size_t i = 0; i < _entries.size(); ++i)
+            addToIndex(i);
+    }
+
+
+    void CompoundMap::addToIndex(size_t entry)
+    {
+        size_t mask = _index.size() - 1;
+        size_t slot = _hashes[entry] & mask;
+
+        while (_index[slot] != 0)
+            slot = (slot + 1) & mask;
+
+        _index[slot] = entry + 1;
+    }
+}
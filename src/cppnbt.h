@@ -26,7 +26,19 @@
 #include <map>
 #include <stdexcept>
 #include <functional>
+#include <type_traits>
 #include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <sys/types.h>
 #include <zlib.h>
 
 #include <stdint.h>
@@ -65,6 +77,12 @@ namespace nbt
 
     bool is_big_endian();
 
+    // Convert count 16, 32 or 64-bit values between big-endian and host
+    // order. dst may be the same as src. Vectorized where the CPU allows.
+    void convertBigEndian16(void *dst, const void *src, size_t count);
+    void convertBigEndian32(void *dst, const void *src, size_t count);
+    void convertBigEndian64(void *dst, const void *src, size_t count);
+
     
     class GzipIOException : public std::runtime_error
     {
@@ -92,9 +110,119 @@ namespace nbt
                 : std::runtime_error("list is empty") {}
     };
 
+    class InvalidPathException : public std::runtime_error
+    {
+        public:
+            InvalidPathException(const std::string &path)
+                : std::runtime_error("invalid NBT path: " + path) {}
+    };
+
+    class ImageIOException : public std::runtime_error
+    {
+        public:
+            ImageIOException(int code)
+                : std::runtime_error("NBT image IO error"), code(code) {}
+
+            int getCode() { return code; }
+
+        private:
+            int code;
+    };
+
+    class RegionIOException : public std::runtime_error
+    {
+        public:
+            RegionIOException(int code)
+                : std::runtime_error("Region IO error"), code(code) {}
+
+            int getCode() { return code; }
+
+        private:
+            int code;
+    };
+
     typedef std::vector<unsigned char>  ByteArray;
     typedef std::vector<int32_t>        IntArray;
 
+    // Non-owning reference to a run of characters, such as a tag name
+    // inside a decompressed buffer
+    class StringView
+    {
+        public:
+            StringView() : _data(""), _size(0) {}
+            StringView(const char *str) : _data(str), _size(strlen(str)) {}
+            template <typename Alloc>
+            StringView(const std::basic_string<char, std::char_traits<char>, Alloc> &str)
+                : _data(str.data()), _size(str.length()) {}
+            StringView(const char *data, size_t size)
+                : _data(data), _size(size) {}
+
+            const char *data() const { return _data; }
+            size_t size() const { return _size; }
+            bool empty() const { return _size == 0; }
+
+            std::string str() const { return std::string(_data, _size); }
+
+            bool operator==(const StringView &other) const
+            {
+                return _size == other._size
+                    && memcmp(_data, other._data, _size) == 0;
+            }
+
+            bool operator!=(const StringView &other) const
+            {
+                return !(*this == other);
+            }
+
+            // Byte-wise ordering, the same as std::string's
+            int compare(const StringView &other) const
+            {
+                int ret = memcmp(_data, other._data, std::min(_size, other._size));
+                if (ret != 0)
+                    return ret;
+
+                return _size < other._size ? -1 : _size > other._size;
+            }
+
+            bool operator<(const StringView &other) const
+            {
+                return compare(other) < 0;
+            }
+
+        private:
+            const char *_data;
+            size_t _size;
+    };
+
+    inline std::ostream &operator<<(std::ostream &os, const StringView &str)
+    {
+        return os.write(str.data(), str.size());
+    }
+
+    // Non-owning reference to a run of values in native byte order, such
+    // as the elements of a packed list
+    template <typename T>
+    class ArrayView
+    {
+        public:
+            ArrayView() : _data(NULL), _size(0) {}
+            ArrayView(const T *data, size_t size)
+                : _data(data), _size(size) {}
+
+            const T *data() const { return _data; }
+            size_t size() const { return _size; }
+            bool empty() const { return _size == 0; }
+
+            const T *begin() const { return _data; }
+            const T *end() const { return _data + _size; }
+
+            const T &operator[](size_t i) const { return _data[i]; }
+
+        private:
+            const T *_data;
+            size_t _size;
+    };
+
     enum
     {
         TAG_END        = 0,
@@ -108,7 +236,252 @@ namespace nbt
         TAG_STRING     = 8,
         TAG_LIST       = 9,
         TAG_COMPOUND   = 10,
-        TAG_INT_ARRAY  = 11
+        TAG_INT_ARRAY  = 11,
+        TAG_LONG_ARRAY = 12
+    };
+
+    class NbtWriter;
+
+    // Bump allocator that holds a whole parsed tree in a few large blocks.
+    // Everything allocated from it is released at once by reset() or the
+    // destructor, without running any Tag destructor.
+    //
+    // While a Scope is active on a thread, new tags, their names, string
+    // values and container storage are allocated from the scoped arena.
+    // Array payloads handed to such tags must come from newArray().
+    class NbtArena
+    {
+        public:
+            NbtArena(size_t blockSize = 65536);
+            ~NbtArena();
+
+            void *allocate(size_t size, size_t align = sizeof(void *) * 2);
+            void reset();
+
+            size_t getBytesAllocated() const;
+            size_t getBlockCount() const;
+
+            // Arena of the innermost active Scope on this thread, or NULL
+            static NbtArena *current();
+
+            // Array of n elements from the current arena, or new[] when
+            // there is none
+            template <typename T>
+            static T *newArray(size_t n);
+
+            // Object constructed in the current arena, or with new when
+            // there is none
+            template <typename T>
+            static T *newObject();
+
+            class Scope
+            {
+                public:
+                    Scope(NbtArena *arena);
+                    ~Scope();
+
+                private:
+                    Scope(const Scope &);
+                    Scope &operator=(const Scope &);
+
+                    NbtArena *_previous;
+            };
+
+        private:
+            NbtArena(const NbtArena &);
+            NbtArena &operator=(const NbtArena &);
+
+            struct Block
+            {
+                Block *next;
+                size_t size;
+            };
+
+            Block *_blocks;
+            uint8_t *_pos;
+            uint8_t *_limit;
+            size_t _blockSize;
+            size_t _bytesAllocated;
+
+            static thread_local NbtArena *_current;
+    };
+
+    // Standard allocator that draws from an NbtArena, or from the heap
+    // when it has none. Default construction picks up NbtArena::current().
+    template <typename T>
+    class ArenaAllocator
+    {
+        public:
+            typedef T value_type;
+
+            ArenaAllocator() : _arena(NbtArena::current()) {}
+            explicit ArenaAllocator(NbtArena *arena) : _arena(arena) {}
+
+            template <typename U>
+            ArenaAllocator(const ArenaAllocator<U> &other)
+                : _arena(other.getArena()) {}
+
+            T *allocate(size_t n)
+            {
+                if (_arena)
+                    return static_cast<T *>(_arena->allocate(n * sizeof(T), alignof(T)));
+
+                return static_cast<T *>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(T *p, size_t)
+            {
+                if (!_arena)
+                    ::operator delete(p);
+            }
+
+            NbtArena *getArena() const { return _arena; }
+
+            template <typename U>
+            bool operator==(const ArenaAllocator<U> &other) const
+            {
+                return _arena == other.getArena();
+            }
+
+            template <typename U>
+            bool operator!=(const ArenaAllocator<U> &other) const
+            {
+                return _arena != other.getArena();
+            }
+
+        private:
+            NbtArena *_arena;
+    };
+
+    typedef std::basic_string<char, std::char_traits<char>,
+                              ArenaAllocator<char> > NbtString;
+
+    // Handle to an immutable string owned by NbtStringPool. Equal strings
+    // interned in the pool share one copy, so handles compare by pointer.
+    // Strings the pool had no room for are private copies instead, freed
+    // with their last handle, or with the arena they were interned in.
+    // The default handle is the empty string.
+    class InternedString
+    {
+        public:
+            InternedString();
+            InternedString(const InternedString &other)
+                : _entry(other._entry)
+            {
+                if (!pooled())
+                    acquire();
+            }
+            InternedString(InternedString &&other) noexcept
+                : _entry(other._entry)
+            {
+                other._entry = InternedString()._entry;
+            }
+            ~InternedString()
+            {
+                if (!pooled())
+                    release();
+            }
+
+            InternedString &operator=(const InternedString &other)
+            {
+                if (_entry == other._entry)
+                    return *this;
+
+                if (!pooled())
+                    release();
+                _entry = other._entry;
+                if (!pooled())
+                    acquire();
+                return *this;
+            }
+
+            const char *data() const { return _entry->data; }
+            const char *c_str() const { return _entry->data; }
+            size_t size() const { return _entry->length; }
+            bool empty() const { return _entry->length == 0; }
+
+            // Hash of the contents, the same as CompoundKey uses
+            uint32_t getHash() const { return _entry->hash; }
+
+            // Unique per distinct pooled string, 0 for the empty string
+            // and for private copies
+            uint32_t getId() const { return _entry->id; }
+
+            std::string str() const { return std::string(data(), size()); }
+            operator StringView() const { return StringView(data(), size()); }
+
+            bool operator==(const InternedString &other) const
+            {
+                if (_entry == other._entry)
+                    return true;
+
+                // A private copy may hold the same string as another handle
+                return (!pooled() || !other.pooled())
+                    && StringView(*this) == StringView(other);
+            }
+
+            bool operator!=(const InternedString &other) const
+            {
+                return !(*this == other);
+            }
+
+            // Pooled string, followed in memory by the rest of its
+            // null-terminated characters
+            struct Entry
+            {
+                uint32_t hash;
+                uint32_t length;
+                uint32_t id;
+                char data[1];
+            };
+
+        private:
+            friend class NbtStringPool;
+
+            // Takes over the reference the pool made entry with
+            explicit InternedString(const Entry *entry) : _entry(entry) {}
+
+            bool pooled() const { return _entry->id != 0 || _entry->length == 0; }
+            void acquire();
+            void release();
+
+            const Entry *_entry;
+    };
+
+    inline std::ostream &operator<<(std::ostream &os, const InternedString &str)
+    {
+        return os.write(str.data(), str.size());
+    }
+
+    // Process-wide set of interned strings, safe to use from any thread.
+    // Pooled strings are never released, so it is meant for tag names and
+    // other values drawn from a small vocabulary. Once the pool reaches
+    // its limit, new strings are handed out as private copies instead of
+    // being added, so untrusted input cannot grow it without bound.
+    class NbtStringPool
+    {
+        public:
+            static InternedString intern(const StringView &str);
+
+            // Bytes the pool may grow to, 16 MiB by default
+            static void setLimit(size_t bytes);
+            static size_t getLimit();
+
+            // 32-bit FNV-1a
+            static uint32_t hash(const StringView &str)
+            {
+                uint32_t ret = 2166136261u;
+                for (size_t i = 0; i < str.size(); ++i)
+                    ret = (ret ^ static_cast<uint8_t>(str.data()[i])) * 16777619u;
+                return ret;
+            }
+
+            // Distinct strings held, and the bytes they take up
+            static size_t getCount();
+            static size_t getBytesAllocated();
+
+        private:
+            NbtStringPool();
     };
 
     class Tag
@@ -120,22 +493,91 @@ namespace nbt
 
             virtual ~Tag();
 
-            // Get and set name
+            // Takes the name only; a tag stays wherever it was allocated
+            Tag &operator=(const Tag &t);
+
+            // Tags are allocated from the current NbtArena, if any
+            static void *operator new(size_t size);
+            static void operator delete(void *p);
+
+            // Drops one owner of tag; the last one deletes it, unless it
+            // lives in an arena
+            static void destroy(Tag *tag);
+            bool inArena() const;
+
+            // Whether the tag also belongs to a copy of the compound or list
+            // holding it. A shared tag must not be modified in place; get a
+            // private one through edit() or the non-const accessors of
+            // TagCompound and TagList.
+            bool isShared() const;
+
+            // Forget the cached encodings of the compounds and lists above
+            // this tag. Every setter, edit() and editValues() does this.
+            // The walk stops at the first shared tag or container, as
+            // only edit() may change those.
+            void markDirty();
+
+            // Get and set name. Names are interned in NbtStringPool.
             std::string getName() const;
-            void setName(const std::string &name);
+            const InternedString &getInternedName() const;
+            void setName(const StringView &name);
 
             // Get type name and ID
             std::string getTypeName() const;
             static std::string getTypeName(uint8_t type);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
             virtual std::string toString() const;
 
+            // Serialize the whole named tag (type, name, payload), or only
+            // its payload as used for list elements
+            virtual void write(NbtWriter &writer) const;
+            virtual void writePayload(NbtWriter &writer) const;
+            ByteArray toByteArray() const;
+
+            // Exact number of bytes write() and writePayload() produce
+            virtual size_t serializedSize() const;
+            virtual size_t payloadSize() const;
+
+            // Payload size of fixed-width types, 0 for variable-length ones
+            static size_t getPayloadSize(uint8_t type);
+
+            // Empty unnamed tag of the given type, NULL for TAG_End and
+            // unknown types
+            static Tag *create(uint8_t type);
+
             virtual Tag* clone() const = 0;
 
+            // Like clone(), but leaving this tag empty rather than copying
+            // its contents where they can be taken over
+            virtual Tag *moveClone() = 0;
+
         protected:
-            std::string _name;
+            friend class TagCompound;
+            friend class TagList;
+            friend class NbtPatch;
+
+            // Adds an owner, for a container sharing its children
+            Tag *share() const;
+
+            // Common part of the bodies of compounds and lists, see below
+            struct Container;
+
+            // Drop the cached encoding of a compound or list this tag
+            // owns the body of
+            virtual void dropCache();
+
+            InternedString _name;
+
+            // Arena the tag was constructed in, NULL on the heap
+            NbtArena *_arena;
+
+            // Containers holding this tag, or 1 when it is on its own
+            mutable std::atomic<unsigned int> _owners;
+
+            // XOR of the bodies holding this tag, so the one body while
+            // _owners is 1; 0 for a root
+            std::atomic<uintptr_t> _holders;
     };
 
 
@@ -144,18 +586,24 @@ namespace nbt
         public:
             TagByteArray(const std::string &name, unsigned char *values, unsigned int size);
             TagByteArray(const TagByteArray &t);
+            TagByteArray(TagByteArray &&t);
             virtual ~TagByteArray();
 
+            TagByteArray &operator=(const TagByteArray &t);
+            TagByteArray &operator=(TagByteArray &&t);
+
             const unsigned char *getValues() const;
             void setValues(unsigned char *values, unsigned int size);
 
             unsigned int getSize() const;
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             unsigned char *pValues;
@@ -173,54 +621,271 @@ namespace nbt
             void setValue(const int8_t &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             int8_t _value;
     };
 
 
+    // Compound key with its hash worked out up front. Keys built once, such
+    // as "static const CompoundKey pos(\"Pos\")", make repeated lookups
+    // hash-free. The name is not copied.
+    class CompoundKey
+    {
+        public:
+            CompoundKey(const char *name)
+                : _name(name), _hash(NbtStringPool::hash(_name)) {}
+            template <typename Alloc>
+            CompoundKey(const std::basic_string<char, std::char_traits<char>, Alloc> &name)
+                : _name(name), _hash(NbtStringPool::hash(_name)) {}
+            CompoundKey(const StringView &name)
+                : _name(name), _hash(NbtStringPool::hash(_name)) {}
+            CompoundKey(const InternedString &name)
+                : _name(name), _hash(name.getHash()) {}
+
+            const StringView &getName() const { return _name; }
+            uint32_t getHash() const { return _hash; }
+
+        private:
+            StringView _name;
+            uint32_t _hash;
+    };
+
+
+    // Storage behind TagCompound. Entries sit in one vector in insertion
+    // order, keyed by interned name, with their hashes alongside. Small
+    // compounds are searched by scanning the hashes; past SCAN_LIMIT
+    // entries an open-addressing index over the vector takes over.
+    class CompoundMap
+    {
+        public:
+            typedef std::pair<InternedString, Tag *> value_type;
+            typedef std::vector<value_type, ArenaAllocator<value_type> > Entries;
+            typedef Entries::const_iterator const_iterator;
+
+            static const size_t SCAN_LIMIT = 16;
+
+            const_iterator begin() const { return _entries.begin(); }
+            const_iterator end() const { return _entries.end(); }
+            size_t size() const { return _entries.size(); }
+            bool empty() const { return _entries.empty(); }
+
+            const_iterator find(const CompoundKey &key) const;
+
+            // Adds or replaces the entry for key and returns the tag it
+            // held before, if any
+            Tag *insert(const InternedString &key, Tag *tag);
+            void erase(const_iterator pos);
+            void clear();
+            void reserve(size_t size);
+
+            ArenaAllocator<value_type> get_allocator() const
+            {
+                return _entries.get_allocator();
+            }
+
+        private:
+            typedef std::vector<uint32_t, ArenaAllocator<uint32_t> > Hashes;
+
+            void rebuildIndex(size_t slots);
+            void addToIndex(size_t entry);
+
+            Entries _entries;
+            Hashes _hashes;
+
+            // Entry index plus one per slot, zero when free. Empty while
+            // the compound is small enough to scan.
+            Hashes _index;
+    };
+
+
+    // Payload of a compound or list as last written, so that writing it
+    // again is a copy. Stored once and never changed; a change anywhere
+    // below the container drops it, and the ones above. Only the outermost
+    // containers whose payload is at most getLimit() bytes keep one when
+    // written, so the bytes are not copied again for each level of
+    // nesting. Trees in an NbtArena keep none.
+    class EncodingCache
+    {
+        public:
+            EncodingCache();
+            ~EncodingCache();
+
+            // Bytes still valid, or NULL
+            const ByteArray *get() const;
+
+            // 64-bit hash of those bytes, worked out on first use; 0 when
+            // there are none
+            uint64_t getHash() const;
+
+            // Keep a copy of the bytes, unless some are already kept. A
+            // container sharing its contents with copies may only add.
+            void store(const uint8_t *data, size_t size, bool owned);
+            void store(const EncodingCache &other);
+
+            // Forget the bytes; false when there were none. A shared cache
+            // may be in use by other threads, so its bytes are only marked
+            // stale.
+            bool drop(bool owned);
+
+            // Largest payload kept, 64 KiB by default; 0 stops keeping any
+            static void setLimit(size_t limit);
+            static size_t getLimit();
+
+        private:
+            EncodingCache(const EncodingCache &);
+            EncodingCache &operator=(const EncodingCache &);
+
+            struct Entry
+            {
+                ByteArray bytes;
+                unsigned long epoch;
+                mutable std::atomic<uint64_t> hash;
+            };
+
+            std::atomic<Entry *> _entry;
+
+            // Bumped by a drop that has to leave the entry in place
+            std::atomic<unsigned long> _epoch;
+
+            static std::atomic<size_t> _limit;
+    };
+
+
+    // Owners and holders of the body of a compound or list. With XORs of
+    // the pointers on both sides, the one container above a tag is known
+    // exactly while neither is shared, which is all markDirty() needs.
+    struct Tag::Container
+    {
+        Container() : owners(0), holders(0) {}
+
+        // A compound or list takes a share of the body or lets go of it.
+        // release() is true for the last one, which then frees the body.
+        void acquire(const Tag *holder);
+        bool release(const Tag *holder);
+
+        // The body of holder is now that of other, as after a swap
+        void replace(const Tag *holder, const Tag *other);
+
+        // A child enters the body or leaves it. Leave before letting go of
+        // a shared child: once it is not ours, another thread may free it.
+        void adopt(Tag *child);
+        void disown(Tag *child);
+
+        std::atomic<unsigned int> owners;
+        std::atomic<uintptr_t> holders;
+        EncodingCache cache;
+    };
+
+
+    // Copies of a compound within one arena, or on the heap, share their
+    // entries, so clone() takes constant time. The first change to either
+    // side copies the entry table of that compound alone; children stay
+    // shared until edit() hands one out for modification. Changing a deep
+    // tag in a tree that has been cloned therefore copies only the path
+    // down to it, and the clone keeps seeing the tree as it was.
     class TagCompound : public Tag
     {
         public:
+            typedef CompoundMap Map;
+            typedef CompoundKey Key;
+
             TagCompound(const std::string &name = "");
             TagCompound(const TagCompound &t);
+            TagCompound(TagCompound &&t);
 
             ~TagCompound();
 
-            const std::map<std::string, Tag *>& getValue() const;
+            TagCompound &operator=(const TagCompound &t);
+            TagCompound &operator=(TagCompound &&t);
+
+            const Map& getValue() const;
             void setValue(std::list<Tag *> value);
 
+            // Adding a tag under a name already present replaces and frees
+            // the old one. Pointers passed in are owned by the compound.
             void insert(const Tag &tag);
+            void insert(Tag &&tag);
             void insert(Tag *tag);
-            void remove(const std::string &name);
+            void insert(std::unique_ptr<Tag> tag);
+            void remove(const Key &key);
+            void clear();
+            void reserve(size_t size);
 
+            // Child under key, ready to be modified: one still shared with a
+            // copy of this compound is replaced by a copy of its own first.
+            // NULL when there is no such child.
+            Tag *edit(const Key &key);
+            template <typename T>
+            T *edit(const Key &key);
+
+            // Construct a tag in place and insert it
+            template <typename T, typename... Args>
+            T *emplace(Args &&... args);
+
+            // Children, NULL when there is no such key. Through a non-const
+            // compound they are private to it as from edit(), so changing
+            // them leaves copies alone; the encoding is only dropped once
+            // they do change. Pointers taken before a copy was made are
+            // shared with that copy.
             std::vector<std::string> getKeys() const;
-            std::vector<Tag *> getValues() const;
-            Tag *getValueAt(const std::string &key) const;
+            std::vector<Tag *> getValues();
+            std::vector<const Tag *> getValues() const;
+            Tag *getValueAt(const Key &key);
+            const Tag *getValueAt(const Key &key) const;
+            template <typename T>
+            T *getValueAt(const Key &key);
             template <typename T>
-            T *getValueAt(const std::string &key) const;
+            const T *getValueAt(const Key &key) const;
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
-            int getInt(const std::string &key) const;
-            short getShort(const std::string &key) const;
-            char getByte(const std::string &key) const;
-            bool getBool(const std::string &key) const;
-            float getFloat(const std::string &key) const;
-            double getDouble(const std::string &key) const;
-            std::string getString(const std::string &key) const;
+            int getInt(const Key &key) const;
+            short getShort(const Key &key) const;
+            char getByte(const Key &key) const;
+            bool getBool(const Key &key) const;
+            float getFloat(const Key &key) const;
+            double getDouble(const Key &key) const;
+            std::string getString(const Key &key) const;
 
-            bool hasKey(const std::string &key) const;
+            bool hasKey(const Key &key) const;
         protected:
-            std::map<std::string, Tag *> _value;
+            friend class NbtPatch;
+
+            // Entries, with the number of compounds sharing them and the
+            // payload as last written
+            struct Body : Container
+            {
+                Map value;
+            };
+
+            Map::const_iterator find(const Key &key) const;
+
+            // Child under key, copied first if a copy of this compound
+            // shares it
+            Tag *privateChild(const Key &key, bool changing);
+
+            // Make the entries private to this compound. Unless they are
+            // about to change, the encoding is kept.
+            void detach(bool changing = true);
+            void releaseBody();
+            bool ownsBody() const;
+
+            virtual void dropCache();
+
+            Body *_body;
     };
 
 
@@ -234,10 +899,12 @@ namespace nbt
             void setValue(const double &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             double _value;
@@ -251,9 +918,12 @@ namespace nbt
             TagEnd(const TagEnd &t);
 
             virtual uint8_t getType() const;
+            virtual void write(NbtWriter &writer) const;
+            virtual size_t serializedSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
     };
 
@@ -268,10 +938,12 @@ namespace nbt
             void setValue(const float &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             float _value;
@@ -283,17 +955,26 @@ namespace nbt
         public:
             TagIntArray(const std::string &name, int* value, size_t size);
             TagIntArray(const TagIntArray &t);
+            TagIntArray(TagIntArray &&t);
             virtual ~TagIntArray();
 
-            int* getValues() const;
+            TagIntArray &operator=(const TagIntArray &t);
+            TagIntArray &operator=(TagIntArray &&t);
+
+            // Values to change in place; like edit(), this forgets the
+            // encodings above the array first
+            const int *getValues() const;
+            int *editValues();
             void setValues(int *values, unsigned int newSize);
             unsigned int getSize() const;
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             int* _values;
@@ -311,34 +992,68 @@ namespace nbt
             void setValue(const int32_t &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             int32_t _value;
     };
 
 
+    template <typename Source> class NbtDecoder;
+
+    // Lists of fixed-width values (bytes, shorts, ints, longs, floats and
+    // doubles) keep their elements packed in one array instead of one
+    // tag per element. Asking a non-const list for a child tag through
+    // at(), operator[], front(), back(), getValue(), edit() or append(Tag *)
+    // turns it into child tags for the rest of its life, until it is
+    // cleared. A const list stays packed and hands out read-only copies.
+    //
+    // Like compounds, copies of a list share their elements until one side
+    // changes; elements reached through a non-const list are its own.
     class TagList : public Tag
     {
         public:
+            typedef std::vector<Tag *, ArenaAllocator<Tag *> > Vector;
+            typedef std::vector<uint8_t, ArenaAllocator<uint8_t> > Packed;
+
             TagList(const uint8_t &type,
                     const std::string &name, 
                     const std::vector<Tag *> &value = std::vector<Tag *>());
             TagList(const TagList &t);
+            TagList(TagList &&t);
 
             ~TagList();
 
-            std::vector<Tag *> getValue() const;
+            TagList &operator=(const TagList &t);
+            TagList &operator=(TagList &&t);
+
+            // Elements; through a non-const list they are private to it, as
+            // for TagCompound::getValueAt()
+            std::vector<Tag *> getValue();
+            std::vector<const Tag *> getValue() const;
             void setValue(const std::vector<Tag *> &value);
 
             uint8_t getChildType() const;
             void setChildType(const uint8_t &value);
 
+            // Only tags of the child type are added. Pointers passed in
+            // are owned by the list, and freed right away when rejected.
             void append(const Tag &value);
+            void append(Tag &&value);
             void append(Tag *value);
+            void append(std::unique_ptr<Tag> value);
+            void reserve(size_t size);
+
+            // Construct an element in place and append it; NULL if it is
+            // not of the child type. A list of fixed width values is
+            // unpacked by this, append() a value there instead.
+            template <typename T, typename... Args>
+            T *emplace(Args &&... args);
 
             void removeFirst();
             void removeLast();
@@ -346,28 +1061,156 @@ namespace nbt
             void remove(size_t i);
             void clear();
 
-            Tag *at(size_t i) const;
-            Tag *back() const;
-            Tag *front() const;
+            // Replace count elements from start with values, which the list
+            // takes over like append(Tag *) does
+            void splice(size_t start, size_t count, const std::vector<Tag *> &values);
 
-            Tag *operator[](size_t index) const;
+            // Element i, ready to be modified, see TagCompound::edit()
+            Tag *edit(size_t i);
+            template <typename T>
+            T *edit(size_t i);
+
+            Tag *at(size_t i);
+            const Tag *at(size_t i) const;
+            Tag *back();
+            const Tag *back() const;
+            Tag *front();
+            const Tag *front() const;
+
+            Tag *operator[](size_t index);
+            const Tag *operator[](size_t index) const;
             TagList &operator<<(const Tag &tag);
 
             size_t size() const;
 
+            // Bulk access to the elements of a primitive list. A view is
+            // empty when the child type does not match, and stays valid
+            // until the list is next modified. Once a non-const at(),
+            // edit() and the like hand out element tags it is not packed;
+            // the values are then copied into storage, or the view is
+            // empty without it. Reading never changes the list itself.
+            bool isPacked() const;
+            ArrayView<int8_t> getBytes() const;
+            ArrayView<int16_t> getShorts() const;
+            ArrayView<int32_t> getInts() const;
+            ArrayView<int64_t> getLongs() const;
+            ArrayView<float> getFloats() const;
+            ArrayView<double> getDoubles() const;
+            ArrayView<int8_t> getBytes(std::vector<int8_t> &storage) const;
+            ArrayView<int16_t> getShorts(std::vector<int16_t> &storage) const;
+            ArrayView<int32_t> getInts(std::vector<int32_t> &storage) const;
+            ArrayView<int64_t> getLongs(std::vector<int64_t> &storage) const;
+            ArrayView<float> getFloats(std::vector<float> &storage) const;
+            ArrayView<double> getDoubles(std::vector<double> &storage) const;
+
+            // Fold the element tags of a primitive list back into packed
+            // values. Pointers to the elements are not valid past this.
+            void pack();
+
+            // Replaces the elements of a primitive list of matching type
+            void setValues(const int8_t *values, size_t count);
+            void setValues(const int16_t *values, size_t count);
+            void setValues(const int32_t *values, size_t count);
+            void setValues(const int64_t *values, size_t count);
+            void setValues(const float *values, size_t count);
+            void setValues(const double *values, size_t count);
+
             template<typename TagType, typename ValueType>
             void fillVariablesWithList(std::initializer_list<ValueType*> values);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
+            template <typename Source> friend class NbtDecoder;
+            friend class NbtPushParser;
+            friend class NbtPatch;
+
+            template <typename T>
+            ArrayView<T> packedValues(uint8_t type, std::vector<T> *storage) const;
+            template <typename T>
+            void setPackedValues(uint8_t type, const T *values, size_t count);
+
+            Tag *createChild(size_t i) const;
+            void packChildren(uint8_t *out) const;
+
+            // Element i, copied first if a copy of this list shares it
+            Tag *privateElement(size_t i, bool changing);
+
+            void unpack();
+
+            // Elements for const readers, made from the packed values
+            // without changing them, and dropped when those change
+            const Vector &readElements() const;
+            void dropReadView() const;
+
+            template <typename TagType, typename ValueType>
+            void fillFromPacked(std::initializer_list<ValueType*> values,
+                                std::true_type);
+            template <typename TagType, typename ValueType>
+            void fillFromPacked(std::initializer_list<ValueType*> values,
+                                std::false_type);
+
+            // Elements, with the number of lists sharing them and the
+            // payload as last written. Child tags are created lazily from
+            // the packed values.
+            struct Body : Container
+            {
+                Body() : packed(false), readView(NULL) {}
+
+                bool packed;
+                Vector value;
+                Packed packedValues;
+                std::atomic<Vector *> readView;
+            };
+
+            // Make the elements private to this list, as for compounds
+            void detach(bool changing = true);
+            void releaseBody() const;
+            bool ownsBody() const;
+
+            void writeElements(NbtWriter &writer) const;
+            virtual void dropCache();
+
             uint8_t _childType;
-            std::vector<Tag *> _value;
 
+            Body *_body;
+    };
+
+
+    class TagLongArray : public Tag
+    {
+        public:
+            TagLongArray(const std::string &name, int64_t *values, size_t size);
+            TagLongArray(const TagLongArray &t);
+            TagLongArray(TagLongArray &&t);
+            virtual ~TagLongArray();
+
+            TagLongArray &operator=(const TagLongArray &t);
+            TagLongArray &operator=(TagLongArray &&t);
+
+            // As for TagIntArray
+            const int64_t *getValues() const;
+            int64_t *editValues();
+            void setValues(int64_t *values, size_t newSize);
+            size_t getSize() const;
+
+            virtual uint8_t getType() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
+            virtual std::string toString() const;
+
+            virtual Tag *clone() const;
+            virtual Tag *moveClone();
+
+        protected:
+            int64_t *_values;
+            size_t _size;
     };
 
 
@@ -381,10 +1224,12 @@ namespace nbt
             void setValue(const int64_t &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             int64_t _value;
@@ -401,10 +1246,12 @@ namespace nbt
             void setValue(const int16_t &value);
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
             int16_t _value;
@@ -416,66 +1263,425 @@ namespace nbt
         public:
             TagString(const std::string &name, const std::string &value = "");
             TagString(const TagString &t);
+            TagString(TagString &&t);
+
+            TagString &operator=(const TagString &t);
+            TagString &operator=(TagString &&t);
 
             std::string getValue() const;
-            void setValue(const std::string &value);
+            void setValue(const StringView &value);
+
+            // An interned value is shared with every tag holding the same
+            // string. intern() moves the current value into NbtStringPool.
+            void setValue(const InternedString &value);
+            void intern();
+            bool isInterned() const;
+            const InternedString &getInternedValue() const;
 
             virtual uint8_t getType() const;
-            virtual ByteArray toByteArray() const;
+            virtual void writePayload(NbtWriter &writer) const;
+            virtual size_t payloadSize() const;
             virtual std::string toString() const;
 
             virtual Tag *clone() const;
+            virtual Tag *moveClone();
 
         protected:
-            std::string _value;
+            friend class NbtPatch;
+
+            StringView value() const;
+
+            // Only one of the two is in use; _value is empty when interned
+            NbtString _value;
+            InternedString _interned;
     };
 
-    class NbtBuffer
+    class NbtWriter
     {
-        typedef Tag *(NbtBuffer::*NbtMembFn)();
+        public:
+            NbtWriter(size_t reserve = 0);
+
+            // Big-endian primitives appended to the end of the buffer
+            void writeByte(int8_t value);
+            void writeShort(int16_t value);
+            void writeInt(int32_t value);
+            void writeLong(int64_t value);
+            void writeFloat(float value);
+            void writeDouble(double value);
+
+            // Raw bytes, and length-prefixed (modified UTF-8) strings
+            void writeBytes(const void *data, size_t len);
+            void writeString(const StringView &str);
+
+            // Arrays of host-order values, converted in bulk
+            void writeShorts(const int16_t *values, size_t count);
+            void writeInts(const int32_t *values, size_t count);
+            void writeLongs(const int64_t *values, size_t count);
+
+            void reserve(size_t size);
+            void clear();
 
+            const uint8_t *data() const;
+            size_t size() const;
+
+            const ByteArray &getBuffer() const;
+            ByteArray &getBuffer();
+
+            // Brackets the payload of a compound or list while it is
+            // written. Which ones get to keep their bytes in an
+            // EncodingCache is only known once the enclosing ones end.
+            class Encoding
+            {
+                public:
+                    Encoding(NbtWriter &writer);
+                    ~Encoding();
+
+                    // Ends the payload; cache is NULL for a container
+                    // that keeps none
+                    void keep(EncodingCache *cache, bool owned);
+
+                private:
+                    Encoding(const Encoding &);
+                    Encoding &operator=(const Encoding &);
+
+                    NbtWriter &_writer;
+                    size_t _start;
+                    size_t _first;
+                    bool _ended;
+            };
+
+        protected:
+            ByteArray _buffer;
+
+        private:
+            // Payloads that fit, waiting for an enclosing one to end
+            struct Pending
+            {
+                EncodingCache *cache;
+                size_t start;
+                size_t size;
+                bool owned;
+            };
+
+            void storePending(size_t first);
+
+            std::vector<Pending> _pending;
+            size_t _depth;
+    };
+
+    class NbtCursor;
+
+    // Read-only view of one tag inside uncompressed NBT data. Navigating
+    // and reading values works on the bytes in place without building
+    // any Tag; the data must outlive every view and cursor made from it.
+    // Reading a value of the wrong type yields 0 or an empty result.
+    class NbtView
+    {
+        public:
+            NbtView();
+            NbtView(const uint8_t *data, size_t size);
+
+            bool isValid() const;
+            uint8_t getType() const;
+            StringView getName() const;
+
+            // Compounds
+            NbtView getValueAt(const StringView &key) const;
+            NbtView operator[](const StringView &key) const;
+            bool hasKey(const StringView &key) const;
+
+            int getInt(const StringView &key) const;
+            short getShort(const StringView &key) const;
+            char getByte(const StringView &key) const;
+            bool getBool(const StringView &key) const;
+            int64_t getLong(const StringView &key) const;
+            float getFloat(const StringView &key) const;
+            double getDouble(const StringView &key) const;
+            StringView getString(const StringView &key) const;
+
+            // Lists, arrays and compounds
+            size_t size() const;
+            uint8_t getChildType() const;
+            NbtView at(size_t i) const;
+            NbtView operator[](size_t i) const;
+            NbtCursor children() const;
+
+            // Values
+            int8_t getByte() const;
+            int16_t getShort() const;
+            int32_t getInt() const;
+            int64_t getLong() const;
+            float getFloat() const;
+            double getDouble() const;
+            StringView getString() const;
+
+            // Byte arrays are returned in place, int and long array
+            // elements are converted on access
+            const uint8_t *getByteArray() const;
+            int32_t getIntAt(size_t i) const;
+            int64_t getLongAt(size_t i) const;
+
+            // Bytes making up the payload
+            const uint8_t *payload() const;
+            size_t payloadSize() const;
+
+        protected:
+            friend class NbtCursor;
+
+            NbtView(uint8_t type, const char *name, uint16_t nameLength,
+                    const uint8_t *payload, const uint8_t *end);
+
+            static const uint8_t *skipPayload(uint8_t type,
+                                              const uint8_t *pos,
+                                              const uint8_t *end);
+            static const uint8_t *readEntry(const uint8_t *pos,
+                                            const uint8_t *end,
+                                            NbtView &view);
+
+            uint8_t _type;
+            const char *_name;
+            uint16_t _nameLength;
+            const uint8_t *_payload;
+            const uint8_t *_end;
+    };
+
+    // Walks the entries of a compound or the elements of a list in order
+    class NbtCursor
+    {
+        public:
+            NbtCursor();
+            NbtCursor(const NbtView &parent);
+
+            // Moves to the next child, false once they are exhausted
+            bool next();
+
+            const NbtView &get() const;
+            const NbtView &operator*() const;
+            const NbtView *operator->() const;
+
+        protected:
+            uint8_t _parentType;
+            uint8_t _childType;
+            int32_t _remaining;
+            const uint8_t *_pos;
+            const uint8_t *_end;
+            NbtView _current;
+    };
+
+    // Paths into a tree, such as "Level.Sections[*].Y", for reads that only
+    // build the subtrees they select. Paths start below the root compound:
+    // "name" steps into a compound entry, "[n]" into element n of a list
+    // and "[*]" into every element. Compounds and lists on the way to a
+    // selected tag are built too, holding only what was selected below
+    // them; everything else is skipped without being decoded.
+    class NbtPathSet
+    {
+        public:
+            static const size_t ROOT = 0;
+            static const size_t NONE = static_cast<size_t>(-1);
+
+            NbtPathSet();
+            NbtPathSet(std::initializer_list<StringView> paths);
+
+            // Throws InvalidPathException on a malformed path
+            void add(const StringView &path);
+
+            bool empty() const;
+
+            // Walking the set: the node under node for a compound entry
+            // or list element, NONE when nothing there is selected
+            size_t field(size_t node, const StringView &name) const;
+            size_t element(size_t node, int32_t index) const;
+
+            // Whether the whole subtree at node is selected
+            bool isSelected(size_t node) const;
+
+        protected:
+            struct Step
+            {
+                std::string name;
+                int32_t index;  // -1 for [*], unused for names
+                bool isIndex;
+            };
+
+            struct Node
+            {
+                Node() : selected(false), anyElement(NONE) {}
+
+                bool selected;
+                std::vector<std::pair<std::string, size_t> > fields;
+                size_t anyElement;
+                std::vector<std::pair<int32_t, size_t> > elements;
+            };
+
+            static std::vector<Step> parse(const StringView &path);
+            void insert(size_t node, const std::vector<Step> &steps, size_t i);
+            size_t copyNode(size_t node);
+
+            std::vector<Node> _nodes;
+    };
+
+    // Receives a tree as a stream of events instead of as Tags, see
+    // NbtBuffer::visit() and NbtFile::visit(). Names, strings and arrays
+    // are only valid during the call that hands them out. List elements
+    // arrive with empty names. Every callback does nothing by default.
+    class NbtVisitor
+    {
+        public:
+            // Returned on entering a compound or list: CONTINUE into it,
+            // SKIP past it without further events (no matching end call),
+            // or STOP the whole walk
+            enum Action
+            {
+                CONTINUE,
+                SKIP,
+                STOP
+            };
+
+            virtual ~NbtVisitor();
+
+            virtual Action onBeginCompound(const StringView &name);
+            virtual void onEndCompound();
+            virtual Action onBeginList(const StringView &name, uint8_t childType,
+                                       int32_t size);
+            virtual void onEndList();
+
+            virtual void onByte(const StringView &name, int8_t value);
+            virtual void onShort(const StringView &name, int16_t value);
+            virtual void onInt(const StringView &name, int32_t value);
+            virtual void onLong(const StringView &name, int64_t value);
+            virtual void onFloat(const StringView &name, float value);
+            virtual void onDouble(const StringView &name, double value);
+            virtual void onString(const StringView &name, const StringView &value);
+
+            virtual void onByteArray(const StringView &name,
+                                     const ArrayView<uint8_t> &values);
+            virtual void onIntArray(const StringView &name,
+                                    const ArrayView<int32_t> &values);
+            virtual void onLongArray(const StringView &name,
+                                     const ArrayView<int64_t> &values);
+    };
+
+    // Compression settings for serialized trees. Gzip, zlib and raw
+    // deflate map onto zlib's window bits; NONE stores the bytes as they
+    // are. Level, strategy, window bits and memLevel have their zlib
+    // meaning and only matter when compressing.
+    class NbtCodec
+    {
+        public:
+            enum Format
+            {
+                NONE,
+                ZLIB,
+                GZIP,
+                RAW
+            };
+
+            NbtCodec(Format format = ZLIB, int level = Z_DEFAULT_COMPRESSION,
+                     int strategy = Z_DEFAULT_STRATEGY, int windowBits = MAX_WBITS,
+                     int memLevel = 8);
+
+            // Guess the format from the first bytes: the gzip magic, a zlib
+            // header, or an uncompressed TAG_Compound; anything else is
+            // taken as raw deflate
+            static Format sniff(const uint8_t *data, size_t length);
+
+            Format getFormat() const;
+            int getLevel() const;
+            int getStrategy() const;
+            int getWindowBits() const;
+            int getMemLevel() const;
+
+            // Worst-case compressed size of length input bytes
+            size_t bound(size_t length) const;
+
+            // Compress into out, which holds outLength bytes and should
+            // hold bound(length); outLength becomes the compressed size
+            bool compress(const uint8_t *data, size_t length,
+                          uint8_t *out, size_t &outLength) const;
+
+            // Inflate data into buffer, growing it in place as needed, and
+            // return the decompressed bytes, or NULL on a corrupt stream.
+            // NONE returns data itself. sizeHint sizes the buffer up front.
+            const uint8_t *decompress(const uint8_t *data, size_t length,
+                                      ByteArray &buffer, size_t &size,
+                                      size_t sizeHint = 0) const;
+
+        protected:
+            Format _format;
+            int _level;
+            int _strategy;
+            int _windowBits;
+            int _memLevel;
+    };
+
+    struct GzInput;
+    template <typename Input> class BufferedSource;
+
+    class NbtBuffer
+    {
         public:
             NbtBuffer();
             NbtBuffer(uint8_t *compressedBuffer, unsigned int length);
             virtual ~NbtBuffer();
 
-            void read(uint8_t *compressedBuffer, unsigned int length);
+            // Sniff the codec of the buffer, inflate it and parse it. False
+            // on a corrupt stream or bad NBT; getRoot() is then NULL.
+            bool read(uint8_t *compressedBuffer, unsigned int length);
+            bool read(uint8_t *compressedBuffer, unsigned int length,
+                      const NbtPathSet &paths);
+
+            // Stream the tree through visitor without building it. False
+            // on bad input; a visitor that stops early still succeeds.
+            bool visit(uint8_t *compressedBuffer, unsigned int length,
+                       NbtVisitor &visitor);
             char* write(Tag* tag, unsigned long& len);
             char* writeGzip(Tag* tag, unsigned int& len);
+            char* write(Tag* tag, unsigned long& len, const NbtCodec &codec);
+
+            // Decompress without building a tree; the view stays valid
+            // until the next readView() on this buffer, or points into
+            // compressedBuffer when that is not compressed
+            NbtView readView(uint8_t *compressedBuffer, unsigned int length);
 
             Tag *getRoot() const;
             void setRoot(const Tag &r);
+            void setRoot(Tag &&r);
+            void setRoot(std::unique_ptr<Tag> r);
 
-        protected:
-            void readBuffer(void* buf, unsigned len);
+            // Hand the tree over to the caller
+            Tag *release();
 
-            Tag *readTag();
+            // Parse into arena instead of the heap. The tree then belongs
+            // to the arena and is released by resetting it; getRoot() is
+            // not valid past that point.
+            void setArena(NbtArena *arena);
+            NbtArena *getArena() const;
 
-            Tag *readByte();
-            Tag *readShort();
-            Tag *readInt();
-            Tag *readLong();
-            Tag *readFloat();
-            Tag *readDouble();
-            Tag *readByteArray();
-            Tag *readString();
-            Tag *readList();
-            Tag *readCompound();
-            Tag *readIntArray();
+            // Intern TAG_String values in NbtStringPool while parsing
+            void setInternStrings(bool intern);
+            bool getInternStrings() const;
 
-            static const NbtMembFn readerFunctions[];
+            // Expected inflated size, used to size the output up front.
+            // Zero falls back to the gzip trailer or a ratio estimate.
+            void setSizeHint(size_t bytes);
+            size_t getSizeHint() const;
+
+        protected:
+            bool decode(uint8_t *compressedBuffer, unsigned int length,
+                        const NbtPathSet *paths);
 
             Tag *_root;
+            bool _ownsRoot;
+            NbtArena *_arena;
+            bool _internStrings;
+            size_t _sizeHint;
 
-            uint8_t *_buffer; //will be NULL if not in the middle of a read() !
-            size_t bufferSize;
-            size_t bufferPos;
+            ByteArray _viewBuffer;
     };
 
     class NbtFile
     {
-        typedef Tag *(NbtFile::*NbtMembFn)();
-
         public:
             NbtFile();
             NbtFile(const std::string &fname);
@@ -485,54 +1691,754 @@ namespace nbt
                       const std::string &flags = "r") throw (GzipIOException);
             void close();
             void read() throw (GzipIOException);
+            void read(const NbtPathSet &paths) throw (GzipIOException);
+
+            // Stream the tree through visitor without building it
+            void visit(NbtVisitor &visitor) throw (GzipIOException);
             void write() throw (GzipIOException);
 
+            // How write() compresses; gzip at the default level unless set
+            // before open(). Reading sniffs the format of the file instead.
+            // Gzip files take level and strategy but not window or memLevel.
+            void setCodec(const NbtCodec &codec);
+            const NbtCodec &getCodec() const;
+
             Tag *getRoot() const;
             void setRoot(const Tag &r);
+            void setRoot(Tag &&r);
+            void setRoot(std::unique_ptr<Tag> r);
+
+            // Parse into arena instead of the heap. The tree then belongs
+            // to the arena and is released by resetting it; getRoot() is
+            // not valid past that point.
+            void setArena(NbtArena *arena);
+            NbtArena *getArena() const;
+
+            // Intern TAG_String values in NbtStringPool while parsing
+            void setInternStrings(bool intern);
+            bool getInternStrings() const;
+
+            // Largest array or list a gzip or uncompressed file may declare,
+            // in bytes; 64 MiB unless set. Longer ones fail the read
+            // instead of being allocated up front.
+            void setMaxLength(size_t bytes);
 
         protected:
-            NbtMembFn getReader(uint8_t type);
-
-            Tag *readTag();
-
-            Tag *readByte();
-            Tag *readShort();
-            Tag *readInt();
-            Tag *readLong();
-            Tag *readFloat();
-            Tag *readDouble();
-            Tag *readByteArray();
-            Tag *readString();
-            Tag *readList();
-            Tag *readCompound();
-            Tag *readIntArray();
+            void decode(const NbtPathSet *paths);
+            void traverse(NbtVisitor &visitor);
+            const uint8_t *loadDeflated(size_t &size);
 
             std::string _fname;
             Tag *_root;
+            bool _ownsRoot;
+            NbtArena *_arena;
+            bool _internStrings;
+            NbtCodec _codec;
+            ByteArray _deflated;
+            ByteArray _inflated;
 
             gzFile _file;
+            BufferedSource<GzInput> *_source;
+    };
+
+    // Incremental parser for a tree that arrives in pieces, such as off a
+    // socket. Each feed() takes whatever bytes are at hand and parses as
+    // far as they go, keeping its place in an explicit stack rather than
+    // on the call stack.
+    class NbtPushParser
+    {
+        public:
+            enum Status
+            {
+                NEED_MORE,  // The tree is not complete yet
+                COMPLETE,   // getRoot() holds the whole tree
+                FAILED      // Bad input, until reset()
+            };
+
+            // With compressed, input is a gzip or zlib stream, and the
+            // tree is only complete at the end of that stream
+            NbtPushParser(bool compressed = false);
+            virtual ~NbtPushParser();
+
+            Status feed(const uint8_t *data, size_t length);
+            Status getStatus() const;
+
+            // Bytes of the last feed() that came after the end of the tree
+            size_t getUnconsumed() const;
+
+            // Start over, dropping the tree and anything buffered
+            void reset();
+
+            // The tree so far, complete once feed() returned COMPLETE
+            Tag *getRoot() const;
+
+            // Hand the tree over to the caller
+            Tag *release();
+
+            // Parse into arena instead of the heap, as for NbtBuffer
+            void setArena(NbtArena *arena);
+            NbtArena *getArena() const;
+
+            // Largest array or list payload, in bytes, accepted from the
+            // input. Lengths are trusted only up to this point.
+            void setMaxLength(size_t bytes);
+
+        protected:
+            struct Frame
+            {
+                Tag *tag;
+                int32_t remaining;  // Elements left in a list
+            };
+
+            Status parse();
+            bool readHeader();
+            bool readPayload();
+            void beginTag(uint8_t type, Tag *tag);
+            bool checkLength(int32_t length, size_t elemSize);
+            void beginBulk(void *dst, size_t count, size_t elemSize);
+            void finishBulk();
+            void fail();
+
+            size_t available() const { return _buffer.size() - _pos; }
+            const uint8_t *current() const { return _buffer.data() + _pos; }
+
+            Status _status;
+            Tag *_root;
+            bool _ownsRoot;
+            NbtArena *_arena;
+            size_t _maxLength;
+
+            ByteArray _buffer;
+            size_t _pos;
+            size_t _unconsumed;
+
+            std::vector<Frame> _stack;
+
+            // Tag whose payload is still to come
+            Tag *_current;
+            uint8_t _currentType;
+
+            // Array payload being filled in across feeds
+            uint8_t *_bulk;
+            void *_bulkStart;
+            size_t _bulkRemaining;
+            size_t _bulkCount;
+            size_t _bulkElemSize;
+
+            bool _compressed;
+            bool _streamEnd;
+            bool _treeEnd;
+            z_stream _stream;
+    };
+
+    // Read-only Anvil region file (.mca) of 32x32 chunks. The file is
+    // mapped into memory and chunk payloads are handed out in place.
+    // Chunk coordinates are taken modulo 32, so world chunk coordinates
+    // can be passed directly.
+    class RegionFile
+    {
+        public:
+            enum
+            {
+                SECTOR_SIZE = 4096,
+                CHUNK_COUNT = 1024,
+                HEADER_SIZE = 2 * SECTOR_SIZE
+            };
+
+            // Compression byte in front of each chunk payload
+            enum Compression
+            {
+                COMPRESSION_GZIP = 1,
+                COMPRESSION_ZLIB = 2,
+                COMPRESSION_NONE = 3
+            };
+
+            // Hints passed on to madvise for the whole mapping
+            enum Access
+            {
+                ACCESS_NORMAL,
+                ACCESS_SEQUENTIAL,
+                ACCESS_RANDOM
+            };
+
+            // Opening throws RegionIOException with errno when the file
+            // cannot be opened or mapped
+            RegionFile();
+            RegionFile(const std::string &fname);
+            virtual ~RegionFile();
+
+            void open(const std::string &fname);
+            void close();
+            bool isOpen() const;
+
+            // Raw header tables: sector offset and count, and the last
+            // save time in seconds, per chunk
+            uint32_t getSectorOffset(int x, int z) const;
+            uint8_t getSectorCount(int x, int z) const;
+            uint32_t getTimestamp(int x, int z) const;
+            bool hasChunk(int x, int z) const;
+
+            // Compressed payload of a chunk inside the mapping, empty when
+            // the chunk is missing, stored externally or out of bounds
+            ArrayView<uint8_t> getChunkData(int x, int z) const;
+            uint8_t getCompression(int x, int z) const;
+
+            // Decode a chunk into buffer; false if missing or corrupt
+            bool readChunk(int x, int z, NbtBuffer &buffer) const;
+
+            void setAccess(Access access);
+
+            // Ask the kernel to start reading a chunk in ahead of use
+            void prefetch(int x, int z) const;
+
+        protected:
+            static int index(int x, int z) { return (x & 31) + (z & 31) * 32; }
+
+            const uint8_t *_data;
+            size_t _size;
+    };
+
+    // Saves chunks into an Anvil region file in place. A chunk goes to
+    // the smallest run of free sectors that holds it, or the end of the
+    // file, and its header entry is switched over only once the payload
+    // is written, so an interrupted save leaves the previous copy intact.
+    // A RegionFile mapping of the same file should not be kept across
+    // compact(), which truncates it.
+    class RegionWriter
+    {
+        public:
+            // Everything that touches the file throws RegionIOException
+            // when it fails, with errno, EBADF when nothing is open, EFBIG
+            // for a chunk too large to store, or EINVAL for a codec the
+            // format has no compression byte for
+            RegionWriter();
+            RegionWriter(const std::string &fname);
+            virtual ~RegionWriter();
+
+            // Opens or creates the file, reading its header tables
+            void open(const std::string &fname);
+            void close();
+            bool isOpen() const;
+
+            // Store a payload as produced by NbtBuffer::write or writeGzip,
+            // compression being one of RegionFile::Compression. A zero
+            // timestamp means now.
+            void writeChunk(int x, int z, const uint8_t *data, size_t length,
+                            uint8_t compression, uint32_t timestamp = 0);
+
+            // Serialize and compress root with a gzip, zlib or no-op codec
+            void writeChunk(int x, int z, Tag *root,
+                            const NbtCodec &codec = NbtCodec(NbtCodec::ZLIB));
+
+            void removeChunk(int x, int z);
+
+            // Move chunks from the end of the file into earlier holes and
+            // truncate what is left free; chunks already packed stay where
+            // they are. Returns the number of sectors reclaimed.
+            size_t compact();
+
+            // Flush each payload to disk before the header points at it, and
+            // the header before the sectors it replaces are reused
+            void setSync(bool sync);
+            bool getSync() const;
+
+            size_t getSectorCount() const;
+            size_t getFreeSectorCount() const;
+
+        protected:
+            static int index(int x, int z) { return (x & 31) + (z & 31) * 32; }
+
+            bool findFree(size_t count, size_t limit, size_t &start) const;
+            size_t allocate(size_t count);
+            void place(int i, size_t start, const uint8_t *sectors, size_t count,
+                       uint32_t timestamp);
+            void writeAll(const void *data, size_t length, off_t offset);
+            void mark(size_t start, size_t count, bool used);
+
+            int _fd;
+            bool _sync;
+
+            // Header location table in host order
+            uint32_t _locations[RegionFile::CHUNK_COUNT];
+            std::vector<bool> _used;
+    };
+
+    // Decodes batches of compressed trees on a fixed set of threads. Each
+    // batch is split evenly over the threads up front, and a thread that
+    // runs out of work steals from the far end of another's queue, so a
+    // few slow chunks do not hold the rest back.
+    //
+    // Callbacks run on the pool threads, possibly at the same time, and
+    // own the tree they are given; it is NULL when the input was corrupt.
+    class NbtDecodePool
+    {
+        public:
+            typedef std::function<void (size_t index, Tag *root)> Callback;
+            typedef std::function<void (int x, int z, Tag *root)> ChunkCallback;
+
+            // Zero threads means one per hardware thread
+            NbtDecodePool(unsigned int threads = 0);
+            virtual ~NbtDecodePool();
+
+            unsigned int getThreadCount() const;
+
+            // Decode every buffer, calling back as each one finishes, and
+            // return once all are done
+            void decode(const std::vector<ArrayView<uint8_t> > &buffers,
+                        const Callback &callback);
+
+            // Decode every buffer into the matching slot of the result
+            std::vector<Tag *> decode(const std::vector<ArrayView<uint8_t> > &buffers);
+
+            // Decode every chunk present in region
+            void decode(const RegionFile &region, const ChunkCallback &callback);
+
+            // Intern TAG_String values in NbtStringPool while parsing
+            void setInternStrings(bool intern);
+            bool getInternStrings() const;
+
+            // Run job(0) to job(count - 1) across the pool and wait for them.
+            // The first exception a job throws is rethrown here once the
+            // rest have run. Called from within one of the pool's own jobs,
+            // the jobs run one after another on the calling thread, since
+            // the pool is busy with the outer batch.
+            void run(size_t count, const std::function<void (size_t)> &job);
+
+        protected:
+            // Tasks carry their batch, so a thread still looking for work
+            // when one batch ends picks up the next one correctly
+            struct Task
+            {
+                const std::function<void (size_t)> *job;
+                size_t index;
+            };
+
+            struct Worker
+            {
+                std::thread thread;
+                std::mutex lock;
+                std::deque<Task> tasks;
+            };
+
+            void work(size_t self);
+            bool take(size_t self, Task &task);
+
+            std::vector<Worker *> _workers;
+            bool _internStrings;
+
+            // One batch runs at a time
+            std::mutex _runLock;
+
+            std::mutex _lock;
+            std::condition_variable _wake;
+            std::condition_variable _done;
+            size_t _pending;
+            unsigned long _generation;
+            bool _stopping;
+
+            // First exception out of a job in the running batch
+            std::exception_ptr _error;
+    };
+
+    class NbtImage;
+
+    // Read-only view of one tag inside an NbtImage, answering the same
+    // queries as the Tag classes straight from the image. Views are small
+    // values and stay valid as long as the image does. Reading a value of
+    // the wrong type yields 0 or an empty result.
+    class NbtImageView
+    {
+        public:
+            NbtImageView();
+
+            bool isValid() const;
+            uint8_t getType() const;
+            std::string getName() const;
+
+            // Compounds, searched by key id
+            NbtImageView getValueAt(const StringView &key) const;
+            NbtImageView operator[](const StringView &key) const;
+            bool hasKey(const StringView &key) const;
+
+            int getInt(const StringView &key) const;
+            short getShort(const StringView &key) const;
+            char getByte(const StringView &key) const;
+            bool getBool(const StringView &key) const;
+            int64_t getLong(const StringView &key) const;
+            float getFloat(const StringView &key) const;
+            double getDouble(const StringView &key) const;
+            StringView getString(const StringView &key) const;
+
+            // Lists, arrays and compounds; compound entries are in key order
+            size_t size() const;
+            uint8_t getChildType() const;
+            NbtImageView at(size_t i) const;
+            NbtImageView operator[](size_t i) const;
+
+            // Values
+            int8_t getByte() const;
+            int16_t getShort() const;
+            int32_t getInt() const;
+            int64_t getLong() const;
+            float getFloat() const;
+            double getDouble() const;
+            StringView getString() const;
+
+            // Arrays, and lists of fixed width values, in place
+            ArrayView<uint8_t> getByteArray() const;
+            ArrayView<int32_t> getIntArray() const;
+            ArrayView<int64_t> getLongArray() const;
+
+            ArrayView<int8_t> getBytes() const;
+            ArrayView<int16_t> getShorts() const;
+            ArrayView<int32_t> getInts() const;
+            ArrayView<int64_t> getLongs() const;
+            ArrayView<float> getFloats() const;
+            ArrayView<double> getDoubles() const;
+
+            // Copy the subtree back out into ordinary tags; NULL if the
+            // image turns out to be corrupt below this point
+            Tag *toTag() const;
+
+        protected:
+            friend class NbtImage;
+
+            static const uint32_t NO_KEY = 0xffffffff;
+
+            NbtImageView(const NbtImage *image, const uint8_t *node, uint32_t key);
+            NbtImageView(const NbtImage *image, uint8_t type, const uint8_t *value);
+
+            template <typename T>
+            T scalar(uint8_t type) const;
+            template <typename T>
+            ArrayView<T> elements(uint8_t type, uint8_t childType) const;
+
+            const NbtImage *_image;
+            uint8_t _type;
+            uint8_t _childType;
+            uint32_t _count;
+            uint32_t _key;
+
+            // Inline value, or offset to out of line data, of the node; or
+            // the element itself in a list of fixed width values
+            const uint8_t *_value;
+    };
+
+    // Relocatable image of a tree that is queried in place, without any
+    // parsing, from a file mapping or any other memory. compile() lays a
+    // tree out once in the host byte order: each tag is a 16 byte record,
+    // everything is reached by offsets from the start of the image, tag
+    // names share one sorted, prefix-compressed key dictionary, and
+    // arrays are 8 byte aligned. Images only load on hosts of the same
+    // byte order.
+    class NbtImage
+    {
+        public:
+            // File and shared memory calls throw ImageIOException with
+            // errno, EFBIG past the offset range, or EINVAL for something
+            // that is not a usable image
+            NbtImage();
+            NbtImage(const std::string &fname);
+            virtual ~NbtImage();
+
+            // Lay root out as an image; empty past the 4 GiB offset range
+            static ByteArray compile(const Tag &root);
+            static void compile(const Tag &root, const std::string &fname);
+
+            // Map a compiled image file read-only
+            void open(const std::string &fname);
+
+            // Compile root into the POSIX shared memory object name, which
+            // other processes then map read-only with openShared(). Offsets
+            // make the image valid at whatever address each one maps it.
+            // The segment stays until unlinkShared(), even with no process
+            // attached. Republishing under the same name affects later
+            // openShared() calls only.
+            static void publishShared(const Tag &root, const std::string &name);
+            void openShared(const std::string &name);
+            static void unlinkShared(const std::string &name);
+
+            // Use an image already in memory, which must be 8 byte aligned
+            // and outlive this object. False if it is not a usable image.
+            bool attach(const void *data, size_t size);
+            void close();
+
+            bool isValid() const;
+            const uint8_t *data() const;
+            size_t size() const;
+
+            NbtImageView getRoot() const;
+
+            // Key dictionary; ids follow the sorted order of the keys
+            size_t getKeyCount() const;
+            std::string getKey(uint32_t id) const;
+            bool findKey(const StringView &key, uint32_t &id) const;
+
+        protected:
+            friend class NbtImageView;
+
+            // Image bytes at offset, NULL unless length of them are there
+            const uint8_t *at(uint64_t offset, uint64_t length) const;
+
+            // Map fd read-only and take it over
+            void map(int fd);
+
+            const uint8_t *_data;
+            size_t _size;
+
+            // Length of our own mapping, 0 for attached memory
+            size_t _mapSize;
     };
 
+    class MemorySource;
+
+    // Binary delta between two versions of a tree, to send changes rather
+    // than whole trees. A patch sets and removes compound entries, splices
+    // ranges of list elements and rewrites ranges of arrays, descending
+    // only where the versions differ. Subtrees the versions share (see
+    // TagCompound), or whose cached encodings match by hash and bytes, are
+    // skipped without a walk, so diffing a tree against an edited clone of
+    // it costs about as much as the edits did. Entries a patch adds to a
+    // compound go last.
+    class NbtPatch
+    {
+        public:
+            // Patch turning oldTag into newTag; empty when they are alike
+            static ByteArray diff(const Tag &oldTag, const Tag &newTag);
+
+            // A new tree made by patching base, which has to be the tree
+            // the patch was made from; NULL on a malformed or mismatched
+            // patch. Unchanged subtrees are shared with base as by clone().
+            static Tag *apply(const Tag &base, const uint8_t *patch, size_t size);
+            static Tag *apply(const Tag &base, const ByteArray &patch);
+
+        protected:
+            static const uint8_t VERSION = 1;
+
+            // What happens to a tag
+            enum Op
+            {
+                OP_NONE,
+                OP_REPLACE,     // type, payload; only for the root
+                OP_COMPOUND,    // entry count, then entry ops
+                OP_LIST,        // op count, then list ops
+                OP_ARRAY        // new size, range count, then ranges
+            };
+
+            // Compound entry ops, each followed by the key
+            enum EntryOp
+            {
+                ENTRY_SET = 1,  // type, payload
+                ENTRY_REMOVE,
+                ENTRY_EDIT      // nested op
+            };
+
+            // List ops, applied one after the other
+            enum ListOp
+            {
+                LIST_SPLICE = 1,    // start, removed, inserted, payloads
+                LIST_EDIT           // index, nested op
+            };
+
+            enum Match
+            {
+                SAME,
+                DIFFERENT,
+                UNKNOWN
+            };
+
+            // Decided without walking containers that keep no encoding
+            static Match match(const Tag &a, const Tag &b);
+            static bool editable(const Tag &a, const Tag &b);
+
+            // Write the op making a into b, of the same editable type.
+            // False, with nothing written, when they turn out alike.
+            static bool diffTag(const Tag &a, const Tag &b, NbtWriter &out);
+            static bool diffCompound(const TagCompound &a, const TagCompound &b,
+                                     NbtWriter &out);
+            static bool diffList(const TagList &a, const TagList &b, NbtWriter &out);
+            static bool diffPacked(const TagList &a, const TagList &b, NbtWriter &out);
+            static bool diffArray(const Tag &a, const Tag &b, NbtWriter &out);
+
+            static bool applyTag(Tag *tag, uint8_t op, MemorySource &source);
+            static bool applyCompound(TagCompound *tag, MemorySource &source);
+            static bool applyList(TagList *tag, MemorySource &source);
+            static bool applyArray(Tag *tag, MemorySource &source);
+    };
+
+    template <typename T, typename... Args>
+    inline T *TagCompound::emplace(Args &&... args)
+    {
+        T *tag = new T(std::forward<Args>(args)...);
+        insert(tag);
+        return tag;
+    }
+
+    template <typename T, typename... Args>
+    inline T *TagList::emplace(Args &&... args)
+    {
+        T *tag = new T(std::forward<Args>(args)...);
+        if (tag->getType() != _childType)
+        {
+            Tag::destroy(tag);
+            return NULL;
+        }
+
+        append(tag);
+        return tag;
+    }
+
+    template <typename T>
+    inline T *NbtArena::newArray(size_t n)
+    {
+        NbtArena *arena = current();
+        if (arena)
+            return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+
+        return new T[n];
+    }
+
+    template <typename T>
+    inline T *NbtArena::newObject()
+    {
+        NbtArena *arena = current();
+        if (arena)
+            return new (arena->allocate(sizeof(T), alignof(T))) T();
+
+        return new T();
+    }
+
+    inline void NbtWriter::writeByte(int8_t value)
+    {
+        _buffer.push_back(static_cast<uint8_t>(value));
+    }
+
+    inline void NbtWriter::writeShort(int16_t value)
+    {
+        uint16_t val = htobe16(static_cast<uint16_t>(value));
+        writeBytes(&val, sizeof(val));
+    }
+
+    inline void NbtWriter::writeInt(int32_t value)
+    {
+        uint32_t val = htobe32(static_cast<uint32_t>(value));
+        writeBytes(&val, sizeof(val));
+    }
+
+    inline void NbtWriter::writeLong(int64_t value)
+    {
+        uint64_t val = htobe64(static_cast<uint64_t>(value));
+        writeBytes(&val, sizeof(val));
+    }
+
+    inline void NbtWriter::writeFloat(float value)
+    {
+        union
+        {
+            float f;
+            int32_t i;
+        } val;
+        val.f = value;
+        writeInt(val.i);
+    }
+
+    inline void NbtWriter::writeDouble(double value)
+    {
+        union
+        {
+            double d;
+            int64_t l;
+        } val;
+        val.d = value;
+        writeLong(val.l);
+    }
+
+
+    inline void NbtWriter::writeBytes(const void *data, size_t len)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        _buffer.insert(_buffer.end(), bytes, bytes + len);
+    }
+
+    template<typename T>
+    inline T* TagCompound::getValueAt(const Key& key)
+    {
+        return dynamic_cast<T*>(getValueAt(key));
+    }
+
     template<typename T>
-    inline T* TagCompound::getValueAt(const std::string& key) const
+    inline const T* TagCompound::getValueAt(const Key& key) const
     {
-        auto tagItr = _value.find(key);
-        if (tagItr != _value.end())
+        auto tagItr = find(key);
+        if (tagItr != _body->value.end())
         {
-            return dynamic_cast<T*>(tagItr->second);
+            return dynamic_cast<const T*>(tagItr->second);
         }
         return nullptr;
     }
 
+    template <typename T>
+    inline T *TagCompound::edit(const Key &key)
+    {
+        return dynamic_cast<T *>(edit(key));
+    }
+
+    template <typename T>
+    inline T *TagList::edit(size_t i)
+    {
+        return dynamic_cast<T *>(edit(i));
+    }
+
+
+    // Element type of the tags a list can keep packed
+    template <typename TagType>
+    struct PackedElement
+    {
+        enum { type = TAG_END };
+    };
+
+    template <> struct PackedElement<TagByte>   { enum { type = TAG_BYTE };   typedef int8_t  Type; };
+    template <> struct PackedElement<TagShort>  { enum { type = TAG_SHORT };  typedef int16_t Type; };
+    template <> struct PackedElement<TagInt>    { enum { type = TAG_INT };    typedef int32_t Type; };
+    template <> struct PackedElement<TagLong>   { enum { type = TAG_LONG };   typedef int64_t Type; };
+    template <> struct PackedElement<TagFloat>  { enum { type = TAG_FLOAT };  typedef float   Type; };
+    template <> struct PackedElement<TagDouble> { enum { type = TAG_DOUBLE }; typedef double  Type; };
+
+
+    template <typename T>
+    inline ArrayView<T> TagList::packedValues(uint8_t type, std::vector<T> *storage) const
+    {
+        if (_childType != type)
+            return ArrayView<T>();
+
+        if (_body->packed)
+            return ArrayView<T>(reinterpret_cast<const T *>(_body->packedValues.data()),
+                                _body->packedValues.size() / sizeof(T));
+
+        if (storage == NULL)
+            return ArrayView<T>();
+
+        storage->resize(_body->value.size());
+        packChildren(reinterpret_cast<uint8_t *>(storage->data()));
+        return ArrayView<T>(storage->data(), storage->size());
+    }
+
 
     template<typename TagType, typename ValueType>
     inline void TagList::fillVariablesWithList(std::initializer_list<ValueType*> values)
     {
-        size_t countTag = _value.size();
+        if (_body->packed)
+        {
+            fillFromPacked<TagType>(values,
+                std::integral_constant<bool, int(PackedElement<TagType>::type) != TAG_END>());
+            return;
+        }
+
+        size_t countTag = _body->value.size();
         auto itr = values.begin();
-        for (size_t i = 0; i < countTag; i++)
+        for (size_t i = 0; i < countTag && itr != values.end(); i++)
         {
-            nbt::Tag* tag = _value[i];
+            nbt::Tag* tag = _body->value[i];
             if (tag == nullptr)
                 continue;
             TagType* tagValue = dynamic_cast<TagType*>(tag);
@@ -544,6 +2450,29 @@ namespace nbt
     }
 
 
+    template <typename TagType, typename ValueType>
+    inline void TagList::fillFromPacked(std::initializer_list<ValueType*> values,
+                                        std::true_type)
+    {
+        typedef typename PackedElement<TagType>::Type Type;
+        ArrayView<Type> packed = packedValues<Type>(PackedElement<TagType>::type, NULL);
+
+        auto itr = values.begin();
+        for (size_t i = 0; i < packed.size() && itr != values.end(); i++, itr++)
+            **itr = packed[i];
+    }
+
+
+    template <typename TagType, typename ValueType>
+    inline void TagList::fillFromPacked(std::initializer_list<ValueType*>,
+                                        std::false_type)
+    {
+        // Packed lists only ever hold primitive values
+    }
+
+
 }
 
+#include "nbtdecoder.h"
+
 #endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    namespace
+    {
+        // Eight bytes a step; equal hashes still need the bytes compared
+        uint64_t hashBytes(const uint8_t *data, size_t size)
+        {
+            uint64_t ret = 0x9e3779b97f4a7c15ull ^ size;
+            uint64_t word;
+
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                memcpy(&word, data + i, 8);
+                ret = (ret ^ word) * 0xff51afd7ed558ccdull;
+                ret ^= ret >> 32;
+            }
+
+            word = 0;
+            memcpy(&word, data + i, size - i);
+            ret = (ret ^ word) * 0xc4ceb9fe1a85ec53ull;
+            ret ^= ret >> 29;
+
+            return ret;
+        }
+    }
+
+
+    std::atomic<size_t> EncodingCache::_limit(65536);
+
+
+    EncodingCache::EncodingCache()
+        : _entry(NULL)
+        , _epoch(0)
+    {
+    }
+
+
+    EncodingCache::~EncodingCache()
+    {
+        delete _entry.load(std::memory_order_acquire);
+    }
+
+
+    const ByteArray *EncodingCache::get() const
+    {
+        Entry *entry = _entry.load(std::memory_order_acquire);
+        if (entry == NULL || entry->epoch != _epoch.load(std::memory_order_acquire))
+            return NULL;
+
+        return &entry->bytes;
+    }
+
+
+    uint64_t EncodingCache::getHash() const
+    {
+        Entry *entry = _entry.load(std::memory_order_acquire);
+        if (entry == NULL || entry->epoch != _epoch.load(std::memory_order_acquire))
+            return 0;
+
+        // Racing threads work out the same value
+        uint64_t ret = entry->hash.load(std::memory_order_relaxed);
+        if (ret == 0)
+        {
+            ret = hashBytes(entry->bytes.data(), entry->bytes.size());
+            if (ret == 0)
+                ret = 1;
+
+            entry->hash.store(ret, std::memory_order_relaxed);
+        }
+
+        return ret;
+    }
+
+
+    void EncodingCache::store(const uint8_t *data, size_t size, bool owned)
+    {
+        if (size > _limit.load(std::memory_order_relaxed))
+            return;
+
+        Entry *old = _entry.load(std::memory_order_acquire);
+        if (old != NULL)
+        {
+            // Stale bytes can only be freed by the one owner; others may
+            // still be reading them
+            if (!owned || get() != NULL)
+                return;
+
+            _entry.store(NULL, std::memory_order_relaxed);
+            delete old;
+        }
+
+        Entry *entry = new Entry;
+        entry->bytes.assign(data, data + size);
+        entry->hash.store(0, std::memory_order_relaxed);
+        entry->epoch = _epoch.load(std::memory_order_acquire);
+
+        // Copies encoding the same contents on other threads may race us
+        Entry *expected = NULL;
+        if (!_entry.compare_exchange_strong(expected, entry, std::memory_order_acq_rel))
+            delete entry;
+    }
+
+
+    void EncodingCache::store(const EncodingCache &other)
+    {
+        const ByteArray *bytes = other.get();
+        if (bytes != NULL)
+            store(bytes->data(), bytes->size(), true);
+    }
+
+
+    bool EncodingCache::drop(bool owned)
+    {
+        if (get() == NULL)
+            return false;
+
+        if (!owned)
+        {
+            _epoch.fetch_add(1, std::memory_order_acq_rel);
+            return true;
+        }
+
+        delete _entry.exchange(NULL, std::memory_order_acq_rel);
+        return true;
+    }
+
+
+    void EncodingCache::setLimit(size_t limit)
+    {
+        _limit.store(limit, std::memory_order_relaxed);
+    }
+
+
+    size_t EncodingCache::getLimit()
+    {
+        return _limit.load(std::memory_order_relaxed);
+    }
+
+}
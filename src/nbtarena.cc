@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace nbt
+{
+    thread_local NbtArena *NbtArena::_current = NULL;
+
+    NbtArena::NbtArena(size_t blockSize)
+        : _blocks(NULL), _pos(NULL), _limit(NULL),
+          _blockSize(blockSize), _bytesAllocated(0)
+    {
+    }
+
+
+    NbtArena::~NbtArena()
+    {
+        while (_blocks)
+        {
+            Block *next = _blocks->next;
+            free(_blocks);
+            _blocks = next;
+        }
+    }
+
+
+    void *NbtArena::allocate(size_t size, size_t align)
+    {
+        uintptr_t pos = reinterpret_cast<uintptr_t>(_pos);
+        uintptr_t aligned = (pos + align - 1) & ~(uintptr_t)(align - 1);
+
+        if (_pos == NULL || aligned + size > reinterpret_cast<uintptr_t>(_limit))
+        {
+            // Oversized requests get a block of their own
+            size_t blockSize = sizeof(Block) + align + size;
+            if (blockSize < _blockSize)
+                blockSize = _blockSize;
+
+            Block *block = static_cast<Block *>(malloc(blockSize));
+            if (block == NULL)
+                throw std::bad_alloc();
+
+            block->next = _blocks;
+            block->size = blockSize;
+            _blocks = block;
+
+            _pos = reinterpret_cast<uint8_t *>(block + 1);
+            _limit = reinterpret_cast<uint8_t *>(block) + blockSize;
+
+            pos = reinterpret_cast<uintptr_t>(_pos);
+            aligned = (pos + align - 1) & ~(uintptr_t)(align - 1);
+        }
+
+        _pos = reinterpret_cast<uint8_t *>(aligned + size);
+        _bytesAllocated += size;
+
+        return reinterpret_cast<void *>(aligned);
+    }
+
+
+    void NbtArena::reset()
+    {
+        if (_blocks == NULL)
+            return;
+
+        // Keep the newest block around for the next tree
+        Block *keep = _blocks;
+        _blocks = keep->next;
+        while (_blocks)
+        {
+            Block *next = _blocks->next;
+            free(_blocks);
+            _blocks = next;
+        }
+
+        keep->next = NULL;
+        _blocks = keep;
+        _pos = reinterpret_cast<uint8_t *>(keep + 1);
+        _limit = reinterpret_cast<uint8_t *>(keep) + keep->size;
+        _bytesAllocated = 0;
+    }
+
+
+    size_t NbtArena::getBytesAllocated() const
+    {
+        return _bytesAllocated;
+    }
+
+
+    size_t NbtArena::getBlockCount() const
+    {
+        size_t ret = 0;
+        for (Block *block = _blocks; block; block = block->next)
+            ++ret;
+
+        return ret;
+    }
+
+
+    NbtArena *NbtArena::current()
+    {
+        return _current;
+    }
+
+
+    NbtArena::Scope::Scope(NbtArena *arena)
+        : _previous(_current)
+    {
+        _current = arena;
+    }
+
+
+    NbtArena::Scope::~Scope()
+    {
+        _current = _previous;
+    }
+}
@@ -18,336 +18,217 @@
  */
 #include "cppnbt.h"
 
-#include <cassert>
-#include <iostream>
 #include <cstring>
 
 namespace nbt
 {
-    typedef Tag *(NbtBuffer::*NbtMembFn)(); // Again...
-
-    const NbtMembFn NbtBuffer::readerFunctions[] =
-    {
-            NULL,
-            &NbtBuffer::readByte,
-            &NbtBuffer::readShort,
-            &NbtBuffer::readInt,
-            &NbtBuffer::readLong,
-            &NbtBuffer::readFloat,
-            &NbtBuffer::readDouble,
-            &NbtBuffer::readByteArray,
-            &NbtBuffer::readString,
-            &NbtBuffer::readList,
-            &NbtBuffer::readCompound,
-            &NbtBuffer::readIntArray,
-    };
-
     NbtBuffer::NbtBuffer()
-        : _root(NULL), _buffer(NULL), bufferSize(0), bufferPos(0)
+        : _root(NULL), _ownsRoot(false), _arena(NULL), _internStrings(false),
+          _sizeHint(0)
     {
 
     }
 
     NbtBuffer::NbtBuffer(uint8_t *compressedBuffer, unsigned int length)
-        : _root(NULL), _buffer(NULL), bufferSize(0), bufferPos(0)
+        : _root(NULL), _ownsRoot(false), _arena(NULL), _internStrings(false),
+          _sizeHint(0)
     {
         read(compressedBuffer, length);
     }
 
     NbtBuffer::~NbtBuffer()
     {
-        delete _root;
+        if (_ownsRoot)
+            delete _root;
     }
 
-    #define BASE_BUFFER_SIZE 32768
-    void NbtBuffer::read(uint8_t *compressedBuffer, unsigned int length)
+    bool NbtBuffer::read(uint8_t *compressedBuffer, unsigned int length)
     {
-        static thread_local uint8_t *inflatedBuffer = new uint8_t[BASE_BUFFER_SIZE];
-        static thread_local size_t inflatedBufferSize = BASE_BUFFER_SIZE;
-        uLongf uncompressedSize = inflatedBufferSize;
-
-        int result = uncompress(inflatedBuffer, &uncompressedSize, compressedBuffer, length);
-        while (result == Z_BUF_ERROR)
+        try
         {
-            inflatedBufferSize *= 2;
-            delete[] inflatedBuffer;
-            inflatedBuffer = new uint8_t[inflatedBufferSize];
-            uncompressedSize = inflatedBufferSize;
-
-            result = uncompress(inflatedBuffer, &uncompressedSize, compressedBuffer, length);
+            return decode(compressedBuffer, length, NULL);
         }
-        if (result != Z_STREAM_END && result!= Z_OK)
+        catch (const std::bad_alloc &)
         {
-            return;
+            // A corrupt header can ask for more than there is
+            return false;
         }
+    }
 
-        bufferSize = uncompressedSize;
-
-        //setup the buffer stream
-        _buffer = inflatedBuffer;
-
-        if (_root)
+    bool NbtBuffer::read(uint8_t *compressedBuffer, unsigned int length,
+                         const NbtPathSet &paths)
+    {
+        try
         {
-            delete _root;
-            _root = NULL;
+            return decode(compressedBuffer, length, &paths);
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
         }
+    }
 
-        //read root
-        _root = readTag();
+    bool NbtBuffer::decode(uint8_t *compressedBuffer, unsigned int length,
+                           const NbtPathSet *paths)
+    {
+        static thread_local ByteArray inflatedBuffer;
+        size_t uncompressedSize;
 
-        //all done reading, clean-up
-        _buffer = NULL;
+        // An arena root may already be gone with its arena
+        if (_ownsRoot)
+            delete _root;
+        _root = NULL;
+        _ownsRoot = (_arena == NULL);
 
-    }
+        NbtCodec codec(NbtCodec::sniff(compressedBuffer, length));
+        const uint8_t *data = codec.decompress(compressedBuffer, length, inflatedBuffer,
+                                               uncompressedSize, _sizeHint);
+        if (data == NULL)
+            return false;
 
-    char* NbtBuffer::write(Tag *tag, unsigned long& len)
-    {
-        ByteArray bs = tag->toByteArray();
+        //read root
+        NbtArena::Scope scope(_arena);
+        MemorySource source(data, uncompressedSize);
+        NbtDecoder<MemorySource> decoder(source, _internStrings);
 
-        len = bs.size();
-        char* buffer = new char[len];
-        compress((uint8_t*)buffer, &len, bs.data(), bs.size());
-        return buffer;
+        _root = paths ? decoder.readTag(*paths) : decoder.readTag();
+        if (decoder.failed())
+        {
+            if (_ownsRoot)
+                delete _root;
+            _root = NULL;
+        }
 
+        return _root != NULL;
     }
 
-    char* NbtBuffer::writeGzip(Tag *tag, unsigned int& len)
+    bool NbtBuffer::visit(uint8_t *compressedBuffer, unsigned int length,
+                          NbtVisitor &visitor)
     {
-        ByteArray bs = tag->toByteArray();
-
-        len = bs.size() * 2;
-        uint8_t* buffer = new uint8_t[len];
+        static thread_local ByteArray inflatedBuffer;
+        size_t uncompressedSize;
 
-        /* =       =                 = */
-        z_stream stream;
-        int err;
+        NbtCodec codec(NbtCodec::sniff(compressedBuffer, length));
+        const uint8_t *data = codec.decompress(compressedBuffer, length, inflatedBuffer,
+                                               uncompressedSize, _sizeHint);
+        if (data == NULL)
+            return false;
 
-        stream.next_in = (z_const Bytef *)bs.data();
-        stream.avail_in = (uInt)bs.size();
-        stream.next_out = buffer;
-        stream.avail_out = (uInt)len;
-        stream.zalloc = (alloc_func)0;
-        stream.zfree = (free_func)0;
-        stream.opaque = (voidpf)0;
+        MemorySource source(data, uncompressedSize);
+        NbtDecoder<MemorySource> decoder(source);
 
-        err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
-        if (err != Z_OK)
-        {
-            delete[] buffer;
-            return nullptr;
-        }
+        bool visited = decoder.visitTag(visitor);
+        return decoder.stopped() || (visited && !decoder.failed());
+    }
 
-        err = deflate(&stream, Z_FINISH);
-        if (err != Z_STREAM_END)
-        {
-            deflateEnd(&stream);
-            delete[] buffer;
-            return nullptr;
-        }
-        len = stream.total_out;
+    NbtView NbtBuffer::readView(uint8_t *compressedBuffer, unsigned int length)
+    {
+        size_t uncompressedSize;
 
-        err = deflateEnd(&stream);
-        /* =       =                 = */
+        NbtCodec codec(NbtCodec::sniff(compressedBuffer, length));
+        const uint8_t *data = codec.decompress(compressedBuffer, length, _viewBuffer,
+                                               uncompressedSize, _sizeHint);
+        if (data == NULL)
+            return NbtView();
 
-        return (char*)buffer;
-    }
-    Tag *NbtBuffer::getRoot() const
-    {
-        return _root;
+        return NbtView(data, uncompressedSize);
     }
 
-    void NbtBuffer::setRoot(const Tag &r)
+    char* NbtBuffer::write(Tag *tag, unsigned long& len)
     {
-        delete _root;
-        _root = r.clone();
+        return write(tag, len, NbtCodec(NbtCodec::ZLIB));
     }
 
-    void NbtBuffer::readBuffer(void* buf, unsigned len)
+    char* NbtBuffer::writeGzip(Tag *tag, unsigned int& len)
     {
-        assert(bufferPos + len <= bufferSize);
-        memcpy(buf, _buffer + bufferPos, len);
-        bufferPos += len;
+        unsigned long size;
+        char* buffer = write(tag, size, NbtCodec(NbtCodec::GZIP));
+        len = size;
+        return buffer;
     }
 
-    Tag *NbtBuffer::readTag()
+    char* NbtBuffer::write(Tag *tag, unsigned long& len, const NbtCodec &codec)
     {
-        uint8_t type = 0;
-
-        readBuffer(&type, 1);
-        if (type == TAG_END)
-            return new TagEnd();
+        NbtWriter writer(tag->serializedSize());
+        tag->write(writer);
 
-        Tag *nameTag = readString();
-        TagString *nameTagStr = dynamic_cast<TagString *>(nameTag);
-
-        NbtMembFn reader = readerFunctions[type];
-        if (reader == nullptr)
+        size_t size = codec.bound(writer.size());
+        uint8_t* buffer = new uint8_t[size];
+        if (!codec.compress(writer.data(), writer.size(), buffer, size))
         {
-            delete nameTag;
+            delete[] buffer;
             return nullptr;
         }
-        Tag *res = (this->*reader)();
-        res->setName(nameTagStr->getValue());
+        len = size;
 
-        delete nameTag;
-        return res;
+        return (char*)buffer;
     }
 
-
-    Tag *NbtBuffer::readByte()
+    Tag *NbtBuffer::getRoot() const
     {
-        uint8_t byte;
-        readBuffer(&byte, 1);
-
-        return new TagByte("", byte);
+        return _root;
     }
 
-    Tag *NbtBuffer::readShort()
+    void NbtBuffer::setRoot(const Tag &r)
     {
-        int16_t val;
-        readBuffer(&val, 2);
-
-        val = be16toh(val);
-
-        return new TagShort("", val);
+        if (_ownsRoot)
+            delete _root;
+        _root = r.clone();
+        _ownsRoot = true;
     }
 
-    Tag *NbtBuffer::readInt()
+    void NbtBuffer::setRoot(Tag &&r)
     {
-        int32_t val;
-        readBuffer(&val, 4);
-
-        val = be32toh(val);
-
-        return new TagInt("", val);
+        if (_ownsRoot)
+            delete _root;
+        _root = r.moveClone();
+        _ownsRoot = true;
     }
 
-    Tag *NbtBuffer::readLong()
+    void NbtBuffer::setRoot(std::unique_ptr<Tag> r)
     {
-        int64_t val;
-        readBuffer(&val, 8);
-
-        val = be64toh(val);
-
-        return new TagLong("", val);
+        if (_ownsRoot)
+            delete _root;
+        _root = r.release();
+        _ownsRoot = true;
     }
 
-    Tag *NbtBuffer::readFloat()
+    Tag *NbtBuffer::release()
     {
-        union endianConvert
-        {
-            int i;
-            float f;
-        } val;
-
-        readBuffer(&val, 4);
+        Tag *ret = _root;
+        _root = NULL;
+        _ownsRoot = false;
 
-        val.i = be32toh(val.i);
-
-        return new TagFloat("", val.f);
+        return ret;
     }
 
-    Tag *NbtBuffer::readDouble()
+    void NbtBuffer::setArena(NbtArena *arena)
     {
-        union endianConvert
-        {
-            long l;
-            double d;
-        } val;
-        readBuffer(&val, 8);
-
-        val.l = be64toh(val.l);
-
-        return new TagDouble("", val.d);
+        _arena = arena;
     }
 
-    Tag *NbtBuffer::readByteArray()
+    NbtArena *NbtBuffer::getArena() const
     {
-        int32_t len;
-        readBuffer(&len, 4);
-
-        len = be32toh(len);
-
-        unsigned char *byteArray = new unsigned char[len];
-
-        readBuffer(byteArray, len);
-
-        return new TagByteArray("", byteArray, len);
+        return _arena;
     }
 
-    Tag *NbtBuffer::readIntArray()
+    void NbtBuffer::setInternStrings(bool intern)
     {
-        int32_t len;
-        readBuffer(&len, 4);
-
-        len = be32toh(len);
-
-        int* intArray = new int[len];
-
-        readBuffer(intArray, len * sizeof(int));
-
-        for (int i = 0; i < len; ++i)
-        {
-            intArray[i] = be32toh(intArray[i]);
-        }
-
-        return new TagIntArray("", intArray, len);
+        _internStrings = intern;
     }
 
-    Tag *NbtBuffer::readString()
+    bool NbtBuffer::getInternStrings() const
     {
-        int16_t len;
-        readBuffer(&len, 2);
-
-        len = be16toh(len);
-
-        std::string str;
-        str.reserve(len);
-
-        str.append(reinterpret_cast<char*>(_buffer + bufferPos),len);
-        bufferPos += len;
-
-        return new TagString("", str);
+        return _internStrings;
     }
 
-    Tag *NbtBuffer::readList()
+    void NbtBuffer::setSizeHint(size_t bytes)
     {
-        int8_t childType;
-        int32_t len;
-
-        readBuffer(&childType, 1);
-        readBuffer(&len, 4);
-
-        TagList *ret = new TagList(childType, "");
-
-        len = be32toh(len);
-
-        NbtMembFn reader = readerFunctions[childType];
-        for (int i = 0; i < len; ++i)
-        {
-            Tag *child = (this->*reader)();
-            ret->append(child);
-        }
-
-        return ret;
+        _sizeHint = bytes;
     }
 
-    Tag *NbtBuffer::readCompound()
+    size_t NbtBuffer::getSizeHint() const
     {
-        Tag *child = NULL;
-        TagCompound *ret = new TagCompound("");
-
-        while (((child = readTag()) != NULL))
-        {
-            if (child->getType() == TAG_END)
-            {
-                delete child;
-                break;
-            }
-
-            ret->insert(child);
-        }
-
-        return ret;
+        return _sizeHint;
     }
 }
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#include <algorithm>
+
+namespace nbt
+{
+    namespace
+    {
+        const size_t BASE_BUFFER_SIZE = 32768;
+
+        // Deflate never expands more than this, so it bounds any size guess
+        const size_t MAX_RATIO = 1032;
+
+        // Largest gzip wrapper deflate writes without extra header fields
+        const size_t MAX_WRAPPER = 18;
+    }
+
+
+    NbtCodec::NbtCodec(Format format, int level, int strategy, int windowBits, int memLevel)
+        : _format(format), _level(level), _strategy(strategy),
+          _windowBits(windowBits), _memLevel(memLevel)
+    {
+
+    }
+
+
+    NbtCodec::Format NbtCodec::sniff(const uint8_t *data, size_t length)
+    {
+        if (length >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+            return GZIP;
+
+        if (length >= 2 && (data[0] & 0x0f) == Z_DEFLATED
+            && (data[0] >> 4) + 8 <= MAX_WBITS
+            && ((data[0] << 8) | data[1]) % 31 == 0)
+            return ZLIB;
+
+        // Root tags are compounds, and 0x0a cannot open a zlib stream
+        if (length >= 1 && data[0] == TAG_COMPOUND)
+            return NONE;
+
+        return RAW;
+    }
+
+
+    NbtCodec::Format NbtCodec::getFormat() const
+    {
+        return _format;
+    }
+
+
+    int NbtCodec::getLevel() const
+    {
+        return _level;
+    }
+
+
+    int NbtCodec::getStrategy() const
+    {
+        return _strategy;
+    }
+
+
+    int NbtCodec::getWindowBits() const
+    {
+        return _windowBits;
+    }
+
+
+    int NbtCodec::getMemLevel() const
+    {
+        return _memLevel;
+    }
+
+
+    size_t NbtCodec::bound(size_t length) const
+    {
+        if (_format == NONE)
+            return length;
+
+        // zlib's conservative deflateBound(), valid for any parameters
+        return length + ((length + 7) >> 3) + ((length + 63) >> 6) + 5 + MAX_WRAPPER;
+    }
+
+
+    bool NbtCodec::compress(const uint8_t *data, size_t length,
+                            uint8_t *out, size_t &outLength) const
+    {
+        if (_format == NONE)
+        {
+            if (outLength < length)
+                return false;
+
+            memcpy(out, data, length);
+            outLength = length;
+            return true;
+        }
+
+        int wbits = _format == GZIP ? _windowBits + 16
+                  : _format == RAW  ? -_windowBits : _windowBits;
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, _level, Z_DEFLATED, wbits, _memLevel, _strategy) != Z_OK)
+            return false;
+
+        stream.next_in = const_cast<uint8_t *>(data);
+        stream.avail_in = length;
+        stream.next_out = out;
+        stream.avail_out = outLength;
+
+        int result = deflate(&stream, Z_FINISH);
+        outLength = stream.total_out;
+
+        deflateEnd(&stream);
+        return result == Z_STREAM_END;
+    }
+
+
+    const uint8_t *NbtCodec::decompress(const uint8_t *data, size_t length,
+                                        ByteArray &buffer, size_t &size,
+                                        size_t sizeHint) const
+    {
+        if (_format == NONE)
+        {
+            size = length;
+            return data;
+        }
+
+        int wbits = _format == GZIP ? MAX_WBITS + 16
+                  : _format == RAW  ? -MAX_WBITS : MAX_WBITS;
+
+        // The gzip trailer holds the inflated size modulo 2^32
+        size_t guess = sizeHint;
+        if (guess == 0 && _format == GZIP && length >= 18)
+        {
+            const uint8_t *trailer = data + length - 4;
+            guess = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+                  | (static_cast<uint32_t>(trailer[3]) << 24);
+        }
+
+        if (guess == 0)
+            guess = length * 4;
+
+        guess = std::max(std::min(guess, length * MAX_RATIO), BASE_BUFFER_SIZE);
+        if (buffer.size() < guess)
+            buffer.resize(guess);
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, wbits) != Z_OK)
+            return NULL;
+
+        stream.next_in = const_cast<uint8_t *>(data);
+        stream.avail_in = length;
+        size = 0;
+
+        // One pass, growing the output in place when the guess is short
+        int result = Z_OK;
+        while (result == Z_OK)
+        {
+            if (size == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            stream.next_out = buffer.data() + size;
+            stream.avail_out = buffer.size() - size;
+
+            result = inflate(&stream, Z_NO_FLUSH);
+            size = buffer.size() - stream.avail_out;
+
+            // Concatenated gzip members inflate as one stream
+            if (result == Z_STREAM_END && _format == GZIP && stream.avail_in > 0
+                && stream.next_in[0] == 0x1f)
+                result = inflateReset(&stream);
+        }
+
+        inflateEnd(&stream);
+        return result == Z_STREAM_END ? buffer.data() : NULL;
+    }
+}
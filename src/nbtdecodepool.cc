@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    namespace
+    {
+        // Pool whose job the current thread is running, if any
+        thread_local const NbtDecodePool *runningPool = NULL;
+    }
+
+
+    NbtDecodePool::NbtDecodePool(unsigned int threads)
+        : _internStrings(false), _pending(0), _generation(0),
+          _stopping(false)
+    {
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        for (unsigned int i = 0; i < threads; ++i)
+            _workers.push_back(new Worker());
+
+        // Start only once every queue exists, as any thread may steal
+        for (unsigned int i = 0; i < threads; ++i)
+            _workers[i]->thread = std::thread(&NbtDecodePool::work, this, i);
+    }
+
+
+    NbtDecodePool::~NbtDecodePool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stopping = true;
+        }
+        _wake.notify_all();
+
+        // A thread still looking for work may steal from any queue, so
+        // none are freed before every thread is done
+        for (size_t i = 0; i < _workers.size(); ++i)
+            _workers[i]->thread.join();
+
+        for (size_t i = 0; i < _workers.size(); ++i)
+            delete _workers[i];
+    }
+
+
+    unsigned int NbtDecodePool::getThreadCount() const
+    {
+        return _workers.size();
+    }
+
+
+    void NbtDecodePool::decode(const std::vector<ArrayView<uint8_t> > &buffers,
+                               const Callback &callback)
+    {
+        bool intern = _internStrings;
+        run(buffers.size(), [&](size_t i)
+        {
+            Tag *root = NULL;
+            try
+            {
+                NbtBuffer buffer;
+                buffer.setInternStrings(intern);
+                if (buffer.read(const_cast<uint8_t *>(buffers[i].data()), buffers[i].size()))
+                    root = buffer.release();
+            }
+            catch (const std::bad_alloc &)
+            {
+                // A corrupt length can ask for more than there is
+            }
+
+            callback(i, root);
+        });
+    }
+
+
+    std::vector<Tag *> NbtDecodePool::decode(const std::vector<ArrayView<uint8_t> > &buffers)
+    {
+        // Each job writes its own slot, so no locking is needed
+        std::vector<Tag *> roots(buffers.size(), NULL);
+        decode(buffers, [&](size_t i, Tag *root)
+        {
+            roots[i] = root;
+        });
+
+        return roots;
+    }
+
+
+    void NbtDecodePool::decode(const RegionFile &region, const ChunkCallback &callback)
+    {
+        std::vector<ArrayView<uint8_t> > buffers;
+        std::vector<int> chunks;
+        for (int i = 0; i < RegionFile::CHUNK_COUNT; ++i)
+        {
+            ArrayView<uint8_t> data = region.getChunkData(i % 32, i / 32);
+            if (data.empty())
+                continue;
+
+            buffers.push_back(data);
+            chunks.push_back(i);
+        }
+
+        decode(buffers, [&](size_t i, Tag *root)
+        {
+            callback(chunks[i] % 32, chunks[i] / 32, root);
+        });
+    }
+
+
+    void NbtDecodePool::setInternStrings(bool intern)
+    {
+        _internStrings = intern;
+    }
+
+
+    bool NbtDecodePool::getInternStrings() const
+    {
+        return _internStrings;
+    }
+
+
+    void NbtDecodePool::run(size_t count, const std::function<void (size_t)> &job)
+    {
+        if (count == 0)
+            return;
+
+        // A job of ours waiting on the pool would never be woken
+        if (runningPool == this)
+        {
+            for (size_t i = 0; i < count; ++i)
+                job(i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> batch(_runLock);
+
+        // Count the batch before queueing it: a worker still draining the
+        // previous one may pick up a task before it sees the new generation
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _pending = count;
+        }
+
+        // Hand each thread one contiguous slice of the batch
+        size_t threads = _workers.size();
+        for (size_t w = 0; w < threads; ++w)
+        {
+            std::lock_guard<std::mutex> guard(_workers[w]->lock);
+            for (size_t i = w * count / threads; i < (w + 1) * count / threads; ++i)
+            {
+                Task task = { &job, i };
+                _workers[w]->tasks.push_back(task);
+            }
+        }
+
+        std::unique_lock<std::mutex> guard(_lock);
+        ++_generation;
+        _wake.notify_all();
+
+        _done.wait(guard, [this] { return _pending == 0; });
+
+        std::exception_ptr error = _error;
+        _error = std::exception_ptr();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+
+    void NbtDecodePool::work(size_t self)
+    {
+        unsigned long seen = 0;
+        runningPool = this;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _wake.wait(guard, [&] { return _stopping || _generation != seen; });
+                if (_stopping)
+                    return;
+
+                seen = _generation;
+            }
+
+            Task task;
+            while (take(self, task))
+            {
+                std::exception_ptr error;
+                try
+                {
+                    (*task.job)(task.index);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                // The batch is over once every task is accounted for,
+                // failed or not
+                std::lock_guard<std::mutex> guard(_lock);
+                if (error && !_error)
+                    _error = error;
+                if (--_pending == 0)
+                    _done.notify_all();
+            }
+        }
+    }
+
+
+    bool NbtDecodePool::take(size_t self, Task &task)
+    {
+        // Own work from the front, stolen work from the back
+        {
+            Worker *worker = _workers[self];
+            std::lock_guard<std::mutex> guard(worker->lock);
+            if (!worker->tasks.empty())
+            {
+                task = worker->tasks.front();
+                worker->tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < _workers.size(); ++i)
+        {
+            Worker *victim = _workers[(self + i) % _workers.size()];
+            std::lock_guard<std::mutex> guard(victim->lock);
+            if (!victim->tasks.empty())
+            {
+                task = victim->tasks.back();
+                victim->tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,987 @@
+/*
+ * Copyright (C) 2012 Scott Atkins
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Included by cppnbt.h once the Tag classes are defined, do not include
+// directly.
+#ifndef CPPNBT_DECODER_H
+#define CPPNBT_DECODER_H
+
+#include <istream>
+#include <unistd.h>
+
+namespace nbt
+{
+    // Input sources for NbtDecoder. A source provides
+    //
+    //   const uint8_t *fetch(size_t len);
+    //       the next len bytes, valid until the next call
+    //   void read(void *dst, size_t len);
+    //       copies the next len bytes into dst
+    //   void skip(size_t len);
+    //       moves past the next len bytes
+    //   bool canRead(size_t len) const;
+    //       false when len bytes are known not to be there
+    //   bool failed() const;
+    //
+    // Once input runs out a source hands out zeroes and reports failed();
+    // zeroes end every open compound, so the decoder unwinds on its own.
+
+    // Uncompressed NBT already in memory, read in place
+    class MemorySource
+    {
+        public:
+            MemorySource(const uint8_t *data, size_t size)
+                : _pos(data), _end(data + size), _failed(false) {}
+
+            const uint8_t *fetch(size_t len)
+            {
+                if (static_cast<size_t>(_end - _pos) < len)
+                    return exhausted(len);
+
+                const uint8_t *ret = _pos;
+                _pos += len;
+                return ret;
+            }
+
+            void read(void *dst, size_t len)
+            {
+                memcpy(dst, fetch(len), len);
+            }
+
+            void skip(size_t len)
+            {
+                if (static_cast<size_t>(_end - _pos) < len)
+                {
+                    _failed = true;
+                    _pos = _end;
+                    return;
+                }
+
+                _pos += len;
+            }
+
+            bool canRead(size_t len) const
+            {
+                return static_cast<size_t>(_end - _pos) >= len;
+            }
+
+            bool failed() const { return _failed; }
+
+            // Bytes left after the data decoded so far
+            size_t remaining() const { return _end - _pos; }
+
+        private:
+            const uint8_t *exhausted(size_t len)
+            {
+                _failed = true;
+                _pos = _end;
+                _zeroes.assign(len, 0);
+                return _zeroes.data();
+            }
+
+            const uint8_t *_pos;
+            const uint8_t *_end;
+            bool _failed;
+            ByteArray _zeroes;
+    };
+
+    // Raw inputs for BufferedSource, each returning the number of bytes
+    // read or a value <= 0 at end of input or on error
+    struct GzInput
+    {
+        gzFile file;
+
+        GzInput(gzFile file = Z_NULL) : file(file) {}
+
+        long read(void *buf, size_t len)
+        {
+            return gzread(file, buf, len);
+        }
+    };
+
+    struct FdInput
+    {
+        int fd;
+
+        FdInput(int fd = -1) : fd(fd) {}
+
+        long read(void *buf, size_t len)
+        {
+            ssize_t ret;
+            do
+            {
+                ret = ::read(fd, buf, len);
+            } while (ret < 0 && errno == EINTR);
+
+            return ret;
+        }
+    };
+
+    struct IStreamInput
+    {
+        std::istream *stream;
+
+        IStreamInput(std::istream *stream = NULL) : stream(stream) {}
+
+        long read(void *buf, size_t len)
+        {
+            stream->read(static_cast<char *>(buf), len);
+            return stream->gcount();
+        }
+    };
+
+    // Streamed input pulled through a block buffer, so that decoding
+    // costs one call into the input per block rather than per value
+    template <typename Input>
+    class BufferedSource
+    {
+        public:
+            static const size_t BLOCK_SIZE = 65536;
+            static const size_t DEFAULT_MAX_LENGTH = 64 * 1024 * 1024;
+
+            BufferedSource(const Input &input = Input())
+                : _input(input), _pos(0), _end(0), _failed(false),
+                  _maxLength(DEFAULT_MAX_LENGTH) {}
+
+            // Switch to a new input, dropping anything still buffered
+            void reset(const Input &input)
+            {
+                _input = input;
+                _pos = _end = 0;
+                _failed = false;
+            }
+
+            const uint8_t *fetch(size_t len)
+            {
+                if (_end - _pos < len)
+                    return fetchSlow(len);
+
+                const uint8_t *ret = _block.data() + _pos;
+                _pos += len;
+                return ret;
+            }
+
+            void read(void *dst, size_t len);
+            void skip(size_t len);
+
+            // The input length is unknown up front, so declared lengths are
+            // trusted only up to the limit, as NbtPushParser does
+            bool canRead(size_t len) const { return !_failed && len <= _maxLength; }
+            void setMaxLength(size_t bytes) { _maxLength = bytes; }
+            bool failed() const { return _failed; }
+
+            // Start a new decode; buffered bytes are kept
+            void clearError() { _failed = false; }
+
+        private:
+            const uint8_t *fetchSlow(size_t len)
+            {
+                _scratch.resize(len);
+                read(_scratch.data(), len);
+                return _scratch.data();
+            }
+
+            Input _input;
+            ByteArray _block;
+            ByteArray _scratch;
+            size_t _pos;
+            size_t _end;
+            bool _failed;
+            size_t _maxLength;
+    };
+
+    typedef BufferedSource<GzInput>      GzSource;
+    typedef BufferedSource<FdInput>      FdSource;
+    typedef BufferedSource<IStreamInput> StreamSource;
+
+    // Decodes a tree of Tags from any source above. Tags are allocated
+    // through Tag::operator new, so an NbtArena::Scope around the decode
+    // places the whole tree in that arena.
+    template <typename Source>
+    class NbtDecoder
+    {
+        public:
+            // With internStrings, TAG_String values are interned in
+            // NbtStringPool like names always are
+            NbtDecoder(Source &source, bool internStrings = false)
+                : _source(source), _failed(false), _stopped(false),
+                  _internStrings(internStrings) {}
+
+            // Reads one named tag, NULL on TAG_End or bad input
+            Tag *readTag();
+
+            // Reads one named tag, building only what paths selects below
+            // it when it is a compound
+            Tag *readTag(const NbtPathSet &paths);
+
+            // Reads one named tag as events for visitor, building nothing.
+            // False on TAG_End.
+            bool visitTag(NbtVisitor &visitor);
+
+            // Whether the last visitor asked to stop
+            bool stopped() const { return _stopped; }
+
+            // Reads the unnamed payload of a tag of the given type
+            Tag *readPayload(uint8_t type);
+
+            bool failed() const { return _failed || _source.failed(); }
+
+        protected:
+            void readPayload(uint8_t type, Tag *tag);
+
+            // Payload of a compound or list holding the selection at node
+            void readSelected(uint8_t type, Tag *tag, const NbtPathSet &paths,
+                              size_t node);
+            void skipPayload(uint8_t type);
+
+            void visitPayload(uint8_t type, const StringView &name,
+                              NbtVisitor &visitor);
+
+            uint8_t readByte()
+            {
+                return *_source.fetch(1);
+            }
+
+            uint16_t readShort()
+            {
+                uint16_t val;
+                memcpy(&val, _source.fetch(2), 2);
+                return be16toh(val);
+            }
+
+            uint32_t readInt()
+            {
+                uint32_t val;
+                memcpy(&val, _source.fetch(4), 4);
+                return be32toh(val);
+            }
+
+            uint64_t readLong()
+            {
+                uint64_t val;
+                memcpy(&val, _source.fetch(8), 8);
+                return be64toh(val);
+            }
+
+            // Length prefix of an array of elemSize-byte elements, 0 if
+            // it cannot be right
+            size_t readLength(size_t elemSize)
+            {
+                int32_t len = static_cast<int32_t>(readInt());
+                if (len < 0 || !_source.canRead(static_cast<size_t>(len) * elemSize))
+                {
+                    _failed = true;
+                    return 0;
+                }
+                return static_cast<size_t>(len);
+            }
+
+            void readPackedList(TagList *list, size_t len);
+
+            Source &_source;
+            bool _failed;
+            bool _stopped;
+            bool _internStrings;
+
+            // Scratch for visiting: the current name and converted arrays
+            std::string _name;
+            ByteArray _values;
+    };
+
+
+    template <typename Input>
+    void BufferedSource<Input>::read(void *dst, size_t len)
+    {
+        uint8_t *out = static_cast<uint8_t *>(dst);
+
+        while (len > 0)
+        {
+            if (_pos == _end)
+            {
+                long count;
+                if (_failed)
+                {
+                    count = 0;
+                }
+                else if (len >= BLOCK_SIZE)
+                {
+                    // Large payloads skip the block and land in place
+                    count = _input.read(out, len);
+                    if (count > 0)
+                    {
+                        out += count;
+                        len -= count;
+                        continue;
+                    }
+                }
+                else
+                {
+                    _block.resize(BLOCK_SIZE);
+                    count = _input.read(_block.data(), BLOCK_SIZE);
+                    if (count > 0)
+                    {
+                        _pos = 0;
+                        _end = count;
+                        continue;
+                    }
+                }
+
+                memset(out, 0, len);
+                _failed = true;
+                return;
+            }
+
+            size_t count = _end - _pos;
+            if (count > len)
+                count = len;
+
+            memcpy(out, _block.data() + _pos, count);
+
+            _pos += count;
+            out += count;
+            len -= count;
+        }
+    }
+
+
+    template <typename Input>
+    void BufferedSource<Input>::skip(size_t len)
+    {
+        while (len > 0)
+        {
+            if (_pos == _end)
+            {
+                long count = 0;
+                if (!_failed)
+                {
+                    _block.resize(BLOCK_SIZE);
+                    count = _input.read(_block.data(), BLOCK_SIZE);
+                }
+
+                if (count <= 0)
+                {
+                    _failed = true;
+                    return;
+                }
+
+                _pos = 0;
+                _end = count;
+            }
+
+            size_t count = _end - _pos;
+            if (count > len)
+                count = len;
+
+            _pos += count;
+            len -= count;
+        }
+    }
+
+
+    template <typename Source>
+    void NbtDecoder<Source>::readPackedList(TagList *list, size_t len)
+    {
+        // Elements land straight in the list and are converted in place
+        size_t childSize = Tag::getPayloadSize(list->getChildType());
+        TagList::Packed &values = list->_body->packedValues;
+
+        values.resize(len * childSize);
+        if (values.empty())
+            return;
+
+        _source.read(values.data(), values.size());
+
+        switch (childSize)
+        {
+            case 2: convertBigEndian16(values.data(), values.data(), len); break;
+            case 4: convertBigEndian32(values.data(), values.data(), len); break;
+            case 8: convertBigEndian64(values.data(), values.data(), len); break;
+        }
+    }
+
+
+    template <typename Source>
+    Tag *NbtDecoder<Source>::readTag()
+    {
+        uint8_t type = readByte();
+        if (type == TAG_END)
+            return NULL;
+
+        Tag *tag = Tag::create(type);
+        if (tag == NULL)
+        {
+            _failed = true;
+            return NULL;
+        }
+
+        // Interned straight from the input, before the payload is fetched
+        uint16_t nameLen = readShort();
+        const char *name = reinterpret_cast<const char *>(_source.fetch(nameLen));
+        tag->setName(StringView(name, nameLen));
+
+        // Children are linked in as they are read, so only this tag can
+        // be left dangling by a throw
+        try
+        {
+            readPayload(type, tag);
+        }
+        catch (...)
+        {
+            Tag::destroy(tag);
+            throw;
+        }
+
+        return tag;
+    }
+
+
+    template <typename Source>
+    Tag *NbtDecoder<Source>::readTag(const NbtPathSet &paths)
+    {
+        uint8_t type = readByte();
+        if (type == TAG_END)
+            return NULL;
+
+        Tag *tag = Tag::create(type);
+        if (tag == NULL)
+        {
+            _failed = true;
+            return NULL;
+        }
+
+        uint16_t nameLen = readShort();
+        const char *name = reinterpret_cast<const char *>(_source.fetch(nameLen));
+        tag->setName(StringView(name, nameLen));
+
+        try
+        {
+            if (type == TAG_COMPOUND && !paths.isSelected(NbtPathSet::ROOT))
+                readSelected(type, tag, paths, NbtPathSet::ROOT);
+            else
+                readPayload(type, tag);
+        }
+        catch (...)
+        {
+            Tag::destroy(tag);
+            throw;
+        }
+
+        return tag;
+    }
+
+
+    template <typename Source>
+    void NbtDecoder<Source>::readSelected(uint8_t type, Tag *tag,
+                                          const NbtPathSet &paths, size_t node)
+    {
+        if (type == TAG_COMPOUND)
+        {
+            TagCompound *compound = static_cast<TagCompound *>(tag);
+
+            uint8_t childType;
+            while ((childType = readByte()) != TAG_END)
+            {
+                uint16_t nameLen = readShort();
+                StringView name(reinterpret_cast<const char *>(_source.fetch(nameLen)), nameLen);
+
+                // Only compounds and lists can hold a selection further down
+                size_t childNode = paths.field(node, name);
+                if (childNode == NbtPathSet::NONE
+                    || (!paths.isSelected(childNode)
+                        && childType != TAG_COMPOUND && childType != TAG_LIST))
+                {
+                    skipPayload(childType);
+                    continue;
+                }
+
+                Tag *child = Tag::create(childType);
+                if (child == NULL)
+                {
+                    _failed = true;
+                    return;
+                }
+                child->setName(name);
+
+                try
+                {
+                    if (paths.isSelected(childNode))
+                        readPayload(childType, child);
+                    else
+                        readSelected(childType, child, paths, childNode);
+                }
+                catch (...)
+                {
+                    Tag::destroy(child);
+                    throw;
+                }
+
+                compound->insert(child);
+            }
+            return;
+        }
+
+        TagList *list = static_cast<TagList *>(tag);
+
+        uint8_t childType = readByte();
+        size_t childSize = Tag::getPayloadSize(childType);
+        size_t len = readLength(childSize != 0 ? childSize : 1);
+
+        list->setChildType(childType);
+
+        for (size_t i = 0; i < len && !failed(); ++i)
+        {
+            size_t childNode = paths.element(node, i);
+            if (childNode == NbtPathSet::NONE
+                || (!paths.isSelected(childNode)
+                    && childType != TAG_COMPOUND && childType != TAG_LIST))
+            {
+                skipPayload(childType);
+                continue;
+            }
+
+            Tag *child = Tag::create(childType);
+            if (child == NULL)
+            {
+                _failed = true;
+                return;
+            }
+
+            try
+            {
+                if (paths.isSelected(childNode))
+                    readPayload(childType, child);
+                else
+                    readSelected(childType, child, paths, childNode);
+            }
+            catch (...)
+            {
+                Tag::destroy(child);
+                throw;
+            }
+
+            // Picked primitives go by value so the list can stay packed
+            if (list->isPacked())
+            {
+                list->append(*child);
+                Tag::destroy(child);
+            }
+            else
+            {
+                list->append(child);
+            }
+        }
+    }
+
+
+    template <typename Source>
+    void NbtDecoder<Source>::skipPayload(uint8_t type)
+    {
+        size_t size = Tag::getPayloadSize(type);
+        if (size != 0)
+        {
+            _source.skip(size);
+            return;
+        }
+
+        switch (type)
+        {
+            case TAG_BYTE_ARRAY:
+                _source.skip(readLength(1));
+                break;
+
+            case TAG_INT_ARRAY:
+                _source.skip(readLength(4) * 4);
+                break;
+
+            case TAG_LONG_ARRAY:
+                _source.skip(readLength(8) * 8);
+                break;
+
+            case TAG_STRING:
+                _source.skip(readShort());
+                break;
+
+            case TAG_LIST:
+            {
+                uint8_t childType = readByte();
+                size_t childSize = Tag::getPayloadSize(childType);
+                size_t len = readLength(childSize != 0 ? childSize : 1);
+
+                if (childSize != 0)
+                {
+                    _source.skip(len * childSize);
+                    break;
+                }
+
+                for (size_t i = 0; i < len && !failed(); ++i)
+                    skipPayload(childType);
+                break;
+            }
+
+            case TAG_COMPOUND:
+            {
+                uint8_t childType;
+                while ((childType = readByte()) != TAG_END && !failed())
+                {
+                    _source.skip(readShort());
+                    skipPayload(childType);
+                }
+                break;
+            }
+
+            default:
+                _failed = true;
+                break;
+        }
+    }
+
+
+    template <typename Source>
+    bool NbtDecoder<Source>::visitTag(NbtVisitor &visitor)
+    {
+        _stopped = false;
+
+        uint8_t type = readByte();
+        if (type == TAG_END)
+            return false;
+
+        // Copied, as fetching the payload may overwrite the input
+        uint16_t nameLen = readShort();
+        _name.assign(reinterpret_cast<const char *>(_source.fetch(nameLen)), nameLen);
+
+        visitPayload(type, _name, visitor);
+        return true;
+    }
+
+
+    template <typename Source>
+    void NbtDecoder<Source>::visitPayload(uint8_t type, const StringView &name,
+                                          NbtVisitor &visitor)
+    {
+        switch (type)
+        {
+            case TAG_BYTE:
+                visitor.onByte(name, readByte());
+                break;
+
+            case TAG_SHORT:
+                visitor.onShort(name, readShort());
+                break;
+
+            case TAG_INT:
+                visitor.onInt(name, readInt());
+                break;
+
+            case TAG_LONG:
+                visitor.onLong(name, readLong());
+                break;
+
+            case TAG_FLOAT:
+            {
+                union
+                {
+                    uint32_t i;
+                    float f;
+                } val;
+                val.i = readInt();
+
+                visitor.onFloat(name, val.f);
+                break;
+            }
+
+            case TAG_DOUBLE:
+            {
+                union
+                {
+                    uint64_t l;
+                    double d;
+                } val;
+                val.l = readLong();
+
+                visitor.onDouble(name, val.d);
+                break;
+            }
+
+            case TAG_BYTE_ARRAY:
+            {
+                size_t len = readLength(1);
+                const uint8_t *values = _source.fetch(len);
+
+                visitor.onByteArray(name, ArrayView<uint8_t>(values, len));
+                break;
+            }
+
+            case TAG_INT_ARRAY:
+            {
+                size_t len = readLength(4);
+                _values.resize(len * 4);
+                _source.read(_values.data(), len * 4);
+                convertBigEndian32(_values.data(), _values.data(), len);
+
+                visitor.onIntArray(name, ArrayView<int32_t>(
+                    reinterpret_cast<const int32_t *>(_values.data()), len));
+                break;
+            }
+
+            case TAG_LONG_ARRAY:
+            {
+                size_t len = readLength(8);
+                _values.resize(len * 8);
+                _source.read(_values.data(), len * 8);
+                convertBigEndian64(_values.data(), _values.data(), len);
+
+                visitor.onLongArray(name, ArrayView<int64_t>(
+                    reinterpret_cast<const int64_t *>(_values.data()), len));
+                break;
+            }
+
+            case TAG_STRING:
+            {
+                uint16_t len = readShort();
+                const char *str = reinterpret_cast<const char *>(_source.fetch(len));
+
+                visitor.onString(name, StringView(str, len));
+                break;
+            }
+
+            case TAG_LIST:
+            {
+                uint8_t childType = readByte();
+                size_t childSize = Tag::getPayloadSize(childType);
+                size_t len = readLength(childSize != 0 ? childSize : 1);
+
+                NbtVisitor::Action action = visitor.onBeginList(name, childType, len);
+                if (action == NbtVisitor::STOP)
+                {
+                    _stopped = true;
+                    return;
+                }
+
+                if (action == NbtVisitor::SKIP)
+                {
+                    if (childSize != 0)
+                        _source.skip(len * childSize);
+
+                    for (size_t i = 0; childSize == 0 && i < len && !failed(); ++i)
+                        skipPayload(childType);
+                    return;
+                }
+
+                for (size_t i = 0; i < len && !failed(); ++i)
+                {
+                    visitPayload(childType, StringView(), visitor);
+                    if (_stopped)
+                        return;
+                }
+
+                visitor.onEndList();
+                break;
+            }
+
+            case TAG_COMPOUND:
+            {
+                NbtVisitor::Action action = visitor.onBeginCompound(name);
+                if (action == NbtVisitor::STOP)
+                {
+                    _stopped = true;
+                    return;
+                }
+
+                if (action == NbtVisitor::SKIP)
+                {
+                    skipPayload(TAG_COMPOUND);
+                    return;
+                }
+
+                while (visitTag(visitor))
+                {
+                    if (_stopped || failed())
+                        return;
+                }
+
+                visitor.onEndCompound();
+                break;
+            }
+
+            default:
+                _failed = true;
+                break;
+        }
+    }
+
+
+    template <typename Source>
+    Tag *NbtDecoder<Source>::readPayload(uint8_t type)
+    {
+        Tag *tag = Tag::create(type);
+        if (tag == NULL)
+        {
+            _failed = true;
+            return NULL;
+        }
+
+        try
+        {
+            readPayload(type, tag);
+        }
+        catch (...)
+        {
+            Tag::destroy(tag);
+            throw;
+        }
+
+        return tag;
+    }
+
+
+    template <typename Source>
+    void NbtDecoder<Source>::readPayload(uint8_t type, Tag *tag)
+    {
+        switch (type)
+        {
+            case TAG_BYTE:
+                static_cast<TagByte *>(tag)->setValue(readByte());
+                break;
+
+            case TAG_SHORT:
+                static_cast<TagShort *>(tag)->setValue(readShort());
+                break;
+
+            case TAG_INT:
+                static_cast<TagInt *>(tag)->setValue(readInt());
+                break;
+
+            case TAG_LONG:
+                static_cast<TagLong *>(tag)->setValue(readLong());
+                break;
+
+            case TAG_FLOAT:
+            {
+                union
+                {
+                    uint32_t i;
+                    float f;
+                } val;
+                val.i = readInt();
+
+                static_cast<TagFloat *>(tag)->setValue(val.f);
+                break;
+            }
+
+            case TAG_DOUBLE:
+            {
+                union
+                {
+                    uint64_t l;
+                    double d;
+                } val;
+                val.l = readLong();
+
+                static_cast<TagDouble *>(tag)->setValue(val.d);
+                break;
+            }
+
+            case TAG_BYTE_ARRAY:
+            {
+                size_t len = readLength(1);
+                unsigned char *values = NbtArena::newArray<unsigned char>(len);
+                _source.read(values, len);
+
+                static_cast<TagByteArray *>(tag)->setValues(values, len);
+                break;
+            }
+
+            case TAG_STRING:
+            {
+                uint16_t len = readShort();
+                const char *str = reinterpret_cast<const char *>(_source.fetch(len));
+
+                if (_internStrings)
+                    static_cast<TagString *>(tag)->setValue(NbtStringPool::intern(StringView(str, len)));
+                else
+                    static_cast<TagString *>(tag)->setValue(StringView(str, len));
+                break;
+            }
+
+            case TAG_LIST:
+            {
+                TagList *list = static_cast<TagList *>(tag);
+
+                uint8_t childType = readByte();
+                size_t childSize = Tag::getPayloadSize(childType);
+                size_t len = readLength(childSize != 0 ? childSize : 1);
+
+                list->setChildType(childType);
+
+                // Not reserved: each element takes at least a byte of input
+                // but up to a pointer and a tag in memory, so a length that
+                // passes readLength() can still ask for far too much
+                if (list->isPacked())
+                {
+                    readPackedList(list, len);
+                    return;
+                }
+
+                for (size_t i = 0; i < len && !failed(); ++i)
+                {
+                    Tag *child = readPayload(childType);
+                    if (child == NULL)
+                        break;
+
+                    list->append(child);
+                }
+                break;
+            }
+
+            case TAG_COMPOUND:
+            {
+                TagCompound *compound = static_cast<TagCompound *>(tag);
+
+                Tag *child;
+                while ((child = readTag()) != NULL)
+                    compound->insert(child);
+                break;
+            }
+
+            case TAG_INT_ARRAY:
+            {
+                size_t len = readLength(4);
+                int *values = NbtArena::newArray<int>(len);
+                _source.read(values, len * 4);
+                convertBigEndian32(values, values, len);
+
+                static_cast<TagIntArray *>(tag)->setValues(values, len);
+                break;
+            }
+
+            case TAG_LONG_ARRAY:
+            {
+                size_t len = readLength(8);
+                int64_t *values = NbtArena::newArray<int64_t>(len);
+                _source.read(values, len * 8);
+                convertBigEndian64(values, values, len);
+
+                static_cast<TagLongArray *>(tag)->setValues(values, len);
+                break;
+            }
+        }
+    }
+}
+
+#endif
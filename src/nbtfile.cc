@@ -20,285 +20,337 @@
 
 namespace nbt
 {
-    typedef Tag *(NbtFile::*NbtMembFn)(); // Again...
-
     NbtFile::NbtFile()
-        : _fname(""), _root(NULL), _file(Z_NULL)
+        : _fname(""), _root(NULL), _ownsRoot(false), _arena(NULL), _internStrings(false),
+          _codec(NbtCodec::GZIP), _file(Z_NULL), _source(new GzSource())
     {
         // empty
     }
 
     NbtFile::NbtFile(const std::string &fname)
-        : _fname(fname), _root(NULL), _file(Z_NULL)
+        : _fname(fname), _root(NULL), _ownsRoot(false), _arena(NULL), _internStrings(false),
+          _codec(NbtCodec::GZIP), _file(Z_NULL), _source(new GzSource())
     {
         open(fname);
     }
 
     NbtFile::~NbtFile()
     {
-        delete _root;
+        if (_ownsRoot)
+            delete _root;
         close();
+        delete _source;
     }
 
     void NbtFile::read() throw (GzipIOException)
     {
-        if (_file == Z_NULL)
-            throw GzipIOException(0);
-
-        if (_root)
+        try
         {
-            delete _root;
-            _root = NULL;
+            decode(NULL);
+        }
+        catch (const std::bad_alloc &)
+        {
+            // A corrupt length can ask for more than there is
+            throw GzipIOException(Z_MEM_ERROR);
         }
-
-        _root = readTag(); // Read root
-
-        return;
-    }
-
-    void NbtFile::write() throw (GzipIOException)
-    {
-        if (_file == Z_NULL)
-            throw GzipIOException(0);
-
-        ByteArray bs = _root->toByteArray();
-
-        ByteArray::const_iterator i;
-        for (i = bs.begin(); i != bs.end(); ++i)
-            gzputc(_file, *i);
-
-        return;
     }
 
-    Tag *NbtFile::getRoot() const
+    void NbtFile::read(const NbtPathSet &paths) throw (GzipIOException)
     {
-        return _root;
-    }
-
-    void NbtFile::setRoot(const Tag &r)
-    {
-        delete _root;
-        _root = r.clone();
+        try
+        {
+            decode(&paths);
+        }
+        catch (const std::bad_alloc &)
+        {
+            throw GzipIOException(Z_MEM_ERROR);
+        }
     }
 
-    void NbtFile::open(const std::string &fname, const std::string &flags) throw (GzipIOException)
+    void NbtFile::decode(const NbtPathSet *paths)
     {
-        if (_file != Z_NULL)
-            close();
-
-        const char *name = ((fname == "") ? _fname : fname).c_str();
-        _file = gzopen(name, flags.c_str());
         if (_file == Z_NULL)
-            throw GzipIOException(errno);
-    }
+            throw GzipIOException(0);
 
-    void NbtFile::close()
-    {
-        gzclose(_file);
-        _file = NULL;
-    }
+        // An arena root may already be gone with its arena
+        if (_ownsRoot)
+            delete _root;
+        _root = NULL;
+        _ownsRoot = (_arena == NULL);
 
-    NbtMembFn NbtFile::getReader(uint8_t type)
-    {
-        switch (type)
+        NbtArena::Scope scope(_arena);
+
+        size_t size;
+        const uint8_t *data = loadDeflated(size);
+        if (data != NULL)
         {
-            case TAG_BYTE:       return &NbtFile::readByte;
-            case TAG_SHORT:      return &NbtFile::readShort;
-            case TAG_INT:        return &NbtFile::readInt;
-            case TAG_LONG:       return &NbtFile::readLong;
-            case TAG_FLOAT:      return &NbtFile::readFloat;
-            case TAG_DOUBLE:     return &NbtFile::readDouble;
-            case TAG_BYTE_ARRAY: return &NbtFile::readByteArray;
-            case TAG_STRING:     return &NbtFile::readString;
-            case TAG_LIST:       return &NbtFile::readList;
-            case TAG_COMPOUND:   return &NbtFile::readCompound;
-            case TAG_INT_ARRAY:  return &NbtFile::readIntArray;
-            default: return NULL; // Also bogus
-        }
-    }
+            MemorySource source(data, size);
+            NbtDecoder<MemorySource> decoder(source, _internStrings);
 
-    Tag *NbtFile::readTag()
-    {
-        uint8_t type = 0;
+            _root = paths ? decoder.readTag(*paths) : decoder.readTag(); // Read root
+            if (decoder.failed() || _root == NULL)
+            {
+                if (_ownsRoot)
+                    delete _root;
+                _root = NULL;
 
-        gzread(_file, &type, 1);
-        if (type == TAG_END)
-            return new TagEnd();
+                throw GzipIOException(Z_DATA_ERROR);
+            }
 
-        Tag *nameTag = readString();
-        TagString *nameTagStr = dynamic_cast<TagString *>(nameTag);
+            return;
+        }
 
-        NbtMembFn reader = getReader(type);
-        Tag *res = (this->*reader)();
-        res->setName(nameTagStr->getValue());
+        NbtDecoder<GzSource> decoder(*_source, _internStrings);
 
-        delete nameTag;
-        return res;
-    }
+        _source->clearError();
+        _root = paths ? decoder.readTag(*paths) : decoder.readTag(); // Read root
 
+        if (decoder.failed() || _root == NULL)
+        {
+            // Plain end of file leaves no zlib error behind
+            int code;
+            gzerror(_file, &code);
+            if (code == Z_OK)
+                code = Z_BUF_ERROR;
+
+            if (_ownsRoot)
+                delete _root;
+            _root = NULL;
 
-    Tag *NbtFile::readByte()
-    {
-        uint8_t byte;
-        gzread(_file, &byte, 1);
+            throw GzipIOException(code);
+        }
 
-        return new TagByte("", byte);
+        return;
     }
 
-    Tag *NbtFile::readShort()
+    // gzread passes files that are not gzip through as they are, which
+    // suits uncompressed NBT. Zlib and raw deflate files are read whole
+    // and inflated here instead; NULL means the file streams as usual.
+    const uint8_t *NbtFile::loadDeflated(size_t &size)
     {
-        int16_t val;
-        gzread(_file, &val, 2);
+        if (!gzdirect(_file) || gztell(_file) != 0)
+            return NULL;
 
-        if (!is_big_endian())
-            flipBytes<int16_t>(val);
+        int first = gzgetc(_file);
+        if (first < 0)
+            return NULL;
 
-        return new TagShort("", val);
-    }
+        gzungetc(first, _file);
+        if (first == TAG_COMPOUND)
+            return NULL;
 
-    Tag *NbtFile::readInt()
-    {
-        int32_t val;
-        gzread(_file, &val, 4);
-
-        if (!is_big_endian())
-            flipBytes<int32_t>(val);
-
-        return new TagInt("", val);
-    }
+        size_t length = 0;
+        _deflated.resize(GzSource::BLOCK_SIZE);
+        for (;;)
+        {
+            int count = gzread(_file, _deflated.data() + length, _deflated.size() - length);
+            if (count < 0)
+            {
+                int code;
+                gzerror(_file, &code);
+                throw GzipIOException(code);
+            }
+            if (count == 0)
+                break;
 
-    Tag *NbtFile::readLong()
-    {
-        int64_t val;
-        gzread(_file, &val, 8);
+            length += count;
+            if (length == _deflated.size())
+                _deflated.resize(_deflated.size() * 2);
+        }
 
-        if (!is_big_endian())
-            flipBytes<int64_t>(val);
+        NbtCodec codec(NbtCodec::sniff(_deflated.data(), length));
+        const uint8_t *data = codec.decompress(_deflated.data(), length, _inflated, size);
+        if (data == NULL)
+            throw GzipIOException(Z_DATA_ERROR);
 
-        return new TagLong("", val);
+        return data;
     }
 
-    Tag *NbtFile::readFloat()
+    void NbtFile::visit(NbtVisitor &visitor) throw (GzipIOException)
     {
-        float val;
-        gzread(_file, &val, 4);
-
-        if (!is_big_endian())
-            flipBytes<float>(val);
-
-        return new TagFloat("", val);
+        try
+        {
+            traverse(visitor);
+        }
+        catch (const std::bad_alloc &)
+        {
+            throw GzipIOException(Z_MEM_ERROR);
+        }
     }
 
-    Tag *NbtFile::readDouble()
+    void NbtFile::traverse(NbtVisitor &visitor)
     {
-        double val;
-        gzread(_file, &val, 8);
+        if (_file == Z_NULL)
+            throw GzipIOException(0);
 
-        if (!is_big_endian())
-            flipBytes<double>(val);
+        size_t size;
+        const uint8_t *data = loadDeflated(size);
+        if (data != NULL)
+        {
+            MemorySource source(data, size);
+            NbtDecoder<MemorySource> decoder(source);
 
-        return new TagDouble("", val);
-    }
+            bool visited = decoder.visitTag(visitor);
+            if (!decoder.stopped() && (decoder.failed() || !visited))
+                throw GzipIOException(Z_DATA_ERROR);
 
-    Tag *NbtFile::readByteArray()
-    {
-        int32_t len;
-        gzread(_file, &len, 4);
+            return;
+        }
 
-        if (!is_big_endian())
-            flipBytes<int32_t>(len);
+        NbtDecoder<GzSource> decoder(*_source);
 
-        unsigned char *byteArray = new unsigned char[len];
+        _source->clearError();
+        bool visited = decoder.visitTag(visitor);
 
-        for (int i = 0; i < len; ++i)
+        if (!decoder.stopped() && (decoder.failed() || !visited))
         {
-            uint8_t byte;
-            gzread(_file, &byte, 1);
+            int code;
+            gzerror(_file, &code);
+            if (code == Z_OK)
+                code = Z_BUF_ERROR;
 
-            byteArray[i] = byte;
+            throw GzipIOException(code);
         }
-
-        return new TagByteArray("", byteArray, len);
     }
 
-    Tag *NbtFile::readIntArray()
+    void NbtFile::write() throw (GzipIOException)
     {
-        int32_t len;
-        gzread(_file, &len, 4);
-
-        len = be32toh(len);
+        if (_file == Z_NULL)
+            throw GzipIOException(0);
 
-        int* intArray = new int[len];
+        NbtWriter writer(_root->serializedSize());
+        _root->write(writer);
 
-        gzread(_file, intArray, len * sizeof(int));
+        // Zlib and raw deflate are compressed here and written through
+        // a transparent gzFile
+        const uint8_t *data = writer.data();
+        size_t size = writer.size();
+        ByteArray compressed;
+        if (_codec.getFormat() == NbtCodec::ZLIB || _codec.getFormat() == NbtCodec::RAW)
+        {
+            compressed.resize(_codec.bound(size));
+            if (!_codec.compress(data, size, compressed.data(), size))
+                throw GzipIOException(Z_STREAM_ERROR);
+            data = compressed.data();
+        }
 
-        for (int i = 0; i < len; ++i)
+        if (gzwrite(_file, data, size) != (int)size)
         {
-            intArray[i] = be32toh(intArray[i]);
+            int code;
+            gzerror(_file, &code);
+            throw GzipIOException(code);
         }
 
-        return new TagIntArray("", intArray, len);
+        return;
     }
 
-    Tag *NbtFile::readString()
+    Tag *NbtFile::getRoot() const
     {
-        int16_t len;
-        gzread(_file, &len, 2);
+        return _root;
+    }
 
-        if (!is_big_endian())
-            flipBytes<int16_t>(len);
+    void NbtFile::setRoot(const Tag &r)
+    {
+        if (_ownsRoot)
+            delete _root;
+        _root = r.clone();
+        _ownsRoot = true;
+    }
 
-        std::string str;
-        for (int i = 0; i < len; ++i)
-        {
-            // TODO: Read blocks
-            uint8_t ch;
-            gzread(_file, &ch, 1);
-            str.push_back(ch);
-        }
+    void NbtFile::setRoot(Tag &&r)
+    {
+        if (_ownsRoot)
+            delete _root;
+        _root = r.moveClone();
+        _ownsRoot = true;
+    }
 
-        return new TagString("", str);
+    void NbtFile::setRoot(std::unique_ptr<Tag> r)
+    {
+        if (_ownsRoot)
+            delete _root;
+        _root = r.release();
+        _ownsRoot = true;
     }
 
-    Tag *NbtFile::readList()
+    void NbtFile::setArena(NbtArena *arena)
     {
-        int8_t childType;
-        int32_t len;
+        _arena = arena;
+    }
 
-        gzread(_file, &childType, 1);
-        gzread(_file, &len, 4);
+    NbtArena *NbtFile::getArena() const
+    {
+        return _arena;
+    }
 
-        TagList *ret = new TagList(childType, "");
+    void NbtFile::setInternStrings(bool intern)
+    {
+        _internStrings = intern;
+    }
 
-        if (!is_big_endian())
-            flipBytes<int32_t>(len);
+    bool NbtFile::getInternStrings() const
+    {
+        return _internStrings;
+    }
 
-        NbtMembFn reader = getReader(childType);
-        for (int i = 0; i < len; ++i)
-        {
-            Tag *child = (this->*reader)();
-            ret->append(child);
-        }
+    void NbtFile::setMaxLength(size_t bytes)
+    {
+        _source->setMaxLength(bytes);
+    }
 
-        return ret;
+    void NbtFile::setCodec(const NbtCodec &codec)
+    {
+        _codec = codec;
+    }
+
+    const NbtCodec &NbtFile::getCodec() const
+    {
+        return _codec;
     }
 
-    Tag *NbtFile::readCompound()
+    void NbtFile::open(const std::string &fname, const std::string &flags) throw (GzipIOException)
     {
-        Tag *child = NULL;
-        TagCompound *ret = new TagCompound("");
+        if (_file != Z_NULL)
+            close();
 
-        while (((child = readTag()) != NULL))
+        // gzopen takes the level and strategy as mode letters, and "T"
+        // for writing without the gzip wrapper
+        std::string mode = flags;
+        if (flags.find_first_of("wa") != std::string::npos)
         {
-            if (child->getType() == TAG_END)
+            if (_codec.getFormat() != NbtCodec::GZIP)
             {
-                delete child;
-                break;
+                mode += 'T';
+            }
+            else
+            {
+                if (_codec.getLevel() >= 0 && _codec.getLevel() <= 9)
+                    mode += char('0' + _codec.getLevel());
+
+                switch (_codec.getStrategy())
+                {
+                    case Z_FILTERED:     mode += 'f'; break;
+                    case Z_HUFFMAN_ONLY: mode += 'h'; break;
+                    case Z_RLE:          mode += 'R'; break;
+                    case Z_FIXED:        mode += 'F'; break;
+                }
             }
-
-            ret->insert(child);
         }
 
-        return ret;
+        const char *name = ((fname == "") ? _fname : fname).c_str();
+        _file = gzopen(name, mode.c_str());
+        if (_file == Z_NULL)
+            throw GzipIOException(errno);
+
+        // Let zlib inflate in large steps too
+        gzbuffer(_file, GzSource::BLOCK_SIZE);
+        _source->reset(GzInput(_file));
+    }
+
+    void NbtFile::close()
+    {
+        gzclose(_file);
+        _file = NULL;
+        _source->reset(GzInput());
     }
 }
@@ -0,0 +1,1193 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#include <algorithm>
+#include <set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nbt
+{
+    namespace
+    {
+        const char MAGIC[4] = { 'N', 'B', 'T', 'I' };
+        const uint16_t VERSION = 1;
+
+        // Written in host order, so an image from a host of the other
+        // byte order reads back as 0x0201
+        const uint16_t HOST_ORDER = 0x0102;
+
+        // Keys between two restarts are stored as the length shared with
+        // the previous key plus the rest
+        const uint32_t RESTART_INTERVAL = 16;
+
+        struct Header
+        {
+            char magic[4];
+            uint16_t version;
+            uint16_t byteOrder;
+            uint32_t size;
+            uint32_t keyCount;
+            uint32_t keyRestarts;   // uint32_t offset of every 16th key
+            uint32_t root;          // Node
+            uint32_t rootKey;
+            uint32_t reserved;
+        };
+
+        // Fixed width values are held in value; strings, arrays, lists and
+        // compounds keep an offset to their data there instead. Compound
+        // data is a uint32_t key id per entry, sorted, then the entries'
+        // Nodes. Lists hold packed values, or Nodes for other types.
+        struct Node
+        {
+            uint8_t type;
+            uint8_t childType;
+            uint16_t reserved;
+            uint32_t count;
+            uint64_t value;
+        };
+
+        const size_t NODE_SIZE = sizeof(Node);
+        const size_t VALUE_OFFSET = offsetof(Node, value);
+
+        template <typename T>
+        inline T load(const uint8_t *pos)
+        {
+            T val;
+            memcpy(&val, pos, sizeof(val));
+            return val;
+        }
+
+        inline size_t align8(size_t offset)
+        {
+            return (offset + 7) & ~static_cast<size_t>(7);
+        }
+
+        class ImageBuilder
+        {
+            public:
+                ImageBuilder(const Tag &root);
+
+                ByteArray &image() { return _out; }
+
+            protected:
+                void collect(const Tag &tag);
+                void writeKeys();
+                size_t reserve(size_t length, size_t align);
+                void emit(const Tag &tag, size_t node);
+
+                template <typename T>
+                void put(size_t offset, const T &val)
+                {
+                    memcpy(&_out[offset], &val, sizeof(val));
+                }
+
+                template <typename T>
+                void putArray(size_t node, const T *values, size_t count)
+                {
+                    size_t offset = reserve(count * sizeof(T), 8);
+                    if (count > 0)
+                        memcpy(&_out[offset], values, count * sizeof(T));
+
+                    put<uint32_t>(node + offsetof(Node, count), count);
+                    put<uint64_t>(node + VALUE_OFFSET, offset);
+                }
+
+                ByteArray _out;
+                std::set<std::string> _names;
+                std::map<std::string, uint32_t> _ids;
+        };
+
+
+        ImageBuilder::ImageBuilder(const Tag &root)
+        {
+            collect(root);
+            _names.insert(root.getName());
+
+            reserve(sizeof(Header), 8);
+            writeKeys();
+
+            size_t node = reserve(NODE_SIZE, 8);
+            emit(root, node);
+
+            Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.byteOrder = HOST_ORDER;
+            header.size = _out.size();
+            header.keyCount = _ids.size();
+            header.keyRestarts = sizeof(Header);
+            header.root = node;
+            header.rootKey = _ids[root.getName()];
+
+            put(0, header);
+        }
+
+
+        void ImageBuilder::collect(const Tag &tag)
+        {
+            if (tag.getType() == TAG_COMPOUND)
+            {
+                const TagCompound::Map &map = static_cast<const TagCompound &>(tag).getValue();
+                for (TagCompound::Map::const_iterator i = map.begin(); i != map.end(); ++i)
+                {
+                    _names.insert(i->first.str());
+                    collect(*i->second);
+                }
+            }
+            else if (tag.getType() == TAG_LIST)
+            {
+                const TagList &list = static_cast<const TagList &>(tag);
+                if (Tag::getPayloadSize(list.getChildType()) == 0)
+                {
+                    for (size_t i = 0; i < list.size(); ++i)
+                        collect(*list.at(i));
+                }
+            }
+        }
+
+
+        void ImageBuilder::writeKeys()
+        {
+            size_t restarts = (_names.size() + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+            size_t table = reserve(restarts * sizeof(uint32_t), 4);
+
+            const std::string *prev = NULL;
+            uint32_t id = 0;
+            for (std::set<std::string>::const_iterator i = _names.begin(); i != _names.end(); ++i, ++id)
+            {
+                uint16_t shared = 0;
+                if (id % RESTART_INTERVAL == 0)
+                {
+                    put<uint32_t>(table + id / RESTART_INTERVAL * sizeof(uint32_t), _out.size());
+                }
+                else
+                {
+                    size_t limit = std::min(prev->size(), i->size());
+                    while (shared < limit && (*prev)[shared] == (*i)[shared])
+                        ++shared;
+                }
+
+                uint16_t rest = i->size() - shared;
+                size_t offset = reserve(2 * sizeof(uint16_t) + rest, 1);
+                put(offset, shared);
+                put(offset + sizeof(uint16_t), rest);
+                memcpy(&_out[offset + 2 * sizeof(uint16_t)], i->data() + shared, rest);
+
+                _ids[*i] = id;
+                prev = &*i;
+            }
+        }
+
+
+        size_t ImageBuilder::reserve(size_t length, size_t align)
+        {
+            size_t offset = (_out.size() + align - 1) / align * align;
+            _out.resize(offset + length, 0);
+
+            return offset;
+        }
+
+
+        void ImageBuilder::emit(const Tag &tag, size_t node)
+        {
+            uint8_t type = tag.getType();
+            put(node + offsetof(Node, type), type);
+
+            // The output grows as children are laid out, so everything is
+            // addressed by offset rather than by pointer
+            size_t value = node + VALUE_OFFSET;
+            switch (type)
+            {
+                case TAG_BYTE:
+                    put(value, static_cast<const TagByte &>(tag).getValue());
+                    break;
+
+                case TAG_SHORT:
+                    put(value, static_cast<const TagShort &>(tag).getValue());
+                    break;
+
+                case TAG_INT:
+                    put(value, static_cast<const TagInt &>(tag).getValue());
+                    break;
+
+                case TAG_LONG:
+                    put(value, static_cast<const TagLong &>(tag).getValue());
+                    break;
+
+                case TAG_FLOAT:
+                    put(value, static_cast<const TagFloat &>(tag).getValue());
+                    break;
+
+                case TAG_DOUBLE:
+                    put(value, static_cast<const TagDouble &>(tag).getValue());
+                    break;
+
+                case TAG_STRING:
+                {
+                    std::string str = static_cast<const TagString &>(tag).getValue();
+                    putArray(node, str.data(), str.size());
+                    break;
+                }
+
+                case TAG_BYTE_ARRAY:
+                {
+                    const TagByteArray &array = static_cast<const TagByteArray &>(tag);
+                    putArray(node, array.getValues(), array.getSize());
+                    break;
+                }
+
+                case TAG_INT_ARRAY:
+                {
+                    const TagIntArray &array = static_cast<const TagIntArray &>(tag);
+                    putArray(node, array.getValues(), array.getSize());
+                    break;
+                }
+
+                case TAG_LONG_ARRAY:
+                {
+                    const TagLongArray &array = static_cast<const TagLongArray &>(tag);
+                    putArray(node, array.getValues(), array.getSize());
+                    break;
+                }
+
+                case TAG_LIST:
+                {
+                    const TagList &list = static_cast<const TagList &>(tag);
+                    uint8_t childType = list.getChildType();
+                    put(node + offsetof(Node, childType), childType);
+
+                    switch (childType)
+                    {
+                        case TAG_BYTE:
+                        {
+                            std::vector<int8_t> storage;
+                            putArray(node, list.getBytes(storage).data(), list.size());
+                            return;
+                        }
+                        case TAG_SHORT:
+                        {
+                            std::vector<int16_t> storage;
+                            putArray(node, list.getShorts(storage).data(), list.size());
+                            return;
+                        }
+                        case TAG_INT:
+                        {
+                            std::vector<int32_t> storage;
+                            putArray(node, list.getInts(storage).data(), list.size());
+                            return;
+                        }
+                        case TAG_LONG:
+                        {
+                            std::vector<int64_t> storage;
+                            putArray(node, list.getLongs(storage).data(), list.size());
+                            return;
+                        }
+                        case TAG_FLOAT:
+                        {
+                            std::vector<float> storage;
+                            putArray(node, list.getFloats(storage).data(), list.size());
+                            return;
+                        }
+                        case TAG_DOUBLE:
+                        {
+                            std::vector<double> storage;
+                            putArray(node, list.getDoubles(storage).data(), list.size());
+                            return;
+                        }
+                    }
+
+                    size_t count = list.size();
+                    size_t nodes = reserve(count * NODE_SIZE, 8);
+                    put<uint32_t>(node + offsetof(Node, count), count);
+                    put<uint64_t>(value, nodes);
+
+                    for (size_t i = 0; i < count; ++i)
+                        emit(*list.at(i), nodes + i * NODE_SIZE);
+                    break;
+                }
+
+                case TAG_COMPOUND:
+                {
+                    const TagCompound::Map &map = static_cast<const TagCompound &>(tag).getValue();
+
+                    std::vector<std::pair<uint32_t, const Tag *> > entries;
+                    entries.reserve(map.size());
+                    for (TagCompound::Map::const_iterator i = map.begin(); i != map.end(); ++i)
+                        entries.push_back(std::make_pair(_ids[i->first.str()], i->second));
+                    std::sort(entries.begin(), entries.end());
+
+                    size_t count = entries.size();
+                    size_t keys = reserve(count * sizeof(uint32_t), 8);
+                    size_t nodes = reserve(count * NODE_SIZE, 8);
+                    put<uint32_t>(node + offsetof(Node, count), count);
+                    put<uint64_t>(value, keys);
+
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        put(keys + i * sizeof(uint32_t), entries[i].first);
+                        emit(*entries[i].second, nodes + i * NODE_SIZE);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+
+    NbtImage::NbtImage()
+        : _data(NULL), _size(0), _mapSize(0)
+    {
+
+    }
+
+
+    NbtImage::NbtImage(const std::string &fname)
+        : _data(NULL), _size(0), _mapSize(0)
+    {
+        open(fname);
+    }
+
+
+    NbtImage::~NbtImage()
+    {
+        close();
+    }
+
+
+    ByteArray NbtImage::compile(const Tag &root)
+    {
+        ImageBuilder builder(root);
+
+        ByteArray ret;
+        if (builder.image().size() <= 0xffffffffu)
+            ret.swap(builder.image());
+
+        return ret;
+    }
+
+
+    void NbtImage::compile(const Tag &root, const std::string &fname)
+    {
+        ByteArray image = compile(root);
+        if (image.empty())
+            throw ImageIOException(EFBIG);
+
+        int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw ImageIOException(errno);
+
+        const uint8_t *pos = image.data();
+        size_t left = image.size();
+        while (left > 0)
+        {
+            ssize_t ret = ::write(fd, pos, left);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0)
+            {
+                int code = errno;
+                ::close(fd);
+                throw ImageIOException(code);
+            }
+
+            pos += ret;
+            left -= ret;
+        }
+
+        if (::close(fd) < 0)
+            throw ImageIOException(errno);
+    }
+
+
+    void NbtImage::open(const std::string &fname)
+    {
+        close();
+
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw ImageIOException(errno);
+
+        map(fd);
+    }
+
+
+    void NbtImage::publishShared(const Tag &root, const std::string &name)
+    {
+        ByteArray image = compile(root);
+        if (image.empty())
+            throw ImageIOException(EFBIG);
+
+        // A fresh object each time, so processes still attached to an
+        // earlier image keep it intact
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            throw ImageIOException(errno);
+
+        void *map = MAP_FAILED;
+        if (ftruncate(fd, image.size()) == 0)
+            map = mmap(NULL, image.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        int code = errno;
+        ::close(fd);
+        if (map == MAP_FAILED)
+            throw ImageIOException(code);
+
+        // The magic goes in last, with a release store that attach()
+        // pairs with an acquire load before it reads anything else. A
+        // segment still being filled fails to attach rather than showing
+        // half an image.
+        uint8_t *dst = static_cast<uint8_t *>(map);
+        memcpy(dst + sizeof(MAGIC), image.data() + sizeof(MAGIC), image.size() - sizeof(MAGIC));
+
+        uint32_t magic;
+        memcpy(&magic, MAGIC, sizeof(magic));
+        __atomic_store_n(reinterpret_cast<uint32_t *>(dst), magic, __ATOMIC_RELEASE);
+
+        munmap(map, image.size());
+    }
+
+
+    void NbtImage::openShared(const std::string &name)
+    {
+        close();
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw ImageIOException(errno);
+
+        map(fd);
+    }
+
+
+    void NbtImage::unlinkShared(const std::string &name)
+    {
+        shm_unlink(name.c_str());
+    }
+
+
+    void NbtImage::map(int fd)
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+        {
+            int code = errno;
+            ::close(fd);
+            throw ImageIOException(code);
+        }
+
+        void *map = MAP_FAILED;
+        if (st.st_size > 0)
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        // The mapping keeps the file or segment alive on its own
+        int code = errno;
+        ::close(fd);
+        if (map == MAP_FAILED)
+            throw ImageIOException(st.st_size > 0 ? code : EINVAL);
+
+        if (!attach(map, st.st_size))
+        {
+            munmap(map, st.st_size);
+            throw ImageIOException(EINVAL);
+        }
+
+        _mapSize = st.st_size;
+    }
+
+
+    bool NbtImage::attach(const void *data, size_t size)
+    {
+        close();
+
+        if (data == NULL || reinterpret_cast<uintptr_t>(data) % 8 != 0 || size < sizeof(Header))
+            return false;
+
+        // Pairs with the release in publishShared(), so the header is read
+        // only once the magic says it is all there
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        uint32_t magic = __atomic_load_n(reinterpret_cast<const uint32_t *>(bytes), __ATOMIC_ACQUIRE);
+        if (memcmp(&magic, MAGIC, sizeof(MAGIC)) != 0)
+            return false;
+
+        Header header = load<Header>(bytes);
+        if (header.version != VERSION || header.byteOrder != HOST_ORDER || header.size > size)
+            return false;
+
+        _data = bytes;
+        _size = header.size;
+
+        size_t restarts = (header.keyCount + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+        if (at(header.keyRestarts, restarts * sizeof(uint32_t)) == NULL
+            || at(header.root, NODE_SIZE) == NULL || header.root % 8 != 0)
+        {
+            _data = NULL;
+            _size = 0;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void NbtImage::close()
+    {
+        if (_mapSize != 0)
+            munmap(const_cast<uint8_t *>(_data), _mapSize);
+
+        _data = NULL;
+        _size = 0;
+        _mapSize = 0;
+    }
+
+
+    bool NbtImage::isValid() const
+    {
+        return _data != NULL;
+    }
+
+
+    const uint8_t *NbtImage::data() const
+    {
+        return _data;
+    }
+
+
+    size_t NbtImage::size() const
+    {
+        return _size;
+    }
+
+
+    NbtImageView NbtImage::getRoot() const
+    {
+        if (_data == NULL)
+            return NbtImageView();
+
+        Header header = load<Header>(_data);
+        return NbtImageView(this, _data + header.root, header.rootKey);
+    }
+
+
+    size_t NbtImage::getKeyCount() const
+    {
+        if (_data == NULL)
+            return 0;
+
+        return load<Header>(_data).keyCount;
+    }
+
+
+    std::string NbtImage::getKey(uint32_t id) const
+    {
+        std::string key;
+        if (id >= getKeyCount())
+            return key;
+
+        Header header = load<Header>(_data);
+        uint32_t offset = load<uint32_t>(_data + header.keyRestarts
+                                         + id / RESTART_INTERVAL * sizeof(uint32_t));
+
+        for (uint32_t i = 0; i <= id % RESTART_INTERVAL; ++i)
+        {
+            const uint8_t *entry = at(offset, 2 * sizeof(uint16_t));
+            if (entry == NULL)
+                return std::string();
+
+            uint16_t shared = load<uint16_t>(entry);
+            uint16_t rest = load<uint16_t>(entry + sizeof(uint16_t));
+            const uint8_t *chars = at(offset + 2 * sizeof(uint16_t), rest);
+            if (chars == NULL || shared > key.size())
+                return std::string();
+
+            key.resize(shared);
+            key.append(reinterpret_cast<const char *>(chars), rest);
+            offset += 2 * sizeof(uint16_t) + rest;
+        }
+
+        return key;
+    }
+
+
+    bool NbtImage::findKey(const StringView &key, uint32_t &id) const
+    {
+        size_t count = getKeyCount();
+        if (count == 0)
+            return false;
+
+        Header header = load<Header>(_data);
+        const uint8_t *restarts = _data + header.keyRestarts;
+        size_t blocks = (count + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+
+        // The first key of a block is stored whole, so blocks are found
+        // by binary search without decoding anything
+        size_t lo = 0;
+        size_t hi = blocks;
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            uint32_t offset = load<uint32_t>(restarts + mid * sizeof(uint32_t));
+            const uint8_t *entry = at(offset, 2 * sizeof(uint16_t));
+            if (entry == NULL)
+                return false;
+
+            uint16_t length = load<uint16_t>(entry + sizeof(uint16_t));
+            const uint8_t *chars = at(offset + 2 * sizeof(uint16_t), length);
+            if (chars == NULL)
+                return false;
+
+            if (StringView(reinterpret_cast<const char *>(chars), length).compare(key) <= 0)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        // Then walked within the block, which is in sorted order
+        uint32_t first = lo * RESTART_INTERVAL;
+        uint32_t last = std::min(count, static_cast<size_t>(first + RESTART_INTERVAL));
+        for (uint32_t i = first; i < last; ++i)
+        {
+            std::string candidate = getKey(i);
+            if (StringView(candidate) == key)
+            {
+                id = i;
+                return true;
+            }
+            if (key < StringView(candidate))
+                break;
+        }
+
+        return false;
+    }
+
+
+    const uint8_t *NbtImage::at(uint64_t offset, uint64_t length) const
+    {
+        if (offset > _size || length > _size - offset)
+            return NULL;
+
+        return _data + offset;
+    }
+
+
+    NbtImageView::NbtImageView()
+        : _image(NULL), _type(TAG_END), _childType(TAG_END), _count(0),
+          _key(NO_KEY), _value(NULL)
+    {
+
+    }
+
+
+    NbtImageView::NbtImageView(const NbtImage *image, const uint8_t *node, uint32_t key)
+        : _image(image), _type(TAG_END), _childType(TAG_END), _count(0),
+          _key(key), _value(NULL)
+    {
+        if (node == NULL)
+            return;
+
+        Node header = load<Node>(node);
+        _type = header.type;
+        _childType = header.childType;
+        _count = header.count;
+        _value = node + VALUE_OFFSET;
+    }
+
+
+    NbtImageView::NbtImageView(const NbtImage *image, uint8_t type, const uint8_t *value)
+        : _image(image), _type(type), _childType(TAG_END), _count(0),
+          _key(NO_KEY), _value(value)
+    {
+
+    }
+
+
+    bool NbtImageView::isValid() const
+    {
+        return _type != TAG_END;
+    }
+
+
+    uint8_t NbtImageView::getType() const
+    {
+        return _type;
+    }
+
+
+    std::string NbtImageView::getName() const
+    {
+        if (_key == NO_KEY)
+            return std::string();
+
+        return _image->getKey(_key);
+    }
+
+
+    NbtImageView NbtImageView::getValueAt(const StringView &key) const
+    {
+        uint32_t id;
+        if (_type != TAG_COMPOUND || !_image->findKey(key, id))
+            return NbtImageView();
+
+        uint64_t offset = load<uint64_t>(_value);
+        const uint8_t *keys = _image->at(offset, _count * sizeof(uint32_t));
+        if (keys == NULL)
+            return NbtImageView();
+
+        // Entries are sorted by key id
+        size_t lo = 0;
+        size_t hi = _count;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            uint32_t current = load<uint32_t>(keys + mid * sizeof(uint32_t));
+            if (current == id)
+                return at(mid);
+
+            if (current < id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        return NbtImageView();
+    }
+
+
+    NbtImageView NbtImageView::operator[](const StringView &key) const
+    {
+        return getValueAt(key);
+    }
+
+
+    bool NbtImageView::hasKey(const StringView &key) const
+    {
+        return getValueAt(key).isValid();
+    }
+
+
+    int NbtImageView::getInt(const StringView &key) const
+    {
+        return getValueAt(key).getInt();
+    }
+
+
+    short NbtImageView::getShort(const StringView &key) const
+    {
+        return getValueAt(key).getShort();
+    }
+
+
+    char NbtImageView::getByte(const StringView &key) const
+    {
+        return getValueAt(key).getByte();
+    }
+
+
+    bool NbtImageView::getBool(const StringView &key) const
+    {
+        return getValueAt(key).getByte() != 0;
+    }
+
+
+    int64_t NbtImageView::getLong(const StringView &key) const
+    {
+        return getValueAt(key).getLong();
+    }
+
+
+    float NbtImageView::getFloat(const StringView &key) const
+    {
+        return getValueAt(key).getFloat();
+    }
+
+
+    double NbtImageView::getDouble(const StringView &key) const
+    {
+        return getValueAt(key).getDouble();
+    }
+
+
+    StringView NbtImageView::getString(const StringView &key) const
+    {
+        return getValueAt(key).getString();
+    }
+
+
+    size_t NbtImageView::size() const
+    {
+        switch (_type)
+        {
+            case TAG_STRING:
+            case TAG_BYTE_ARRAY:
+            case TAG_INT_ARRAY:
+            case TAG_LONG_ARRAY:
+            case TAG_LIST:
+            case TAG_COMPOUND:
+                return _count;
+
+            default:
+                return 0;
+        }
+    }
+
+
+    uint8_t NbtImageView::getChildType() const
+    {
+        return _type == TAG_LIST ? _childType : TAG_END;
+    }
+
+
+    NbtImageView NbtImageView::at(size_t i) const
+    {
+        if (i >= _count || (_type != TAG_LIST && _type != TAG_COMPOUND))
+            return NbtImageView();
+
+        // compile() lays children out after their parent, so a corrupt
+        // image cannot lead a walk around in circles
+        uint64_t offset = load<uint64_t>(_value);
+        if (offset <= static_cast<uint64_t>(_value - _image->data()))
+            return NbtImageView();
+
+        if (_type == TAG_LIST)
+        {
+            size_t elemSize = Tag::getPayloadSize(_childType);
+            if (elemSize != 0)
+                return NbtImageView(_image, _childType, _image->at(offset + i * elemSize, elemSize));
+
+            return NbtImageView(_image, _image->at(offset + i * NODE_SIZE, NODE_SIZE), NO_KEY);
+        }
+
+        const uint8_t *key = _image->at(offset + i * sizeof(uint32_t), sizeof(uint32_t));
+        uint64_t nodes = align8(offset + _count * sizeof(uint32_t));
+        if (key == NULL)
+            return NbtImageView();
+
+        return NbtImageView(_image, _image->at(nodes + i * NODE_SIZE, NODE_SIZE),
+                            load<uint32_t>(key));
+    }
+
+
+    NbtImageView NbtImageView::operator[](size_t i) const
+    {
+        return at(i);
+    }
+
+
+    template <typename T>
+    T NbtImageView::scalar(uint8_t type) const
+    {
+        if (_type != type || _value == NULL)
+            return 0;
+
+        return load<T>(_value);
+    }
+
+
+    int8_t NbtImageView::getByte() const
+    {
+        return scalar<int8_t>(TAG_BYTE);
+    }
+
+
+    int16_t NbtImageView::getShort() const
+    {
+        return scalar<int16_t>(TAG_SHORT);
+    }
+
+
+    int32_t NbtImageView::getInt() const
+    {
+        return scalar<int32_t>(TAG_INT);
+    }
+
+
+    int64_t NbtImageView::getLong() const
+    {
+        return scalar<int64_t>(TAG_LONG);
+    }
+
+
+    float NbtImageView::getFloat() const
+    {
+        return scalar<float>(TAG_FLOAT);
+    }
+
+
+    double NbtImageView::getDouble() const
+    {
+        return scalar<double>(TAG_DOUBLE);
+    }
+
+
+    StringView NbtImageView::getString() const
+    {
+        ArrayView<char> chars = elements<char>(TAG_STRING, TAG_END);
+        if (chars.empty())
+            return StringView();
+
+        return StringView(chars.data(), chars.size());
+    }
+
+
+    template <typename T>
+    ArrayView<T> NbtImageView::elements(uint8_t type, uint8_t childType) const
+    {
+        if (_type != type || (type == TAG_LIST && _childType != childType))
+            return ArrayView<T>();
+
+        const uint8_t *data = _image->at(load<uint64_t>(_value), _count * sizeof(T));
+        if (data == NULL)
+            return ArrayView<T>();
+
+        return ArrayView<T>(reinterpret_cast<const T *>(data), _count);
+    }
+
+
+    ArrayView<uint8_t> NbtImageView::getByteArray() const
+    {
+        return elements<uint8_t>(TAG_BYTE_ARRAY, TAG_END);
+    }
+
+
+    ArrayView<int32_t> NbtImageView::getIntArray() const
+    {
+        return elements<int32_t>(TAG_INT_ARRAY, TAG_END);
+    }
+
+
+    ArrayView<int64_t> NbtImageView::getLongArray() const
+    {
+        return elements<int64_t>(TAG_LONG_ARRAY, TAG_END);
+    }
+
+
+    ArrayView<int8_t> NbtImageView::getBytes() const
+    {
+        return elements<int8_t>(TAG_LIST, TAG_BYTE);
+    }
+
+
+    ArrayView<int16_t> NbtImageView::getShorts() const
+    {
+        return elements<int16_t>(TAG_LIST, TAG_SHORT);
+    }
+
+
+    ArrayView<int32_t> NbtImageView::getInts() const
+    {
+        return elements<int32_t>(TAG_LIST, TAG_INT);
+    }
+
+
+    ArrayView<int64_t> NbtImageView::getLongs() const
+    {
+        return elements<int64_t>(TAG_LIST, TAG_LONG);
+    }
+
+
+    ArrayView<float> NbtImageView::getFloats() const
+    {
+        return elements<float>(TAG_LIST, TAG_FLOAT);
+    }
+
+
+    ArrayView<double> NbtImageView::getDoubles() const
+    {
+        return elements<double>(TAG_LIST, TAG_DOUBLE);
+    }
+
+
+    Tag *NbtImageView::toTag() const
+    {
+        Tag *tag = Tag::create(_type);
+        if (tag == NULL)
+            return NULL;
+
+        tag->setName(getName());
+
+        switch (_type)
+        {
+            case TAG_BYTE:
+                static_cast<TagByte *>(tag)->setValue(getByte());
+                break;
+
+            case TAG_SHORT:
+                static_cast<TagShort *>(tag)->setValue(getShort());
+                break;
+
+            case TAG_INT:
+                static_cast<TagInt *>(tag)->setValue(getInt());
+                break;
+
+            case TAG_LONG:
+                static_cast<TagLong *>(tag)->setValue(getLong());
+                break;
+
+            case TAG_FLOAT:
+                static_cast<TagFloat *>(tag)->setValue(getFloat());
+                break;
+
+            case TAG_DOUBLE:
+                static_cast<TagDouble *>(tag)->setValue(getDouble());
+                break;
+
+            case TAG_STRING:
+            {
+                // Strings and arrays come out empty when their data is out
+                // of bounds, just like lists
+                StringView value = getString();
+                if (value.size() != _count)
+                {
+                    Tag::destroy(tag);
+                    return NULL;
+                }
+                static_cast<TagString *>(tag)->setValue(value);
+                break;
+            }
+
+            case TAG_BYTE_ARRAY:
+            {
+                ArrayView<uint8_t> values = getByteArray();
+                if (values.size() != _count)
+                {
+                    Tag::destroy(tag);
+                    return NULL;
+                }
+                unsigned char *copy = NbtArena::newArray<unsigned char>(values.size());
+                std::copy(values.begin(), values.end(), copy);
+                static_cast<TagByteArray *>(tag)->setValues(copy, values.size());
+                break;
+            }
+
+            case TAG_INT_ARRAY:
+            {
+                ArrayView<int32_t> values = getIntArray();
+                if (values.size() != _count)
+                {
+                    Tag::destroy(tag);
+                    return NULL;
+                }
+                int *copy = NbtArena::newArray<int>(values.size());
+                std::copy(values.begin(), values.end(), copy);
+                static_cast<TagIntArray *>(tag)->setValues(copy, values.size());
+                break;
+            }
+
+            case TAG_LONG_ARRAY:
+            {
+                ArrayView<int64_t> values = getLongArray();
+                if (values.size() != _count)
+                {
+                    Tag::destroy(tag);
+                    return NULL;
+                }
+                int64_t *copy = NbtArena::newArray<int64_t>(values.size());
+                std::copy(values.begin(), values.end(), copy);
+                static_cast<TagLongArray *>(tag)->setValues(copy, values.size());
+                break;
+            }
+
+            case TAG_LIST:
+            {
+                TagList *list = static_cast<TagList *>(tag);
+                list->setChildType(_childType);
+
+                // A view comes out empty when its data is out of bounds
+                size_t count = 0;
+                switch (_childType)
+                {
+                    case TAG_BYTE:
+                    {
+                        ArrayView<int8_t> values = getBytes();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    case TAG_SHORT:
+                    {
+                        ArrayView<int16_t> values = getShorts();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    case TAG_INT:
+                    {
+                        ArrayView<int32_t> values = getInts();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    case TAG_LONG:
+                    {
+                        ArrayView<int64_t> values = getLongs();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    case TAG_FLOAT:
+                    {
+                        ArrayView<float> values = getFloats();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    case TAG_DOUBLE:
+                    {
+                        ArrayView<double> values = getDoubles();
+                        list->setValues(values.data(), count = values.size());
+                        break;
+                    }
+                    default:
+                        for (; count < _count; ++count)
+                        {
+                            Tag *child = at(count).toTag();
+                            if (child == NULL)
+                                break;
+                            list->append(child);
+                        }
+                }
+
+                if (count != _count)
+                {
+                    Tag::destroy(tag);
+                    return NULL;
+                }
+                break;
+            }
+
+            case TAG_COMPOUND:
+            {
+                TagCompound *compound = static_cast<TagCompound *>(tag);
+                for (size_t i = 0; i < _count; ++i)
+                {
+                    Tag *child = at(i).toTag();
+                    if (child == NULL)
+                    {
+                        Tag::destroy(tag);
+                        return NULL;
+                    }
+                    compound->insert(child);
+                }
+                break;
+            }
+        }
+
+        return tag;
+    }
+}
@@ -0,0 +1,977 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    namespace
+    {
+        // Bytes of a splice before its elements, and of an array range
+        // before its values: op, start, removed, inserted; start, length
+        const size_t SPLICE_HEADER = 13;
+        const size_t RANGE_HEADER = 8;
+
+        uint8_t readByte(MemorySource &source)
+        {
+            return *source.fetch(1);
+        }
+
+        uint16_t readShort(MemorySource &source)
+        {
+            uint16_t val;
+            source.read(&val, sizeof(val));
+            return be16toh(val);
+        }
+
+        uint32_t readInt(MemorySource &source)
+        {
+            uint32_t val;
+            source.read(&val, sizeof(val));
+            return be32toh(val);
+        }
+
+        // Points into the patch; check the source before using it
+        StringView readString(MemorySource &source)
+        {
+            uint16_t len = readShort(source);
+            return StringView(reinterpret_cast<const char *>(source.fetch(len)), len);
+        }
+
+        // Fill in a count written ahead as a placeholder at pos
+        void putCount(NbtWriter &out, size_t pos, uint32_t count)
+        {
+            uint32_t val = htobe32(count);
+            memcpy(&out.getBuffer()[pos], &val, sizeof(val));
+        }
+
+        void truncate(NbtWriter &out, size_t pos)
+        {
+            out.getBuffer().resize(pos);
+        }
+
+        // Values of a byte, int or long array, width bytes each
+        struct ArrayData
+        {
+            const uint8_t *data;
+            size_t size;
+            size_t width;
+        };
+
+        ArrayData arrayData(const Tag &tag)
+        {
+            ArrayData ret = { NULL, 0, 0 };
+
+            switch (tag.getType())
+            {
+                case TAG_BYTE_ARRAY:
+                {
+                    const TagByteArray &array = static_cast<const TagByteArray &>(tag);
+                    ret.data = array.getValues();
+                    ret.size = array.getSize();
+                    ret.width = 1;
+                    break;
+                }
+
+                case TAG_INT_ARRAY:
+                {
+                    const TagIntArray &array = static_cast<const TagIntArray &>(tag);
+                    ret.data = reinterpret_cast<const uint8_t *>(array.getValues());
+                    ret.size = array.getSize();
+                    ret.width = sizeof(int32_t);
+                    break;
+                }
+
+                case TAG_LONG_ARRAY:
+                {
+                    const TagLongArray &array = static_cast<const TagLongArray &>(tag);
+                    ret.data = reinterpret_cast<const uint8_t *>(array.getValues());
+                    ret.size = array.getSize();
+                    ret.width = sizeof(int64_t);
+                    break;
+                }
+            }
+
+            return ret;
+        }
+
+        void writeValues(NbtWriter &out, const ArrayData &array, size_t from, size_t count)
+        {
+            const uint8_t *values = array.data + from * array.width;
+
+            switch (array.width)
+            {
+                case 1:
+                    out.writeBytes(values, count);
+                    break;
+
+                case sizeof(int32_t):
+                    out.writeInts(reinterpret_cast<const int32_t *>(values), count);
+                    break;
+
+                case sizeof(int64_t):
+                    out.writeLongs(reinterpret_cast<const int64_t *>(values), count);
+                    break;
+            }
+        }
+
+        // First element from i on that differs between a and b, or end.
+        // Equal stretches are skipped a block at a time.
+        size_t firstDiff(const uint8_t *a, const uint8_t *b, size_t i, size_t end,
+                         size_t width)
+        {
+            const size_t block = 256 / width;
+            while (end - i >= block && memcmp(a + i * width, b + i * width, block * width) == 0)
+                i += block;
+
+            while (i < end && memcmp(a + i * width, b + i * width, width) == 0)
+                ++i;
+
+            return i;
+        }
+
+        // End of the differences starting at i, taking in equal stretches
+        // too short to pay for the header of another range
+        size_t runEnd(const uint8_t *a, const uint8_t *b, size_t i, size_t end,
+                      size_t width, size_t header)
+        {
+            size_t ret = i + 1;
+            for (size_t j = ret; j < end; ++j)
+            {
+                if (memcmp(a + j * width, b + j * width, width) != 0)
+                    ret = j + 1;
+                else if ((j + 1 - ret) * width > header)
+                    break;
+            }
+
+            return ret;
+        }
+
+        inline void fromBigEndian(uint8_t *dst, const uint8_t *src, size_t count)
+        {
+            memcpy(dst, src, count);
+        }
+
+        inline void fromBigEndian(int32_t *dst, const uint8_t *src, size_t count)
+        {
+            convertBigEndian32(dst, src, count);
+        }
+
+        inline void fromBigEndian(int64_t *dst, const uint8_t *src, size_t count)
+        {
+            convertBigEndian64(dst, src, count);
+        }
+
+        // Values of an array resized to size, with the ranges that follow
+        // in source written over them; NULL on a range out of bounds
+        template <typename T>
+        T *patchValues(const T *values, size_t oldSize, uint32_t size, MemorySource &source)
+        {
+            // Values past the old end all come with the patch
+            uint32_t count = readInt(source);
+            size_t kept = std::min<size_t>(oldSize, size);
+            if (source.failed()
+                || !source.canRead(count * RANGE_HEADER + (size - kept) * sizeof(T)))
+                return NULL;
+
+            T *ret = NbtArena::newArray<T>(size);
+            if (kept > 0)
+                memcpy(ret, values, kept * sizeof(T));
+            if (size > kept)
+                memset(ret + kept, 0, (size - kept) * sizeof(T));
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t from = readInt(source);
+                uint32_t length = readInt(source);
+                const uint8_t *bytes = NULL;
+                if (from <= size && length <= size - from)
+                    bytes = source.fetch(static_cast<size_t>(length) * sizeof(T));
+
+                if (bytes == NULL || source.failed())
+                {
+                    if (NbtArena::current() == NULL)
+                        delete[] ret;
+                    return NULL;
+                }
+
+                fromBigEndian(ret + from, bytes, length);
+            }
+
+            return ret;
+        }
+    }
+
+
+    ByteArray NbtPatch::diff(const Tag &oldTag, const Tag &newTag)
+    {
+        NbtWriter out;
+        out.writeByte(VERSION);
+
+        bool renamed = oldTag.getInternedName() != newTag.getInternedName();
+        out.writeByte(renamed);
+        if (renamed)
+            out.writeString(newTag.getInternedName());
+
+        size_t start = out.size();
+        Match found = match(oldTag, newTag);
+
+        if (found == SAME || (editable(oldTag, newTag) && !diffTag(oldTag, newTag, out)))
+        {
+            if (!renamed)
+                return ByteArray();
+
+            out.writeByte(OP_NONE);
+        }
+        else if (out.size() == start || out.size() - start > 2 + newTag.payloadSize())
+        {
+            // Not editable, or the edit would outgrow the whole tree
+            truncate(out, start);
+            out.writeByte(OP_REPLACE);
+            out.writeByte(newTag.getType());
+            newTag.writePayload(out);
+        }
+
+        ByteArray ret;
+        ret.swap(out.getBuffer());
+        return ret;
+    }
+
+
+    Tag *NbtPatch::apply(const Tag &base, const uint8_t *patch, size_t size)
+    {
+        if (size == 0)
+            return base.clone();
+
+        MemorySource source(patch, size);
+        if (readByte(source) != VERSION)
+            return NULL;
+
+        StringView name = base.getInternedName();
+        if (readByte(source) != 0)
+            name = readString(source);
+
+        uint8_t op = readByte(source);
+        if (source.failed())
+            return NULL;
+
+        Tag *ret;
+        if (op == OP_REPLACE)
+        {
+            NbtDecoder<MemorySource> decoder(source);
+            ret = decoder.readPayload(readByte(source));
+            if (ret == NULL)
+                return NULL;
+
+            if (decoder.failed())
+            {
+                Tag::destroy(ret);
+                return NULL;
+            }
+        }
+        else
+        {
+            ret = base.clone();
+            if (op != OP_NONE && !applyTag(ret, op, source))
+            {
+                Tag::destroy(ret);
+                return NULL;
+            }
+        }
+
+        if (source.failed() || source.remaining() != 0)
+        {
+            Tag::destroy(ret);
+            return NULL;
+        }
+
+        ret->setName(name);
+        return ret;
+    }
+
+
+    Tag *NbtPatch::apply(const Tag &base, const ByteArray &patch)
+    {
+        return apply(base, patch.data(), patch.size());
+    }
+
+
+    NbtPatch::Match NbtPatch::match(const Tag &a, const Tag &b)
+    {
+        if (&a == &b)
+            return SAME;
+
+        if (a.getType() != b.getType())
+            return DIFFERENT;
+
+        const EncodingCache *cacheA;
+        const EncodingCache *cacheB;
+
+        switch (a.getType())
+        {
+            case TAG_COMPOUND:
+            {
+                const TagCompound &compoundA = static_cast<const TagCompound &>(a);
+                const TagCompound &compoundB = static_cast<const TagCompound &>(b);
+
+                // Copies that were never changed apart
+                if (compoundA._body == compoundB._body)
+                    return SAME;
+
+                cacheA = &compoundA._body->cache;
+                cacheB = &compoundB._body->cache;
+                break;
+            }
+
+            case TAG_LIST:
+            {
+                const TagList &listA = static_cast<const TagList &>(a);
+                const TagList &listB = static_cast<const TagList &>(b);
+
+                if (listA._childType != listB._childType)
+                    return DIFFERENT;
+
+                if (listA._body == listB._body)
+                    return SAME;
+
+                cacheA = &listA._body->cache;
+                cacheB = &listB._body->cache;
+                break;
+            }
+
+            case TAG_BYTE:
+                return static_cast<const TagByte &>(a).getValue()
+                    == static_cast<const TagByte &>(b).getValue() ? SAME : DIFFERENT;
+
+            case TAG_SHORT:
+                return static_cast<const TagShort &>(a).getValue()
+                    == static_cast<const TagShort &>(b).getValue() ? SAME : DIFFERENT;
+
+            case TAG_INT:
+                return static_cast<const TagInt &>(a).getValue()
+                    == static_cast<const TagInt &>(b).getValue() ? SAME : DIFFERENT;
+
+            case TAG_LONG:
+                return static_cast<const TagLong &>(a).getValue()
+                    == static_cast<const TagLong &>(b).getValue() ? SAME : DIFFERENT;
+
+            // Compared as encoded, so NaNs and signed zeroes are told apart
+            case TAG_FLOAT:
+            {
+                float valA = static_cast<const TagFloat &>(a).getValue();
+                float valB = static_cast<const TagFloat &>(b).getValue();
+                return memcmp(&valA, &valB, sizeof(valA)) == 0 ? SAME : DIFFERENT;
+            }
+
+            case TAG_DOUBLE:
+            {
+                double valA = static_cast<const TagDouble &>(a).getValue();
+                double valB = static_cast<const TagDouble &>(b).getValue();
+                return memcmp(&valA, &valB, sizeof(valA)) == 0 ? SAME : DIFFERENT;
+            }
+
+            case TAG_STRING:
+            {
+                const TagString &stringA = static_cast<const TagString &>(a);
+                const TagString &stringB = static_cast<const TagString &>(b);
+
+                if (stringA.isInterned() && stringB.isInterned())
+                    return stringA.getInternedValue() == stringB.getInternedValue() ? SAME : DIFFERENT;
+
+                return stringA.value() == stringB.value() ? SAME : DIFFERENT;
+            }
+
+            default:
+            {
+                ArrayData arrayA = arrayData(a);
+                ArrayData arrayB = arrayData(b);
+
+                if (arrayA.size != arrayB.size)
+                    return DIFFERENT;
+
+                return arrayA.size == 0
+                    || memcmp(arrayA.data, arrayB.data, arrayA.size * arrayA.width) == 0
+                    ? SAME : DIFFERENT;
+            }
+        }
+
+        // Encodings from the last writes settle it; the hashes mostly
+        // spare reading the bytes of ones that differ
+        const ByteArray *bytesA = cacheA->get();
+        const ByteArray *bytesB = cacheB->get();
+        if (bytesA == NULL || bytesB == NULL)
+            return UNKNOWN;
+
+        if (bytesA->size() != bytesB->size() || cacheA->getHash() != cacheB->getHash())
+            return DIFFERENT;
+
+        return memcmp(bytesA->data(), bytesB->data(), bytesA->size()) == 0 ? SAME : DIFFERENT;
+    }
+
+
+    bool NbtPatch::editable(const Tag &a, const Tag &b)
+    {
+        if (a.getType() != b.getType())
+            return false;
+
+        switch (a.getType())
+        {
+            case TAG_LIST:
+                return static_cast<const TagList &>(a)._childType
+                    == static_cast<const TagList &>(b)._childType;
+
+            case TAG_COMPOUND:
+            case TAG_BYTE_ARRAY:
+            case TAG_INT_ARRAY:
+            case TAG_LONG_ARRAY:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+
+    bool NbtPatch::diffTag(const Tag &a, const Tag &b, NbtWriter &out)
+    {
+        switch (a.getType())
+        {
+            case TAG_COMPOUND:
+                return diffCompound(static_cast<const TagCompound &>(a),
+                                    static_cast<const TagCompound &>(b), out);
+
+            case TAG_LIST:
+                return diffList(static_cast<const TagList &>(a),
+                                static_cast<const TagList &>(b), out);
+
+            default:
+                return diffArray(a, b, out);
+        }
+    }
+
+
+    bool NbtPatch::diffCompound(const TagCompound &a, const TagCompound &b,
+                                NbtWriter &out)
+    {
+        size_t start = out.size();
+        out.writeByte(OP_COMPOUND);
+        out.writeInt(0);
+
+        uint32_t count = 0;
+        const TagCompound::Map &oldEntries = a._body->value;
+        const TagCompound::Map &newEntries = b._body->value;
+
+        for (const auto &entry : oldEntries)
+        {
+            if (newEntries.find(entry.first) != newEntries.end())
+                continue;
+
+            out.writeByte(ENTRY_REMOVE);
+            out.writeString(entry.first);
+            ++count;
+        }
+
+        for (const auto &entry : newEntries)
+        {
+            const Tag &tag = *entry.second;
+
+            TagCompound::Map::const_iterator oldItr = oldEntries.find(entry.first);
+            if (oldItr != oldEntries.end())
+            {
+                const Tag &oldTag = *oldItr->second;
+                if (match(oldTag, tag) == SAME)
+                    continue;
+
+                if (editable(oldTag, tag))
+                {
+                    size_t pos = out.size();
+                    out.writeByte(ENTRY_EDIT);
+                    out.writeString(entry.first);
+
+                    size_t op = out.size();
+                    if (!diffTag(oldTag, tag, out))
+                    {
+                        truncate(out, pos);
+                        continue;
+                    }
+
+                    // An edit larger than the value goes as the value
+                    if (out.size() - op <= 1 + tag.payloadSize())
+                    {
+                        ++count;
+                        continue;
+                    }
+
+                    truncate(out, pos);
+                }
+            }
+
+            out.writeByte(ENTRY_SET);
+            out.writeString(entry.first);
+            out.writeByte(tag.getType());
+            tag.writePayload(out);
+            ++count;
+        }
+
+        if (count == 0)
+        {
+            truncate(out, start);
+            return false;
+        }
+
+        putCount(out, start + 1, count);
+        return true;
+    }
+
+
+    bool NbtPatch::diffList(const TagList &a, const TagList &b, NbtWriter &out)
+    {
+        if (Tag::getPayloadSize(a._childType) != 0)
+            return diffPacked(a, b, out);
+
+        size_t start = out.size();
+        out.writeByte(OP_LIST);
+        out.writeInt(0);
+
+        uint32_t count = 0;
+        const TagList::Vector &oldItems = a._body->value;
+        const TagList::Vector &newItems = b._body->value;
+        size_t oldSize = oldItems.size();
+        size_t newSize = newItems.size();
+
+        auto alike = [&out](const Tag &x, const Tag &y)
+        {
+            Match found = match(x, y);
+            if (found != UNKNOWN)
+                return found == SAME;
+
+            size_t pos = out.size();
+            bool changed = diffTag(x, y, out);
+            truncate(out, pos);
+            return !changed;
+        };
+
+        auto splice = [&](size_t at, size_t removed, size_t inserted)
+        {
+            out.writeByte(LIST_SPLICE);
+            out.writeInt(at);
+            out.writeInt(removed);
+            out.writeInt(inserted);
+
+            for (size_t i = at; i < at + inserted; ++i)
+                newItems[i]->writePayload(out);
+
+            ++count;
+        };
+
+        // When the length changed, the elements alike at either end stay
+        // put and those in between line up from the front; otherwise all
+        // of them pair up
+        size_t common = std::min(oldSize, newSize);
+        size_t prefix = 0;
+        size_t suffix = 0;
+
+        if (oldSize != newSize)
+        {
+            while (prefix < common && alike(*oldItems[prefix], *newItems[prefix]))
+                ++prefix;
+
+            while (suffix < common - prefix
+                   && alike(*oldItems[oldSize - 1 - suffix], *newItems[newSize - 1 - suffix]))
+                ++suffix;
+        }
+
+        size_t paired = common - suffix;
+        size_t runStart = 0;
+        size_t runLength = 0;
+
+        for (size_t i = prefix; i < paired; ++i)
+        {
+            const Tag &oldTag = *oldItems[i];
+            const Tag &tag = *newItems[i];
+
+            if (match(oldTag, tag) == SAME)
+                continue;
+
+            if (editable(oldTag, tag))
+            {
+                size_t pos = out.size();
+                out.writeByte(LIST_EDIT);
+                out.writeInt(i);
+
+                size_t op = out.size();
+                if (!diffTag(oldTag, tag, out))
+                {
+                    truncate(out, pos);
+                    continue;
+                }
+
+                if (out.size() - op <= tag.payloadSize())
+                {
+                    ++count;
+                    continue;
+                }
+
+                truncate(out, pos);
+            }
+
+            // Replaced elements next to each other go in one splice
+            if (runLength > 0 && runStart + runLength == i)
+            {
+                ++runLength;
+                continue;
+            }
+
+            if (runLength > 0)
+                splice(runStart, runLength, runLength);
+
+            runStart = i;
+            runLength = 1;
+        }
+
+        if (runLength > 0)
+            splice(runStart, runLength, runLength);
+
+        if (oldSize != newSize)
+            splice(paired, oldSize - suffix - paired, newSize - suffix - paired);
+
+        if (count == 0)
+        {
+            truncate(out, start);
+            return false;
+        }
+
+        putCount(out, start + 1, count);
+        return true;
+    }
+
+
+    bool NbtPatch::diffPacked(const TagList &a, const TagList &b, NbtWriter &out)
+    {
+        // Elements are compared and sent as encoded, past the child type
+        // and length
+        auto elements = [](const TagList &list, NbtWriter &scratch)
+        {
+            const ByteArray *cached = list._body->cache.get();
+            if (cached != NULL)
+                return cached->data() + 5;
+
+            list.writePayload(scratch);
+            return scratch.data() + 5;
+        };
+
+        NbtWriter oldScratch;
+        NbtWriter newScratch;
+        const uint8_t *oldData = elements(a, oldScratch);
+        const uint8_t *newData = elements(b, newScratch);
+
+        size_t width = Tag::getPayloadSize(a._childType);
+        size_t oldSize = a.size();
+        size_t newSize = b.size();
+        size_t common = std::min(oldSize, newSize);
+
+        size_t start = out.size();
+        out.writeByte(OP_LIST);
+        out.writeInt(0);
+
+        uint32_t count = 0;
+
+        auto splice = [&](size_t at, size_t removed, size_t inserted)
+        {
+            out.writeByte(LIST_SPLICE);
+            out.writeInt(at);
+            out.writeInt(removed);
+            out.writeInt(inserted);
+            out.writeBytes(newData + at * width, inserted * width);
+            ++count;
+        };
+
+        if (oldSize == newSize)
+        {
+            size_t i = firstDiff(oldData, newData, 0, common, width);
+            while (i < common)
+            {
+                size_t end = runEnd(oldData, newData, i, common, width, SPLICE_HEADER);
+                splice(i, end - i, end - i);
+                i = firstDiff(oldData, newData, end, common, width);
+            }
+        }
+        else
+        {
+            size_t prefix = firstDiff(oldData, newData, 0, common, width);
+            size_t suffix = 0;
+            while (suffix < common - prefix
+                   && memcmp(oldData + (oldSize - 1 - suffix) * width,
+                             newData + (newSize - 1 - suffix) * width, width) == 0)
+                ++suffix;
+
+            splice(prefix, oldSize - suffix - prefix, newSize - suffix - prefix);
+        }
+
+        if (count == 0)
+        {
+            truncate(out, start);
+            return false;
+        }
+
+        putCount(out, start + 1, count);
+        return true;
+    }
+
+
+    bool NbtPatch::diffArray(const Tag &a, const Tag &b, NbtWriter &out)
+    {
+        ArrayData oldArray = arrayData(a);
+        ArrayData newArray = arrayData(b);
+        size_t width = oldArray.width;
+        size_t common = std::min(oldArray.size, newArray.size);
+
+        size_t start = out.size();
+        out.writeByte(OP_ARRAY);
+        out.writeInt(newArray.size);
+        out.writeInt(0);
+
+        uint32_t count = 0;
+
+        size_t i = firstDiff(oldArray.data, newArray.data, 0, common, width);
+        while (i < common)
+        {
+            size_t end = runEnd(oldArray.data, newArray.data, i, common, width, RANGE_HEADER);
+
+            out.writeInt(i);
+            out.writeInt(end - i);
+            writeValues(out, newArray, i, end - i);
+            ++count;
+
+            i = firstDiff(oldArray.data, newArray.data, end, common, width);
+        }
+
+        if (newArray.size > common)
+        {
+            out.writeInt(common);
+            out.writeInt(newArray.size - common);
+            writeValues(out, newArray, common, newArray.size - common);
+            ++count;
+        }
+
+        if (count == 0 && oldArray.size == newArray.size)
+        {
+            truncate(out, start);
+            return false;
+        }
+
+        putCount(out, start + 5, count);
+        return true;
+    }
+
+
+    bool NbtPatch::applyTag(Tag *tag, uint8_t op, MemorySource &source)
+    {
+        switch (op)
+        {
+            case OP_COMPOUND:
+                return tag->getType() == TAG_COMPOUND
+                    && applyCompound(static_cast<TagCompound *>(tag), source);
+
+            case OP_LIST:
+                return tag->getType() == TAG_LIST
+                    && applyList(static_cast<TagList *>(tag), source);
+
+            case OP_ARRAY:
+                return applyArray(tag, source);
+
+            default:
+                return false;
+        }
+    }
+
+
+    bool NbtPatch::applyCompound(TagCompound *tag, MemorySource &source)
+    {
+        // New entries belong wherever the compound lives
+        NbtArena::Scope scope(tag->_arena);
+        NbtDecoder<MemorySource> decoder(source);
+
+        uint32_t count = readInt(source);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint8_t op = readByte(source);
+            StringView key = readString(source);
+            if (source.failed())
+                return false;
+
+            switch (op)
+            {
+                case ENTRY_SET:
+                {
+                    Tag *value = decoder.readPayload(readByte(source));
+                    if (value == NULL)
+                        return false;
+
+                    if (decoder.failed())
+                    {
+                        Tag::destroy(value);
+                        return false;
+                    }
+
+                    value->setName(key);
+                    tag->insert(value);
+                    break;
+                }
+
+                case ENTRY_REMOVE:
+                    if (!tag->hasKey(key))
+                        return false;
+
+                    tag->remove(key);
+                    break;
+
+                case ENTRY_EDIT:
+                {
+                    Tag *child = tag->edit(key);
+                    if (child == NULL || !applyTag(child, readByte(source), source))
+                        return false;
+
+                    break;
+                }
+
+                default:
+                    return false;
+            }
+        }
+
+        return !source.failed();
+    }
+
+
+    bool NbtPatch::applyList(TagList *tag, MemorySource &source)
+    {
+        NbtArena::Scope scope(tag->_arena);
+        NbtDecoder<MemorySource> decoder(source);
+
+        uint32_t count = readInt(source);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint8_t op = readByte(source);
+
+            if (op == LIST_SPLICE)
+            {
+                uint32_t at = readInt(source);
+                uint32_t removed = readInt(source);
+                uint32_t inserted = readInt(source);
+
+                // Every element takes at least a byte
+                if (source.failed() || at > tag->size() || removed > tag->size() - at
+                    || !source.canRead(inserted))
+                    return false;
+
+                std::vector<Tag *> values;
+                values.reserve(inserted);
+
+                for (uint32_t j = 0; j < inserted; ++j)
+                {
+                    Tag *value = decoder.readPayload(tag->_childType);
+                    if (value != NULL && decoder.failed())
+                    {
+                        Tag::destroy(value);
+                        value = NULL;
+                    }
+
+                    if (value == NULL)
+                    {
+                        for (size_t k = 0; k < values.size(); ++k)
+                            Tag::destroy(values[k]);
+                        return false;
+                    }
+
+                    values.push_back(value);
+                }
+
+                tag->splice(at, removed, values);
+            }
+            else if (op == LIST_EDIT)
+            {
+                uint32_t index = readInt(source);
+                if (source.failed() || index >= tag->size())
+                    return false;
+
+                if (!applyTag(tag->edit(index), readByte(source), source))
+                    return false;
+            }
+            else
+            {
+                return false;
+            }
+
+            if (source.failed())
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool NbtPatch::applyArray(Tag *tag, MemorySource &source)
+    {
+        uint32_t size = readInt(source);
+        if (source.failed())
+            return false;
+
+        // Fresh values in the arena of the array, which setValues() expects
+        NbtArena::Scope scope(tag->_arena);
+
+        switch (tag->getType())
+        {
+            case TAG_BYTE_ARRAY:
+            {
+                TagByteArray *array = static_cast<TagByteArray *>(tag);
+                uint8_t *values = patchValues(array->getValues(), array->getSize(), size, source);
+                if (values == NULL)
+                    return false;
+
+                array->setValues(values, size);
+                return true;
+            }
+
+            case TAG_INT_ARRAY:
+            {
+                TagIntArray *array = static_cast<TagIntArray *>(tag);
+                int32_t *values = patchValues<int32_t>(array->getValues(), array->getSize(), size, source);
+                if (values == NULL)
+                    return false;
+
+                array->setValues(values, size);
+                return true;
+            }
+
+            case TAG_LONG_ARRAY:
+            {
+                TagLongArray *array = static_cast<TagLongArray *>(tag);
+                int64_t *values = patchValues(array->getValues(), array->getSize(), size, source);
+                if (values == NULL)
+                    return false;
+
+                array->setValues(values, size);
+                return true;
+            }
+
+            default:
+                return false;
+        }
+    }
+}
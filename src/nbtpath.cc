@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+#include <cstdlib>
+
+namespace nbt
+{
+    const size_t NbtPathSet::ROOT;
+    const size_t NbtPathSet::NONE;
+
+
+    NbtPathSet::NbtPathSet()
+        : _nodes(1)
+    {
+    }
+
+
+    NbtPathSet::NbtPathSet(std::initializer_list<StringView> paths)
+        : _nodes(1)
+    {
+        std::initializer_list<StringView>::const_iterator i;
+        for (i = paths.begin(); i != paths.end(); ++i)
+            add(*i);
+    }
+
+
+    void NbtPathSet::add(const StringView &path)
+    {
+        insert(ROOT, parse(path), 0);
+    }
+
+
+    bool NbtPathSet::empty() const
+    {
+        const Node &root = _nodes[ROOT];
+        return !root.selected && root.fields.empty();
+    }
+
+
+    size_t NbtPathSet::field(size_t node, const StringView &name) const
+    {
+        const Node &n = _nodes[node];
+        for (size_t i = 0; i < n.fields.size(); ++i)
+        {
+            if (StringView(n.fields[i].first) == name)
+                return n.fields[i].second;
+        }
+
+        return NONE;
+    }
+
+
+    size_t NbtPathSet::element(size_t node, int32_t index) const
+    {
+        const Node &n = _nodes[node];
+        for (size_t i = 0; i < n.elements.size(); ++i)
+        {
+            if (n.elements[i].first == index)
+                return n.elements[i].second;
+        }
+
+        return n.anyElement;
+    }
+
+
+    bool NbtPathSet::isSelected(size_t node) const
+    {
+        return _nodes[node].selected;
+    }
+
+
+    std::vector<NbtPathSet::Step> NbtPathSet::parse(const StringView &path)
+    {
+        std::vector<Step> ret;
+        const char *pos = path.data();
+        const char *end = pos + path.size();
+
+        while (pos != end)
+        {
+            // A name, then any number of [n] or [*]
+            const char *nameEnd = pos;
+            while (nameEnd != end && *nameEnd != '.' && *nameEnd != '[')
+                ++nameEnd;
+
+            if (nameEnd == pos)
+                throw InvalidPathException(path.str());
+
+            Step step;
+            step.name.assign(pos, nameEnd);
+            step.index = 0;
+            step.isIndex = false;
+            ret.push_back(step);
+
+            pos = nameEnd;
+            while (pos != end && *pos == '[')
+            {
+                const char *close = static_cast<const char *>(memchr(pos, ']', end - pos));
+                if (close == NULL || close == pos + 1)
+                    throw InvalidPathException(path.str());
+
+                std::string index(pos + 1, close);
+
+                step.name.clear();
+                step.isIndex = true;
+                if (index == "*")
+                {
+                    step.index = -1;
+                }
+                else
+                {
+                    char *last;
+                    long value = strtol(index.c_str(), &last, 10);
+                    if (*last != '\0' || value < 0 || value > INT32_MAX)
+                        throw InvalidPathException(path.str());
+
+                    step.index = static_cast<int32_t>(value);
+                }
+                ret.push_back(step);
+
+                pos = close + 1;
+            }
+
+            if (pos != end)
+            {
+                // Only a separator can follow, and something must follow it
+                if (*pos != '.' || pos + 1 == end)
+                    throw InvalidPathException(path.str());
+                ++pos;
+            }
+        }
+
+        if (ret.empty())
+            throw InvalidPathException(path.str());
+
+        return ret;
+    }
+
+
+    void NbtPathSet::insert(size_t node, const std::vector<Step> &steps, size_t i)
+    {
+        // Nodes are referred to by index, _nodes may grow along the way
+        if (_nodes[node].selected)
+            return;
+
+        if (i == steps.size())
+        {
+            Node &n = _nodes[node];
+            n.selected = true;
+            n.fields.clear();
+            n.elements.clear();
+            n.anyElement = NONE;
+            return;
+        }
+
+        const Step &step = steps[i];
+        if (!step.isIndex)
+        {
+            size_t child = field(node, step.name);
+            if (child == NONE)
+            {
+                child = _nodes.size();
+                _nodes.push_back(Node());
+                _nodes[node].fields.push_back(std::make_pair(step.name, child));
+            }
+
+            insert(child, steps, i + 1);
+        }
+        else if (step.index < 0)
+        {
+            // [*] reaches every element, including those picked by index
+            if (_nodes[node].anyElement == NONE)
+            {
+                size_t child = _nodes.size();
+                _nodes.push_back(Node());
+                _nodes[node].anyElement = child;
+            }
+
+            insert(_nodes[node].anyElement, steps, i + 1);
+
+            for (size_t e = 0; e < _nodes[node].elements.size(); ++e)
+                insert(_nodes[node].elements[e].second, steps, i + 1);
+        }
+        else
+        {
+            size_t child = NONE;
+            for (size_t e = 0; e < _nodes[node].elements.size(); ++e)
+            {
+                if (_nodes[node].elements[e].first == step.index)
+                    child = _nodes[node].elements[e].second;
+            }
+
+            if (child == NONE)
+            {
+                // A new index starts out with whatever [*] already selects
+                if (_nodes[node].anyElement != NONE)
+                {
+                    child = copyNode(_nodes[node].anyElement);
+                }
+                else
+                {
+                    child = _nodes.size();
+                    _nodes.push_back(Node());
+                }
+                _nodes[node].elements.push_back(std::make_pair(step.index, child));
+            }
+
+            insert(child, steps, i + 1);
+        }
+    }
+
+
+    size_t NbtPathSet::copyNode(size_t node)
+    {
+        size_t ret = _nodes.size();
+        _nodes.push_back(_nodes[node]);
+
+        for (size_t i = 0; i < _nodes[ret].fields.size(); ++i)
+        {
+            size_t child = copyNode(_nodes[ret].fields[i].second);
+            _nodes[ret].fields[i].second = child;
+        }
+
+        for (size_t i = 0; i < _nodes[ret].elements.size(); ++i)
+        {
+            size_t child = copyNode(_nodes[ret].elements[i].second);
+            _nodes[ret].elements[i].second = child;
+        }
+
+        if (_nodes[ret].anyElement != NONE)
+        {
+            size_t child = copyNode(_nodes[ret].anyElement);
+            _nodes[ret].anyElement = child;
+        }
+
+        return ret;
+    }
+}
@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    namespace
+    {
+        const size_t INFLATE_CHUNK = 65536;
+
+        inline uint16_t load16(const uint8_t *pos)
+        {
+            uint16_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be16toh(val);
+        }
+
+        inline uint32_t load32(const uint8_t *pos)
+        {
+            uint32_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be32toh(val);
+        }
+
+        inline uint64_t load64(const uint8_t *pos)
+        {
+            uint64_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be64toh(val);
+        }
+    }
+
+
+    NbtPushParser::NbtPushParser(bool compressed)
+        : _status(NEED_MORE), _root(NULL), _ownsRoot(false), _arena(NULL),
+          _maxLength(64 * 1024 * 1024), _pos(0), _unconsumed(0),
+          _current(NULL), _currentType(TAG_END),
+          _bulk(NULL), _bulkStart(NULL), _bulkRemaining(0), _bulkCount(0),
+          _bulkElemSize(0), _compressed(compressed), _streamEnd(false), _treeEnd(false)
+    {
+        if (_compressed)
+        {
+            memset(&_stream, 0, sizeof(_stream));
+            // Window bits + 32 accepts both gzip and zlib headers
+            if (inflateInit2(&_stream, 15 + 32) != Z_OK)
+                _status = FAILED;
+        }
+    }
+
+
+    NbtPushParser::~NbtPushParser()
+    {
+        if (_ownsRoot)
+            delete _root;
+
+        if (_compressed)
+            inflateEnd(&_stream);
+    }
+
+
+    NbtPushParser::Status NbtPushParser::feed(const uint8_t *data, size_t length)
+    {
+        _unconsumed = length;
+        if (_status != NEED_MORE)
+            return _status;
+
+        NbtArena::Scope scope(_arena);
+
+        if (!_compressed)
+        {
+            _buffer.erase(_buffer.begin(), _buffer.begin() + _pos);
+            _pos = 0;
+            _buffer.insert(_buffer.end(), data, data + length);
+
+            if (parse() == COMPLETE)
+                _unconsumed = available();
+            else
+                _unconsumed = 0;
+
+            return _status;
+        }
+
+        _stream.next_in = const_cast<uint8_t *>(data);
+        _stream.avail_in = length;
+
+        // Inflate a chunk at a time, so a burst of input does not have
+        // to be held all at once before it is parsed. The rest of the
+        // stream after the tree is still read, for the checksum at its end
+        // and so that getUnconsumed() does not depend on the fragments.
+        while (_status == NEED_MORE && !_streamEnd)
+        {
+            // Bytes inflated past the end of the tree are dropped
+            if (_treeEnd)
+                _pos = _buffer.size();
+
+            _buffer.erase(_buffer.begin(), _buffer.begin() + _pos);
+            _pos = 0;
+
+            size_t used = _buffer.size();
+            _buffer.resize(used + INFLATE_CHUNK);
+            _stream.next_out = _buffer.data() + used;
+            _stream.avail_out = INFLATE_CHUNK;
+
+            int result = inflate(&_stream, Z_NO_FLUSH);
+            _buffer.resize(_buffer.size() - _stream.avail_out);
+
+            if (result == Z_STREAM_END)
+                _streamEnd = true;
+            else if (result != Z_OK && result != Z_BUF_ERROR)
+                fail();
+
+            if (!_treeEnd && parse() == COMPLETE)
+            {
+                _treeEnd = true;
+                _status = NEED_MORE;
+            }
+
+            // Out of input, wait for the next fragment
+            if (_stream.avail_out != 0 && _stream.avail_in == 0)
+                break;
+        }
+
+        // Nothing more will come after the end of the stream
+        if (_status == NEED_MORE && _streamEnd)
+        {
+            if (_treeEnd)
+                _status = COMPLETE;
+            else
+                fail();
+        }
+
+        _unconsumed = _stream.avail_in;
+        return _status;
+    }
+
+
+    NbtPushParser::Status NbtPushParser::getStatus() const
+    {
+        return _status;
+    }
+
+
+    size_t NbtPushParser::getUnconsumed() const
+    {
+        return _unconsumed;
+    }
+
+
+    void NbtPushParser::reset()
+    {
+        if (_ownsRoot)
+            delete _root;
+        _root = NULL;
+        _ownsRoot = false;
+
+        _status = NEED_MORE;
+        _buffer.clear();
+        _pos = 0;
+        _unconsumed = 0;
+        _stack.clear();
+        _current = NULL;
+        _bulkRemaining = 0;
+
+        if (_compressed)
+        {
+            _streamEnd = false;
+            _treeEnd = false;
+            if (inflateReset(&_stream) != Z_OK)
+                _status = FAILED;
+        }
+    }
+
+
+    Tag *NbtPushParser::getRoot() const
+    {
+        return _root;
+    }
+
+
+    Tag *NbtPushParser::release()
+    {
+        Tag *ret = _root;
+        _root = NULL;
+        reset();
+
+        return ret;
+    }
+
+
+    void NbtPushParser::setArena(NbtArena *arena)
+    {
+        _arena = arena;
+    }
+
+
+    NbtArena *NbtPushParser::getArena() const
+    {
+        return _arena;
+    }
+
+
+    void NbtPushParser::setMaxLength(size_t bytes)
+    {
+        _maxLength = bytes;
+    }
+
+
+    NbtPushParser::Status NbtPushParser::parse()
+    {
+        while (_status == NEED_MORE)
+        {
+            if (_bulkRemaining > 0)
+            {
+                size_t count = std::min(available(), _bulkRemaining);
+                memcpy(_bulk, current(), count);
+                _bulk += count;
+                _pos += count;
+                _bulkRemaining -= count;
+
+                if (_bulkRemaining > 0)
+                    break;
+
+                finishBulk();
+                continue;
+            }
+
+            if (_current != NULL)
+            {
+                if (!readPayload())
+                    break;
+                continue;
+            }
+
+            if (_stack.empty())
+            {
+                if (_root != NULL)
+                {
+                    _status = COMPLETE;
+                    break;
+                }
+
+                if (!readHeader())
+                    break;
+                continue;
+            }
+
+            Frame &top = _stack.back();
+            if (top.tag->getType() == TAG_COMPOUND)
+            {
+                if (!readHeader())
+                    break;
+                continue;
+            }
+
+            if (top.remaining == 0)
+            {
+                _stack.pop_back();
+                continue;
+            }
+
+            top.remaining--;
+
+            TagList *list = static_cast<TagList *>(top.tag);
+            Tag *child = Tag::create(list->getChildType());
+            if (child == NULL)
+            {
+                fail();
+                break;
+            }
+
+            list->append(child);
+            beginTag(list->getChildType(), child);
+        }
+
+        return _status;
+    }
+
+
+    bool NbtPushParser::readHeader()
+    {
+        // Type, name length and name arrive as one piece
+        if (available() < 1)
+            return false;
+
+        uint8_t type = current()[0];
+        if (type == TAG_END)
+        {
+            if (_stack.empty())
+            {
+                fail();
+                return false;
+            }
+
+            _pos += 1;
+            _stack.pop_back();
+            return true;
+        }
+
+        if (available() < 3)
+            return false;
+
+        uint16_t nameLen = load16(current() + 1);
+        if (available() < 3u + nameLen)
+            return false;
+
+        Tag *tag = Tag::create(type);
+        if (tag == NULL)
+        {
+            fail();
+            return false;
+        }
+
+        tag->setName(StringView(reinterpret_cast<const char *>(current() + 3), nameLen));
+        _pos += 3 + nameLen;
+
+        if (_stack.empty())
+        {
+            _root = tag;
+            _ownsRoot = (_arena == NULL);
+        }
+        else
+        {
+            static_cast<TagCompound *>(_stack.back().tag)->insert(tag);
+        }
+
+        beginTag(type, tag);
+        return true;
+    }
+
+
+    void NbtPushParser::beginTag(uint8_t type, Tag *tag)
+    {
+        _current = tag;
+        _currentType = type;
+    }
+
+
+    bool NbtPushParser::readPayload()
+    {
+        // Fixed-size parts of a payload are taken whole or not at all
+        const uint8_t *pos = current();
+        size_t avail = available();
+        size_t size = Tag::getPayloadSize(_currentType);
+
+        if (avail < size)
+            return false;
+
+        switch (_currentType)
+        {
+            case TAG_BYTE:
+                static_cast<TagByte *>(_current)->setValue(static_cast<int8_t>(*pos));
+                break;
+
+            case TAG_SHORT:
+                static_cast<TagShort *>(_current)->setValue(load16(pos));
+                break;
+
+            case TAG_INT:
+                static_cast<TagInt *>(_current)->setValue(load32(pos));
+                break;
+
+            case TAG_LONG:
+                static_cast<TagLong *>(_current)->setValue(load64(pos));
+                break;
+
+            case TAG_FLOAT:
+            {
+                uint32_t bits = load32(pos);
+                float val;
+                memcpy(&val, &bits, sizeof(val));
+
+                static_cast<TagFloat *>(_current)->setValue(val);
+                break;
+            }
+
+            case TAG_DOUBLE:
+            {
+                uint64_t bits = load64(pos);
+                double val;
+                memcpy(&val, &bits, sizeof(val));
+
+                static_cast<TagDouble *>(_current)->setValue(val);
+                break;
+            }
+
+            case TAG_STRING:
+            {
+                if (avail < 2)
+                    return false;
+
+                uint16_t len = load16(pos);
+                if (avail < 2u + len)
+                    return false;
+
+                static_cast<TagString *>(_current)->setValue(
+                    StringView(reinterpret_cast<const char *>(pos + 2), len));
+                size = 2 + len;
+                break;
+            }
+
+            case TAG_BYTE_ARRAY:
+            case TAG_INT_ARRAY:
+            case TAG_LONG_ARRAY:
+            {
+                if (avail < 4)
+                    return false;
+
+                int32_t len = load32(pos);
+                size_t elemSize = _currentType == TAG_BYTE_ARRAY ? 1
+                                : _currentType == TAG_INT_ARRAY  ? 4 : 8;
+                if (!checkLength(len, elemSize))
+                    return false;
+
+                _pos += 4;
+
+                void *values;
+                if (_currentType == TAG_BYTE_ARRAY)
+                {
+                    unsigned char *bytes = NbtArena::newArray<unsigned char>(len);
+                    static_cast<TagByteArray *>(_current)->setValues(bytes, len);
+                    values = bytes;
+                }
+                else if (_currentType == TAG_INT_ARRAY)
+                {
+                    int *ints = NbtArena::newArray<int>(len);
+                    static_cast<TagIntArray *>(_current)->setValues(ints, len);
+                    values = ints;
+                }
+                else
+                {
+                    int64_t *longs = NbtArena::newArray<int64_t>(len);
+                    static_cast<TagLongArray *>(_current)->setValues(longs, len);
+                    values = longs;
+                }
+
+                _current = NULL;
+                beginBulk(values, len, elemSize);
+                return true;
+            }
+
+            case TAG_LIST:
+            {
+                if (avail < 5)
+                    return false;
+
+                uint8_t childType = pos[0];
+                int32_t len = load32(pos + 1);
+                size_t childSize = Tag::getPayloadSize(childType);
+                if (!checkLength(len, childSize != 0 ? childSize : 1))
+                    return false;
+
+                if (len > 0 && (childType == TAG_END || childType > TAG_LONG_ARRAY))
+                {
+                    fail();
+                    return false;
+                }
+
+                _pos += 5;
+
+                TagList *list = static_cast<TagList *>(_current);
+                list->setChildType(childType);
+                _current = NULL;
+
+                if (list->isPacked())
+                {
+                    list->_body->packedValues.resize(len * childSize);
+                    beginBulk(list->_body->packedValues.data(), len, childSize);
+                }
+                else
+                {
+                    Frame frame = { list, len };
+                    _stack.push_back(frame);
+                }
+                return true;
+            }
+
+            case TAG_COMPOUND:
+            {
+                Frame frame = { _current, 0 };
+                _stack.push_back(frame);
+                break;
+            }
+        }
+
+        _pos += size;
+        _current = NULL;
+        return true;
+    }
+
+
+    bool NbtPushParser::checkLength(int32_t length, size_t elemSize)
+    {
+        if (length < 0 || static_cast<size_t>(length) > _maxLength / elemSize)
+        {
+            fail();
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void NbtPushParser::beginBulk(void *dst, size_t count, size_t elemSize)
+    {
+        _bulk = static_cast<uint8_t *>(dst);
+        _bulkStart = dst;
+        _bulkRemaining = count * elemSize;
+        _bulkCount = count;
+        _bulkElemSize = elemSize;
+
+        if (_bulkRemaining == 0)
+            finishBulk();
+    }
+
+
+    void NbtPushParser::finishBulk()
+    {
+        switch (_bulkElemSize)
+        {
+            case 2: convertBigEndian16(_bulkStart, _bulkStart, _bulkCount); break;
+            case 4: convertBigEndian32(_bulkStart, _bulkStart, _bulkCount); break;
+            case 8: convertBigEndian64(_bulkStart, _bulkStart, _bulkCount); break;
+        }
+
+        _bulkCount = 0;
+    }
+
+
+    void NbtPushParser::fail()
+    {
+        _status = FAILED;
+
+        if (_ownsRoot)
+            delete _root;
+        _root = NULL;
+        _ownsRoot = false;
+
+        _stack.clear();
+        _current = NULL;
+        _bulkRemaining = 0;
+    }
+}
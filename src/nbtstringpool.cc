@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace nbt
+{
+    namespace
+    {
+        typedef InternedString::Entry Entry;
+
+        // Strings are spread over shards by hash so that threads decoding
+        // in parallel rarely wait on the same lock
+        const size_t SHARD_COUNT = 16;
+        const size_t CACHE_SIZE = 256;
+
+        struct Shard
+        {
+            Shard() : arena(16384), count(0) {}
+
+            std::mutex mutex;
+            NbtArena arena;
+
+            // Open-addressing set, at most half full
+            std::vector<const Entry *> slots;
+            size_t count;
+        };
+
+        Shard *shards()
+        {
+            // Never destroyed, interned names may outlive static tags
+            static Shard *ret = new Shard[SHARD_COUNT];
+            return ret;
+        }
+
+        std::atomic<uint32_t> nextId(1);
+        std::atomic<size_t> limit(16 * 1024 * 1024);
+
+        // A string the pool had no room for. Arena copies go with their
+        // arena, the others with their last handle.
+        struct Unpooled
+        {
+            std::atomic<size_t> refs;
+            NbtArena *arena;
+            Entry entry;
+        };
+
+        Unpooled *unpooled(const Entry *entry)
+        {
+            const char *pos = reinterpret_cast<const char *>(entry);
+            return reinterpret_cast<Unpooled *>(const_cast<char *>(pos - offsetof(Unpooled, entry)));
+        }
+
+        const Entry *copy(const StringView &str, uint32_t hash)
+        {
+            NbtArena *arena = NbtArena::current();
+            size_t size = offsetof(Unpooled, entry) + offsetof(Entry, data) + str.size() + 1;
+            void *mem = arena ? arena->allocate(size, alignof(Unpooled)) : ::operator new(size);
+
+            Unpooled *ret = static_cast<Unpooled *>(mem);
+            new (&ret->refs) std::atomic<size_t>(1);
+            ret->arena = arena;
+            ret->entry.hash = hash;
+            ret->entry.length = str.size();
+            ret->entry.id = 0;
+            memcpy(ret->entry.data, str.data(), str.size());
+            ret->entry.data[str.size()] = '\0';
+
+            return &ret->entry;
+        }
+
+        // Recently interned strings per thread, looked up without locking
+        thread_local const Entry *cache[CACHE_SIZE];
+
+        bool matches(const Entry *entry, const StringView &str, uint32_t hash)
+        {
+            return entry->hash == hash && entry->length == str.size()
+                && memcmp(entry->data, str.data(), str.size()) == 0;
+        }
+
+        void place(std::vector<const Entry *> &slots, const Entry *entry)
+        {
+            size_t mask = slots.size() - 1;
+            size_t slot = (entry->hash >> 4) & mask;
+
+            while (slots[slot] != NULL)
+                slot = (slot + 1) & mask;
+
+            slots[slot] = entry;
+        }
+
+        const Entry *findOrAdd(Shard &shard, const StringView &str, uint32_t hash)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            if (!shard.slots.empty())
+            {
+                size_t mask = shard.slots.size() - 1;
+                for (size_t slot = (hash >> 4) & mask; shard.slots[slot] != NULL;
+                     slot = (slot + 1) & mask)
+                {
+                    if (matches(shard.slots[slot], str, hash))
+                        return shard.slots[slot];
+                }
+            }
+
+            // Full up; the caller makes a private copy instead
+            if (shard.arena.getBytesAllocated() >= limit.load(std::memory_order_relaxed) / SHARD_COUNT)
+                return NULL;
+
+            void *mem = shard.arena.allocate(offsetof(Entry, data) + str.size() + 1,
+                                             alignof(Entry));
+            Entry *entry = static_cast<Entry *>(mem);
+            entry->hash = hash;
+            entry->length = str.size();
+            entry->id = nextId++;
+            memcpy(entry->data, str.data(), str.size());
+            entry->data[str.size()] = '\0';
+
+            if ((shard.count + 1) * 2 > shard.slots.size())
+            {
+                std::vector<const Entry *> slots(shard.slots.empty() ? 64 : shard.slots.size() * 2);
+                for (size_t i = 0; i < shard.slots.size(); ++i)
+                {
+                    if (shard.slots[i] != NULL)
+                        place(slots, shard.slots[i]);
+                }
+                shard.slots.swap(slots);
+            }
+
+            place(shard.slots, entry);
+            shard.count++;
+
+            return entry;
+        }
+
+        const Entry emptyEntry = { 2166136261u, 0, 0, { '\0' } };
+    }
+
+
+    InternedString::InternedString()
+        : _entry(&emptyEntry)
+    {
+    }
+
+
+    void InternedString::acquire()
+    {
+        Unpooled *copied = unpooled(_entry);
+        if (copied->arena == NULL)
+        {
+            copied->refs.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // Copies leaving the arena need their own string
+        if (copied->arena != NbtArena::current())
+            _entry = copy(StringView(_entry->data, _entry->length), _entry->hash);
+    }
+
+
+    void InternedString::release()
+    {
+        Unpooled *copied = unpooled(_entry);
+        if (copied->arena != NULL
+            || copied->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        copied->refs.~atomic();
+        ::operator delete(copied);
+    }
+
+
+    InternedString NbtStringPool::intern(const StringView &str)
+    {
+        if (str.empty())
+            return InternedString();
+
+        uint32_t hash = NbtStringPool::hash(str);
+
+        const Entry *&cached = cache[hash & (CACHE_SIZE - 1)];
+        if (cached == NULL || !matches(cached, str, hash))
+        {
+            const Entry *entry = findOrAdd(shards()[hash % SHARD_COUNT], str, hash);
+            if (entry == NULL)
+                return InternedString(copy(str, hash));
+
+            cached = entry;
+        }
+
+        return InternedString(cached);
+    }
+
+
+    void NbtStringPool::setLimit(size_t bytes)
+    {
+        limit.store(bytes, std::memory_order_relaxed);
+    }
+
+
+    size_t NbtStringPool::getLimit()
+    {
+        return limit.load(std::memory_order_relaxed);
+    }
+
+
+    size_t NbtStringPool::getCount()
+    {
+        size_t ret = 0;
+        for (size_t i = 0; i < SHARD_COUNT; ++i)
+        {
+            std::lock_guard<std::mutex> lock(shards()[i].mutex);
+            ret += shards()[i].count;
+        }
+        return ret;
+    }
+
+
+    size_t NbtStringPool::getBytesAllocated()
+    {
+        size_t ret = 0;
+        for (size_t i = 0; i < SHARD_COUNT; ++i)
+        {
+            std::lock_guard<std::mutex> lock(shards()[i].mutex);
+            ret += shards()[i].arena.getBytesAllocated();
+        }
+        return ret;
+    }
+}
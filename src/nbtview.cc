@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2012 Scott Atkins
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    namespace
+    {
+        // Unaligned big-endian loads straight from the buffer
+        inline uint16_t load16(const uint8_t *pos)
+        {
+            uint16_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be16toh(val);
+        }
+
+        inline uint32_t load32(const uint8_t *pos)
+        {
+            uint32_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be32toh(val);
+        }
+
+        inline uint64_t load64(const uint8_t *pos)
+        {
+            uint64_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be64toh(val);
+        }
+
+        inline bool fits(const uint8_t *pos, const uint8_t *end, size_t len)
+        {
+            return pos != NULL && static_cast<size_t>(end - pos) >= len;
+        }
+    }
+
+    NbtView::NbtView()
+        : _type(TAG_END), _name(NULL), _nameLength(0), _payload(NULL), _end(NULL)
+    {
+    }
+
+
+    NbtView::NbtView(const uint8_t *data, size_t size)
+        : _type(TAG_END), _name(NULL), _nameLength(0), _payload(NULL), _end(NULL)
+    {
+        readEntry(data, data + size, *this);
+    }
+
+
+    NbtView::NbtView(uint8_t type, const char *name, uint16_t nameLength,
+                     const uint8_t *payload, const uint8_t *end)
+        : _type(type), _name(name), _nameLength(nameLength),
+          _payload(payload), _end(end)
+    {
+    }
+
+
+    const uint8_t *NbtView::readEntry(const uint8_t *pos, const uint8_t *end,
+                                      NbtView &view)
+    {
+        if (!fits(pos, end, 1) || *pos == TAG_END || *pos > TAG_LONG_ARRAY)
+            return NULL;
+
+        if (!fits(pos, end, 3))
+            return NULL;
+
+        uint16_t nameLength = load16(pos + 1);
+        if (!fits(pos + 3, end, nameLength))
+            return NULL;
+
+        view = NbtView(*pos, reinterpret_cast<const char *>(pos + 3),
+                       nameLength, pos + 3 + nameLength, end);
+
+        return view._payload;
+    }
+
+
+    const uint8_t *NbtView::skipPayload(uint8_t type, const uint8_t *pos,
+                                        const uint8_t *end)
+    {
+        size_t fixed = Tag::getPayloadSize(type);
+        if (fixed != 0)
+            return fits(pos, end, fixed) ? pos + fixed : NULL;
+
+        switch (type)
+        {
+            case TAG_BYTE_ARRAY:
+            case TAG_INT_ARRAY:
+            case TAG_LONG_ARRAY:
+            {
+                if (!fits(pos, end, 4))
+                    return NULL;
+
+                int32_t len = load32(pos);
+                size_t elem = type == TAG_BYTE_ARRAY ? 1
+                            : type == TAG_INT_ARRAY  ? 4 : 8;
+                size_t bytes = static_cast<size_t>(len) * elem;
+                if (len < 0 || !fits(pos + 4, end, bytes))
+                    return NULL;
+
+                return pos + 4 + bytes;
+            }
+
+            case TAG_STRING:
+            {
+                if (!fits(pos, end, 2))
+                    return NULL;
+
+                uint16_t len = load16(pos);
+                return fits(pos + 2, end, len) ? pos + 2 + len : NULL;
+            }
+
+            case TAG_LIST:
+            {
+                if (!fits(pos, end, 5))
+                    return NULL;
+
+                uint8_t childType = pos[0];
+                int32_t len = load32(pos + 1);
+                pos += 5;
+
+                if (len <= 0)
+                    return pos;
+
+                size_t childSize = Tag::getPayloadSize(childType);
+                if (childSize != 0)
+                {
+                    size_t bytes = static_cast<size_t>(len) * childSize;
+                    return fits(pos, end, bytes) ? pos + bytes : NULL;
+                }
+
+                for (int32_t i = 0; i < len && pos != NULL; ++i)
+                    pos = skipPayload(childType, pos, end);
+
+                return pos;
+            }
+
+            case TAG_COMPOUND:
+            {
+                NbtView child;
+                while (fits(pos, end, 1))
+                {
+                    if (*pos == TAG_END)
+                        return pos + 1;
+
+                    if (readEntry(pos, end, child) == NULL)
+                        return NULL;
+
+                    pos = skipPayload(child._type, child._payload, end);
+                }
+                return NULL;
+            }
+
+            default:
+                return NULL;
+        }
+    }
+
+
+    bool NbtView::isValid() const
+    {
+        return _payload != NULL;
+    }
+
+
+    uint8_t NbtView::getType() const
+    {
+        return _type;
+    }
+
+
+    StringView NbtView::getName() const
+    {
+        if (_name == NULL)
+            return StringView();
+
+        return StringView(_name, _nameLength);
+    }
+
+
+    NbtView NbtView::getValueAt(const StringView &key) const
+    {
+        if (_type != TAG_COMPOUND)
+            return NbtView();
+
+        NbtCursor cursor(*this);
+        while (cursor.next())
+        {
+            if (cursor->getName() == key)
+                return *cursor;
+        }
+
+        return NbtView();
+    }
+
+
+    NbtView NbtView::operator[](const StringView &key) const
+    {
+        return getValueAt(key);
+    }
+
+
+    bool NbtView::hasKey(const StringView &key) const
+    {
+        return getValueAt(key).isValid();
+    }
+
+
+    int NbtView::getInt(const StringView &key) const
+    {
+        return getValueAt(key).getInt();
+    }
+
+
+    short NbtView::getShort(const StringView &key) const
+    {
+        return getValueAt(key).getShort();
+    }
+
+
+    char NbtView::getByte(const StringView &key) const
+    {
+        return getValueAt(key).getByte();
+    }
+
+
+    bool NbtView::getBool(const StringView &key) const
+    {
+        return getValueAt(key).getByte() != 0;
+    }
+
+
+    int64_t NbtView::getLong(const StringView &key) const
+    {
+        return getValueAt(key).getLong();
+    }
+
+
+    float NbtView::getFloat(const StringView &key) const
+    {
+        return getValueAt(key).getFloat();
+    }
+
+
+    double NbtView::getDouble(const StringView &key) const
+    {
+        return getValueAt(key).getDouble();
+    }
+
+
+    StringView NbtView::getString(const StringView &key) const
+    {
+        return getValueAt(key).getString();
+    }
+
+
+    size_t NbtView::size() const
+    {
+        switch (_type)
+        {
+            case TAG_BYTE_ARRAY:
+            case TAG_INT_ARRAY:
+            case TAG_LONG_ARRAY:
+            case TAG_STRING:
+                return skipPayload(_type, _payload, _end) != NULL
+                    ? (_type == TAG_STRING ? load16(_payload) : load32(_payload))
+                    : 0;
+
+            case TAG_LIST:
+            {
+                if (!fits(_payload, _end, 5))
+                    return 0;
+
+                int32_t len = load32(_payload + 1);
+                return len > 0 ? len : 0;
+            }
+
+            case TAG_COMPOUND:
+            {
+                size_t ret = 0;
+
+                NbtCursor cursor(*this);
+                while (cursor.next())
+                    ++ret;
+
+                return ret;
+            }
+
+            default:
+                return 0;
+        }
+    }
+
+
+    uint8_t NbtView::getChildType() const
+    {
+        switch (_type)
+        {
+            case TAG_LIST:
+                return fits(_payload, _end, 1) ? _payload[0] : TAG_END;
+
+            case TAG_BYTE_ARRAY:
+                return TAG_BYTE;
+
+            case TAG_INT_ARRAY:
+                return TAG_INT;
+
+            case TAG_LONG_ARRAY:
+                return TAG_LONG;
+
+            default:
+                return TAG_END;
+        }
+    }
+
+
+    NbtView NbtView::at(size_t i) const
+    {
+        if (_type != TAG_LIST || i >= size())
+            return NbtView();
+
+        uint8_t childType = _payload[0];
+        size_t childSize = Tag::getPayloadSize(childType);
+        if (childSize != 0)
+        {
+            const uint8_t *pos = _payload + 5 + i * childSize;
+            if (!fits(pos, _end, childSize))
+                return NbtView();
+
+            return NbtView(childType, NULL, 0, pos, _end);
+        }
+
+        NbtCursor cursor(*this);
+        for (size_t k = 0; k <= i; ++k)
+        {
+            if (!cursor.next())
+                return NbtView();
+        }
+
+        return *cursor;
+    }
+
+
+    NbtView NbtView::operator[](size_t i) const
+    {
+        return at(i);
+    }
+
+
+    NbtCursor NbtView::children() const
+    {
+        return NbtCursor(*this);
+    }
+
+
+    int8_t NbtView::getByte() const
+    {
+        if (_type != TAG_BYTE || !fits(_payload, _end, 1))
+            return 0;
+
+        return static_cast<int8_t>(_payload[0]);
+    }
+
+
+    int16_t NbtView::getShort() const
+    {
+        if (_type != TAG_SHORT || !fits(_payload, _end, 2))
+            return 0;
+
+        return static_cast<int16_t>(load16(_payload));
+    }
+
+
+    int32_t NbtView::getInt() const
+    {
+        if (_type != TAG_INT || !fits(_payload, _end, 4))
+            return 0;
+
+        return static_cast<int32_t>(load32(_payload));
+    }
+
+
+    int64_t NbtView::getLong() const
+    {
+        if (_type != TAG_LONG || !fits(_payload, _end, 8))
+            return 0;
+
+        return static_cast<int64_t>(load64(_payload));
+    }
+
+
+    float NbtView::getFloat() const
+    {
+        if (_type != TAG_FLOAT || !fits(_payload, _end, 4))
+            return 0;
+
+        union
+        {
+            uint32_t i;
+            float f;
+        } val;
+        val.i = load32(_payload);
+
+        return val.f;
+    }
+
+
+    double NbtView::getDouble() const
+    {
+        if (_type != TAG_DOUBLE || !fits(_payload, _end, 8))
+            return 0;
+
+        union
+        {
+            uint64_t l;
+            double d;
+        } val;
+        val.l = load64(_payload);
+
+        return val.d;
+    }
+
+
+    StringView NbtView::getString() const
+    {
+        if (_type != TAG_STRING || skipPayload(_type, _payload, _end) == NULL)
+            return StringView();
+
+        return StringView(reinterpret_cast<const char *>(_payload + 2),
+                          load16(_payload));
+    }
+
+
+    const uint8_t *NbtView::getByteArray() const
+    {
+        if (_type != TAG_BYTE_ARRAY || skipPayload(_type, _payload, _end) == NULL)
+            return NULL;
+
+        return _payload + 4;
+    }
+
+
+    int32_t NbtView::getIntAt(size_t i) const
+    {
+        if (_type != TAG_INT_ARRAY || i >= size())
+            return 0;
+
+        return static_cast<int32_t>(load32(_payload + 4 + i * 4));
+    }
+
+
+    int64_t NbtView::getLongAt(size_t i) const
+    {
+        if (_type != TAG_LONG_ARRAY || i >= size())
+            return 0;
+
+        return static_cast<int64_t>(load64(_payload + 4 + i * 8));
+    }
+
+
+    const uint8_t *NbtView::payload() const
+    {
+        return _payload;
+    }
+
+
+    size_t NbtView::payloadSize() const
+    {
+        const uint8_t *next = skipPayload(_type, _payload, _end);
+        return next != NULL ? next - _payload : 0;
+    }
+
+
+    NbtCursor::NbtCursor()
+        : _parentType(TAG_END), _childType(TAG_END), _remaining(0),
+          _pos(NULL), _end(NULL)
+    {
+    }
+
+
+    NbtCursor::NbtCursor(const NbtView &parent)
+        : _parentType(parent._type), _childType(TAG_END), _remaining(0),
+          _pos(NULL), _end(parent._end)
+    {
+        if (_parentType == TAG_COMPOUND)
+        {
+            _pos = parent._payload;
+        }
+        else if (_parentType == TAG_LIST && fits(parent._payload, _end, 5))
+        {
+            _childType = parent._payload[0];
+            _remaining = load32(parent._payload + 1);
+            _pos = parent._payload + 5;
+        }
+    }
+
+
+    bool NbtCursor::next()
+    {
+        if (_pos == NULL)
+            return false;
+
+        // Step over the payload of the child we are currently on
+        if (_current.isValid())
+        {
+            _pos = NbtView::skipPayload(_current._type, _current._payload, _end);
+            _current = NbtView();
+
+            if (_pos == NULL)
+                return false;
+        }
+
+        if (_parentType == TAG_LIST)
+        {
+            if (_remaining <= 0)
+            {
+                _pos = NULL;
+                return false;
+            }
+
+            --_remaining;
+            _current = NbtView(_childType, NULL, 0, _pos, _end);
+            return true;
+        }
+
+        if (NbtView::readEntry(_pos, _end, _current) == NULL)
+        {
+            // TAG_End, or malformed data
+            _current = NbtView();
+            _pos = NULL;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    const NbtView &NbtCursor::get() const
+    {
+        return _current;
+    }
+
+
+    const NbtView &NbtCursor::operator*() const
+    {
+        return _current;
+    }
+
+
+    const NbtView *NbtCursor::operator->() const
+    {
+        return &_current;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    NbtVisitor::~NbtVisitor()
+    {
+    }
+
+
+    NbtVisitor::Action NbtVisitor::onBeginCompound(const StringView &)
+    {
+        return CONTINUE;
+    }
+
+
+    void NbtVisitor::onEndCompound()
+    {
+    }
+
+
+    NbtVisitor::Action NbtVisitor::onBeginList(const StringView &, uint8_t, int32_t)
+    {
+        return CONTINUE;
+    }
+
+
+    void NbtVisitor::onEndList()
+    {
+    }
+
+
+    void NbtVisitor::onByte(const StringView &, int8_t)
+    {
+    }
+
+
+    void NbtVisitor::onShort(const StringView &, int16_t)
+    {
+    }
+
+
+    void NbtVisitor::onInt(const StringView &, int32_t)
+    {
+    }
+
+
+    void NbtVisitor::onLong(const StringView &, int64_t)
+    {
+    }
+
+
+    void NbtVisitor::onFloat(const StringView &, float)
+    {
+    }
+
+
+    void NbtVisitor::onDouble(const StringView &, double)
+    {
+    }
+
+
+    void NbtVisitor::onString(const StringView &, const StringView &)
+    {
+    }
+
+
+    void NbtVisitor::onByteArray(const StringView &, const ArrayView<uint8_t> &)
+    {
+    }
+
+
+    void NbtVisitor::onIntArray(const StringView &, const ArrayView<int32_t> &)
+    {
+    }
+
+
+    void NbtVisitor::onLongArray(const StringView &, const ArrayView<int64_t> &)
+    {
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+namespace nbt
+{
+    NbtWriter::NbtWriter(size_t reserve)
+        : _depth(0)
+    {
+        _buffer.reserve(reserve);
+    }
+
+
+    void NbtWriter::writeString(const StringView &str)
+    {
+        writeShort(str.size());
+        writeBytes(str.data(), str.size());
+    }
+
+
+    void NbtWriter::writeShorts(const int16_t *values, size_t count)
+    {
+        size_t pos = _buffer.size();
+        _buffer.resize(pos + count * 2);
+        convertBigEndian16(_buffer.data() + pos, values, count);
+    }
+
+
+    void NbtWriter::writeInts(const int32_t *values, size_t count)
+    {
+        size_t pos = _buffer.size();
+        _buffer.resize(pos + count * 4);
+        convertBigEndian32(_buffer.data() + pos, values, count);
+    }
+
+
+    void NbtWriter::writeLongs(const int64_t *values, size_t count)
+    {
+        size_t pos = _buffer.size();
+        _buffer.resize(pos + count * 8);
+        convertBigEndian64(_buffer.data() + pos, values, count);
+    }
+
+
+    void NbtWriter::reserve(size_t size)
+    {
+        _buffer.reserve(size);
+    }
+
+
+    void NbtWriter::clear()
+    {
+        _buffer.clear();
+    }
+
+
+    const uint8_t *NbtWriter::data() const
+    {
+        return _buffer.data();
+    }
+
+
+    size_t NbtWriter::size() const
+    {
+        return _buffer.size();
+    }
+
+
+    const ByteArray &NbtWriter::getBuffer() const
+    {
+        return _buffer;
+    }
+
+
+    ByteArray &NbtWriter::getBuffer()
+    {
+        return _buffer;
+    }
+
+
+    void NbtWriter::storePending(size_t first)
+    {
+        for (size_t i = first; i < _pending.size(); ++i)
+        {
+            const Pending &pending = _pending[i];
+            pending.cache->store(_buffer.data() + pending.start, pending.size, pending.owned);
+        }
+
+        _pending.resize(first);
+    }
+
+
+    NbtWriter::Encoding::Encoding(NbtWriter &writer)
+        : _writer(writer)
+        , _start(writer.size())
+        , _first(writer._pending.size())
+        , _ended(false)
+    {
+        ++_writer._depth;
+    }
+
+
+    NbtWriter::Encoding::~Encoding()
+    {
+        // Left by an exception, the bytes are not all there
+        if (!_ended)
+        {
+            _writer._pending.resize(_first);
+            --_writer._depth;
+        }
+    }
+
+
+    void NbtWriter::Encoding::keep(EncodingCache *cache, bool owned)
+    {
+        _ended = true;
+        --_writer._depth;
+
+        size_t size = _writer.size() - _start;
+        if (size > EncodingCache::getLimit())
+        {
+            // Nothing enclosing this fits either
+            _writer.storePending(_first);
+        }
+        else if (cache != NULL)
+        {
+            // Covers the ones nested in it
+            _writer._pending.resize(_first);
+
+            Pending pending = {cache, _start, size, owned};
+            _writer._pending.push_back(pending);
+        }
+
+        if (_writer._depth == 0)
+            _writer.storePending(0);
+    }
+}
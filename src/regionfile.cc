@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nbt
+{
+    namespace
+    {
+        inline uint32_t load32(const uint8_t *pos)
+        {
+            uint32_t val;
+            memcpy(&val, pos, sizeof(val));
+            return be32toh(val);
+        }
+    }
+
+
+    RegionFile::RegionFile()
+        : _data(NULL), _size(0)
+    {
+
+    }
+
+
+    RegionFile::RegionFile(const std::string &fname)
+        : _data(NULL), _size(0)
+    {
+        open(fname);
+    }
+
+
+    RegionFile::~RegionFile()
+    {
+        close();
+    }
+
+
+    void RegionFile::open(const std::string &fname)
+    {
+        close();
+
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw RegionIOException(errno);
+
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+        {
+            int code = errno;
+            ::close(fd);
+            throw RegionIOException(code);
+        }
+
+        // A freshly created region may be empty and holds no chunks
+        if (st.st_size > 0)
+        {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                int code = errno;
+                ::close(fd);
+                throw RegionIOException(code);
+            }
+
+            _data = static_cast<const uint8_t *>(map);
+            _size = st.st_size;
+        }
+
+        // The mapping keeps the file alive on its own
+        ::close(fd);
+    }
+
+
+    void RegionFile::close()
+    {
+        if (_data != NULL)
+            munmap(const_cast<uint8_t *>(_data), _size);
+
+        _data = NULL;
+        _size = 0;
+    }
+
+
+    bool RegionFile::isOpen() const
+    {
+        return _data != NULL;
+    }
+
+
+    uint32_t RegionFile::getSectorOffset(int x, int z) const
+    {
+        if (_size < HEADER_SIZE)
+            return 0;
+
+        return load32(_data + index(x, z) * 4) >> 8;
+    }
+
+
+    uint8_t RegionFile::getSectorCount(int x, int z) const
+    {
+        if (_size < HEADER_SIZE)
+            return 0;
+
+        return _data[index(x, z) * 4 + 3];
+    }
+
+
+    uint32_t RegionFile::getTimestamp(int x, int z) const
+    {
+        if (_size < HEADER_SIZE)
+            return 0;
+
+        return load32(_data + SECTOR_SIZE + index(x, z) * 4);
+    }
+
+
+    bool RegionFile::hasChunk(int x, int z) const
+    {
+        return !getChunkData(x, z).empty();
+    }
+
+
+    ArrayView<uint8_t> RegionFile::getChunkData(int x, int z) const
+    {
+        uint32_t offset = getSectorOffset(x, z);
+        uint8_t count = getSectorCount(x, z);
+        if (offset < 2 || count == 0)
+            return ArrayView<uint8_t>();
+
+        // Payloads may end early in their last sector but never overrun it
+        size_t start = static_cast<size_t>(offset) * SECTOR_SIZE;
+        if (start + 5 > _size)
+            return ArrayView<uint8_t>();
+
+        size_t length = load32(_data + start);
+        if (length < 1 || length + 4 > static_cast<size_t>(count) * SECTOR_SIZE
+            || start + 4 + length > _size)
+            return ArrayView<uint8_t>();
+
+        // The high bit marks a payload kept in a separate .mcc file
+        if (_data[start + 4] & 0x80)
+            return ArrayView<uint8_t>();
+
+        return ArrayView<uint8_t>(_data + start + 5, length - 1);
+    }
+
+
+    uint8_t RegionFile::getCompression(int x, int z) const
+    {
+        if (getChunkData(x, z).empty())
+            return 0;
+
+        return _data[static_cast<size_t>(getSectorOffset(x, z)) * SECTOR_SIZE + 4];
+    }
+
+
+    bool RegionFile::readChunk(int x, int z, NbtBuffer &buffer) const
+    {
+        ArrayView<uint8_t> data = getChunkData(x, z);
+        if (data.empty())
+            return false;
+
+        // NbtBuffer sniffs gzip, zlib and uncompressed payloads itself
+        return buffer.read(const_cast<uint8_t *>(data.data()), data.size());
+    }
+
+
+    void RegionFile::setAccess(Access access)
+    {
+        if (_data == NULL)
+            return;
+
+        int advice = access == ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL
+                   : access == ACCESS_RANDOM     ? MADV_RANDOM : MADV_NORMAL;
+        madvise(const_cast<uint8_t *>(_data), _size, advice);
+    }
+
+
+    void RegionFile::prefetch(int x, int z) const
+    {
+        ArrayView<uint8_t> data = getChunkData(x, z);
+        if (data.empty())
+            return;
+
+        // madvise wants a page aligned start
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = reinterpret_cast<uintptr_t>(data.data() - 5) & ~(page - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(data.data() + data.size());
+
+        madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+    }
+}
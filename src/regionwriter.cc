@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2011 Lukas Niederbremer
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nbt
+{
+    namespace
+    {
+        const size_t SECTOR_SIZE = RegionFile::SECTOR_SIZE;
+        const size_t HEADER_SECTORS = RegionFile::HEADER_SIZE / RegionFile::SECTOR_SIZE;
+
+        // A location entry has one byte for the sector count and three
+        // for the offset
+        const size_t MAX_SECTORS = 255;
+        const size_t MAX_OFFSET = 1 << 24;
+
+        inline void store32(uint8_t *pos, uint32_t val)
+        {
+            val = htobe32(val);
+            memcpy(pos, &val, sizeof(val));
+        }
+    }
+
+
+    RegionWriter::RegionWriter()
+        : _fd(-1), _sync(false)
+    {
+        memset(_locations, 0, sizeof(_locations));
+    }
+
+
+    RegionWriter::RegionWriter(const std::string &fname)
+        : _fd(-1), _sync(false)
+    {
+        memset(_locations, 0, sizeof(_locations));
+        open(fname);
+    }
+
+
+    RegionWriter::~RegionWriter()
+    {
+        close();
+    }
+
+
+    void RegionWriter::open(const std::string &fname)
+    {
+        close();
+
+        _fd = ::open(fname.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0)
+            throw RegionIOException(errno);
+
+        struct stat st;
+        if (fstat(_fd, &st) < 0)
+        {
+            int code = errno;
+            close();
+            throw RegionIOException(code);
+        }
+
+        // A new or cut short file starts with empty header tables
+        uint8_t header[RegionFile::SECTOR_SIZE];
+        memset(header, 0, sizeof(header));
+        if (static_cast<size_t>(st.st_size) < RegionFile::HEADER_SIZE)
+        {
+            if (ftruncate(_fd, RegionFile::HEADER_SIZE) < 0)
+            {
+                int code = errno;
+                close();
+                throw RegionIOException(code);
+            }
+            st.st_size = RegionFile::HEADER_SIZE;
+        }
+        else if (pread(_fd, header, sizeof(header), 0) != sizeof(header))
+        {
+            int code = errno;
+            close();
+            throw RegionIOException(code);
+        }
+
+        size_t sectors = (st.st_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        _used.assign(sectors, false);
+        mark(0, HEADER_SECTORS, true);
+
+        for (int i = 0; i < RegionFile::CHUNK_COUNT; ++i)
+        {
+            uint32_t location;
+            memcpy(&location, header + i * 4, sizeof(location));
+            location = be32toh(location);
+
+            // Entries pointing outside the file are dropped
+            size_t offset = location >> 8;
+            size_t count = location & 0xff;
+            if (offset < HEADER_SECTORS || count == 0 || offset + count > sectors)
+                location = 0;
+            else
+                mark(offset, count, true);
+
+            _locations[i] = location;
+        }
+    }
+
+
+    void RegionWriter::close()
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+
+        _fd = -1;
+        _used.clear();
+        memset(_locations, 0, sizeof(_locations));
+    }
+
+
+    bool RegionWriter::isOpen() const
+    {
+        return _fd >= 0;
+    }
+
+
+    void RegionWriter::writeChunk(int x, int z, const uint8_t *data, size_t length,
+                                  uint8_t compression, uint32_t timestamp)
+    {
+        if (_fd < 0)
+            throw RegionIOException(EBADF);
+
+        size_t count = (length + 5 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        if (count > MAX_SECTORS)
+            throw RegionIOException(EFBIG);
+
+        ByteArray sectors(count * SECTOR_SIZE, 0);
+        store32(sectors.data(), length + 1);
+        sectors[4] = compression;
+        memcpy(sectors.data() + 5, data, length);
+
+        // The old copy stays allocated until the header has moved on
+        size_t start = allocate(count);
+        place(index(x, z), start, sectors.data(), count,
+              timestamp != 0 ? timestamp : time(NULL));
+    }
+
+
+    void RegionWriter::writeChunk(int x, int z, Tag *root, const NbtCodec &codec)
+    {
+        uint8_t compression;
+        switch (codec.getFormat())
+        {
+            case NbtCodec::GZIP: compression = RegionFile::COMPRESSION_GZIP; break;
+            case NbtCodec::ZLIB: compression = RegionFile::COMPRESSION_ZLIB; break;
+            case NbtCodec::NONE: compression = RegionFile::COMPRESSION_NONE; break;
+            default:
+                throw RegionIOException(EINVAL);
+        }
+
+        unsigned long length;
+        char *data = NbtBuffer().write(root, length, codec);
+        if (data == NULL)
+            throw RegionIOException(EINVAL);
+
+        try
+        {
+            writeChunk(x, z, reinterpret_cast<uint8_t *>(data), length, compression);
+        }
+        catch (...)
+        {
+            delete[] data;
+            throw;
+        }
+
+        delete[] data;
+    }
+
+
+    void RegionWriter::removeChunk(int x, int z)
+    {
+        if (_fd < 0)
+            throw RegionIOException(EBADF);
+
+        int i = index(x, z);
+        uint32_t old = _locations[i];
+        if (old == 0)
+            return;
+
+        uint8_t entry[4] = { 0, 0, 0, 0 };
+        writeAll(entry, sizeof(entry), i * 4);
+        _locations[i] = 0;
+
+        writeAll(entry, sizeof(entry), RegionFile::SECTOR_SIZE + i * 4);
+        if (_sync && fdatasync(_fd) < 0)
+            throw RegionIOException(errno);
+
+        mark(old >> 8, old & 0xff, false);
+    }
+
+
+    size_t RegionWriter::compact()
+    {
+        if (_fd < 0)
+            throw RegionIOException(EBADF);
+
+        // Chunks furthest out move first, each into the best hole before it
+        std::vector<int> order;
+        for (int i = 0; i < RegionFile::CHUNK_COUNT; ++i)
+        {
+            if (_locations[i] != 0)
+                order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b)
+        {
+            return _locations[a] > _locations[b];
+        });
+
+        ByteArray sectors;
+        for (size_t n = 0; n < order.size(); ++n)
+        {
+            int i = order[n];
+            size_t offset = _locations[i] >> 8;
+            size_t count = _locations[i] & 0xff;
+
+            size_t start;
+            if (!findFree(count, offset, start))
+                continue;
+
+            sectors.resize(count * SECTOR_SIZE);
+            ssize_t got = pread(_fd, sectors.data(), sectors.size(), offset * SECTOR_SIZE);
+            if (got < 0)
+                throw RegionIOException(errno);
+            std::fill(sectors.begin() + got, sectors.end(), 0);
+
+            uint32_t timestamp;
+            if (pread(_fd, &timestamp, sizeof(timestamp), RegionFile::SECTOR_SIZE + i * 4) != sizeof(timestamp))
+                throw RegionIOException(errno);
+
+            mark(start, count, true);
+            place(i, start, sectors.data(), count, be32toh(timestamp));
+        }
+
+        size_t end = _used.size();
+        while (end > HEADER_SECTORS && !_used[end - 1])
+            --end;
+
+        size_t freed = _used.size() - end;
+        if (freed > 0)
+        {
+            if (ftruncate(_fd, end * SECTOR_SIZE) < 0)
+                throw RegionIOException(errno);
+            _used.resize(end);
+        }
+
+        return freed;
+    }
+
+
+    void RegionWriter::setSync(bool sync)
+    {
+        _sync = sync;
+    }
+
+
+    bool RegionWriter::getSync() const
+    {
+        return _sync;
+    }
+
+
+    size_t RegionWriter::getSectorCount() const
+    {
+        return _used.size();
+    }
+
+
+    size_t RegionWriter::getFreeSectorCount() const
+    {
+        return std::count(_used.begin(), _used.end(), false);
+    }
+
+
+    bool RegionWriter::findFree(size_t count, size_t limit, size_t &start) const
+    {
+        // Best fit among the holes that end by limit
+        size_t best = 0;
+        size_t bestLength = 0;
+
+        size_t i = HEADER_SECTORS;
+        while (i < limit)
+        {
+            if (_used[i])
+            {
+                ++i;
+                continue;
+            }
+
+            size_t run = i;
+            while (i < limit && !_used[i])
+                ++i;
+
+            size_t length = i - run;
+            if (length >= count && (bestLength == 0 || length < bestLength))
+            {
+                best = run;
+                bestLength = length;
+                if (length == count)
+                    break;
+            }
+        }
+
+        start = best;
+        return bestLength != 0;
+    }
+
+
+    size_t RegionWriter::allocate(size_t count)
+    {
+        size_t start;
+        bool found = findFree(count, std::min(_used.size(), MAX_OFFSET), start);
+        if (!found)
+        {
+            // Grow the file, reusing any free sectors at its end
+            start = _used.size();
+            while (start > HEADER_SECTORS && !_used[start - 1])
+                --start;
+        }
+
+        if (start >= MAX_OFFSET)
+            throw RegionIOException(EFBIG);
+
+        if (!found && _used.size() < start + count)
+            _used.resize(start + count, false);
+
+        mark(start, count, true);
+        return start;
+    }
+
+
+    void RegionWriter::place(int i, size_t start, const uint8_t *sectors, size_t count,
+                             uint32_t timestamp)
+    {
+        try
+        {
+            writeAll(sectors, count * SECTOR_SIZE, start * SECTOR_SIZE);
+            if (_sync && fdatasync(_fd) < 0)
+                throw RegionIOException(errno);
+        }
+        catch (...)
+        {
+            mark(start, count, false);
+            throw;
+        }
+
+        // A single aligned 4 byte write switches the chunk over
+        uint8_t entry[4];
+        uint32_t location = (start << 8) | count;
+        store32(entry, location);
+        try
+        {
+            writeAll(entry, sizeof(entry), i * 4);
+        }
+        catch (...)
+        {
+            mark(start, count, false);
+            throw;
+        }
+
+        uint32_t old = _locations[i];
+        _locations[i] = location;
+
+        store32(entry, timestamp);
+        writeAll(entry, sizeof(entry), RegionFile::SECTOR_SIZE + i * 4);
+        if (_sync && fdatasync(_fd) < 0)
+            throw RegionIOException(errno);
+
+        // The old copy is free to reuse only once the header is down; if
+        // that failed, it stays allocated until compact()
+        if (old != 0)
+            mark(old >> 8, old & 0xff, false);
+    }
+
+
+    void RegionWriter::writeAll(const void *data, size_t length, off_t offset)
+    {
+        const uint8_t *pos = static_cast<const uint8_t *>(data);
+        while (length > 0)
+        {
+            ssize_t ret = pwrite(_fd, pos, length, offset);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw RegionIOException(errno);
+            }
+
+            pos += ret;
+            length -= ret;
+            offset += ret;
+        }
+    }
+
+
+    void RegionWriter::mark(size_t start, size_t count, bool used)
+    {
+        for (size_t i = start; i < start + count && i < _used.size(); ++i)
+            _used[i] = used;
+    }
+}
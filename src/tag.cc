@@ -21,32 +21,174 @@
 namespace nbt
 {
     Tag::Tag(const std::string &name)
+        : _name(NbtStringPool::intern(name))
+        , _arena(NbtArena::current())
+        , _owners(1)
+        , _holders(0)
     {
         // Create a new Tag
-        _name = name;
     }
 
 
     Tag::Tag(const Tag &t)
+        : _name(t._name)
+        , _arena(NbtArena::current())
+        , _owners(1)
+        , _holders(0)
     {
         // Copy from another one
-        _name = t.getName();
     }
 
 
     Tag::~Tag() {}
 
 
+    Tag &Tag::operator=(const Tag &t)
+    {
+        markDirty();
+        _name = t._name;
+        return *this;
+    }
+
+
+    void *Tag::operator new(size_t size)
+    {
+        NbtArena *arena = NbtArena::current();
+        if (arena)
+            return arena->allocate(size);
+
+        return ::operator new(size);
+    }
+
+
+    void Tag::operator delete(void *p)
+    {
+        // Only ever reached for heap tags, see destroy()
+        ::operator delete(p);
+    }
+
+
+    void Tag::destroy(Tag *tag)
+    {
+        if (!tag || tag->_owners.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        if (!tag->inArena())
+            delete tag;
+    }
+
+
+    bool Tag::inArena() const
+    {
+        // Tags are constructed right where operator new put them
+        return _arena != NULL;
+    }
+
+
+    bool Tag::isShared() const
+    {
+        // Pairs with the release in destroy(), so a copy that has just let
+        // go is done reading before the tag is changed
+        if (_owners.load(std::memory_order_acquire) > 1)
+            return true;
+
+        // Or the one body holding the tag is held by copies
+        const Container *body = reinterpret_cast<const Container *>(
+            _holders.load(std::memory_order_acquire));
+        return body != NULL && body->owners.load(std::memory_order_acquire) > 1;
+    }
+
+
+    Tag *Tag::share() const
+    {
+        _owners.fetch_add(1, std::memory_order_relaxed);
+        return const_cast<Tag *>(this);
+    }
+
+
+    void Tag::markDirty()
+    {
+        dropCache();
+
+        // A shared tag sits in several bodies, and a shared body under
+        // several containers; only one path up is recorded
+        const Tag *tag = this;
+        while (tag->_owners.load(std::memory_order_acquire) == 1)
+        {
+            Container *body = reinterpret_cast<Container *>(
+                tag->_holders.load(std::memory_order_acquire));
+            if (body == NULL)
+                return;
+
+            if (body->owners.load(std::memory_order_acquire) != 1)
+            {
+                body->cache.drop(false);
+                return;
+            }
+
+            // One without an encoding may still be inside one with
+            body->cache.drop(true);
+            tag = reinterpret_cast<const Tag *>(body->holders.load(std::memory_order_acquire));
+        }
+    }
+
+
+    void Tag::dropCache()
+    {
+    }
+
+
+    void Tag::Container::acquire(const Tag *holder)
+    {
+        holders.fetch_xor(reinterpret_cast<uintptr_t>(holder), std::memory_order_relaxed);
+        owners.fetch_add(1, std::memory_order_relaxed);
+    }
+
+
+    bool Tag::Container::release(const Tag *holder)
+    {
+        // The remaining holders must be exact once they see the count
+        holders.fetch_xor(reinterpret_cast<uintptr_t>(holder), std::memory_order_relaxed);
+        return owners.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+
+    void Tag::Container::replace(const Tag *holder, const Tag *other)
+    {
+        holders.fetch_xor(reinterpret_cast<uintptr_t>(holder) ^ reinterpret_cast<uintptr_t>(other),
+                          std::memory_order_relaxed);
+    }
+
+
+    void Tag::Container::adopt(Tag *child)
+    {
+        child->_holders.fetch_xor(reinterpret_cast<uintptr_t>(this), std::memory_order_release);
+    }
+
+
+    void Tag::Container::disown(Tag *child)
+    {
+        child->_holders.fetch_xor(reinterpret_cast<uintptr_t>(this), std::memory_order_release);
+    }
+
+
     std::string Tag::getName() const
+    {
+        return _name.str();
+    }
+
+
+    const InternedString &Tag::getInternedName() const
     {
         return _name;
     }
 
 
-    void Tag::setName(const std::string &name)
+    void Tag::setName(const StringView &name)
     {
         // Assign a new name
-        _name = name;
+        _name = NbtStringPool::intern(name);
+        markDirty();
     }
 
 
@@ -105,34 +247,98 @@ namespace nbt
             case TAG_INT_ARRAY:
                 return "Int Array";
 
+            case TAG_LONG_ARRAY:
+                return "Long Array";
+
             default:
                 return "Unknown";
         }
     }
 
 
+    void Tag::write(NbtWriter &writer) const
+    {
+        writer.writeByte(getType());
+        writer.writeString(_name);
+        writePayload(writer);
+    }
+
+
+    void Tag::writePayload(NbtWriter &writer) const
+    {
+        // The super class Tag has no payload, this is overriden by
+        // derived classes
+    }
+
+
     ByteArray Tag::toByteArray() const
     {
-        ByteArray ret;
-        int16_t length = _name.length();
+        NbtWriter writer(serializedSize());
+        write(writer);
+
+        return writer.getBuffer();
+    }
+
+
+    size_t Tag::serializedSize() const
+    {
+        return 1 + 2 + _name.size() + payloadSize();
+    }
+
+
+    size_t Tag::payloadSize() const
+    {
+        return 0;
+    }
+
+
+    size_t Tag::getPayloadSize(uint8_t type)
+    {
+        switch (type)
+        {
+            case TAG_BYTE:
+                return 1;
+
+            case TAG_SHORT:
+                return 2;
 
-        ret.push_back(getType());
+            case TAG_INT:
+            case TAG_FLOAT:
+                return 4;
 
-        // Turn the 2 byte length into an array of two 1 byte length
-        int8_t *flip = reinterpret_cast<int8_t *>(&length);
+            case TAG_LONG:
+            case TAG_DOUBLE:
+                return 8;
+
+            default:
+                return 0;
+        }
+    }
 
-        for (int i = 1; i >= 0; --i)
-            ret.push_back(flip[i]);
 
-        for (size_t i = 0; i < _name.length(); ++i)
-            ret.push_back(_name[i]);
-        
-        return ret;
+    Tag *Tag::create(uint8_t type)
+    {
+        switch (type)
+        {
+            case TAG_BYTE:       return new TagByte("");
+            case TAG_SHORT:      return new TagShort("");
+            case TAG_INT:        return new TagInt("");
+            case TAG_LONG:       return new TagLong("");
+            case TAG_FLOAT:      return new TagFloat("");
+            case TAG_DOUBLE:     return new TagDouble("");
+            case TAG_BYTE_ARRAY: return new TagByteArray("", NULL, 0);
+            case TAG_STRING:     return new TagString("");
+            case TAG_LIST:       return new TagList(TAG_END, "");
+            case TAG_COMPOUND:   return new TagCompound("");
+            case TAG_INT_ARRAY:  return new TagIntArray("", NULL, 0);
+            case TAG_LONG_ARRAY: return new TagLongArray("", NULL, 0);
+            default:             return NULL;
+        }
     }
 
 
     std::string Tag::toString() const
     {
-        return "TAG" + (_name.empty() ? "" : "(\"" + _name + "\")");
+        return "TAG" + (_name.empty() ? "" : "(\"" + getName() + "\")");
     }
 }
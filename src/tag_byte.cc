@@ -41,6 +41,7 @@ namespace nbt
     void TagByte::setValue(const int8_t &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,13 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagByte::toByteArray() const
+    void TagByte::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
+        writer.writeByte(_value);
+    }
 
-        ret.push_back(_value);
 
-        return ret;
+    size_t TagByte::payloadSize() const
+    {
+        return sizeof(int8_t);
     }
 
 
@@ -76,6 +79,13 @@ namespace nbt
 
     Tag* TagByte::clone() const
     {
-        return new TagByte(_name, _value);
+        return new TagByte(getName(), _value);
+    }
+
+
+    Tag* TagByte::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
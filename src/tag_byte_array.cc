@@ -33,13 +33,56 @@ namespace nbt
         , pValues(0)
         , size(t.size)
     {
-        pValues = new unsigned char[size];
+        pValues = NbtArena::newArray<unsigned char>(size);
         memcpy(pValues, t.pValues, size);
     }
 
     TagByteArray::~TagByteArray()
     {
-        delete[] pValues;
+        if (!inArena())
+            delete[] pValues;
+    }
+
+    TagByteArray::TagByteArray(TagByteArray &&t)
+        : Tag(t.getName())
+        , pValues(0)
+        , size(0)
+    {
+        *this = std::move(t);
+    }
+
+    TagByteArray &TagByteArray::operator=(const TagByteArray &t)
+    {
+        if (this != &t)
+        {
+            Tag::operator=(t);
+
+            // The copy belongs to wherever this tag lives
+            NbtArena::Scope scope(_arena);
+            unsigned char *values = NbtArena::newArray<unsigned char>(t.size);
+            memcpy(values, t.pValues, t.size);
+            setValues(values, t.size);
+        }
+
+        return *this;
+    }
+
+    TagByteArray &TagByteArray::operator=(TagByteArray &&t)
+    {
+        // Buffers only change hands between tags in the same arena
+        if (_arena != t._arena)
+            return *this = t;
+
+        if (this != &t)
+        {
+            Tag::operator=(t);
+            setValues(t.pValues, t.size);
+
+            t.pValues = 0;
+            t.size = 0;
+        }
+
+        return *this;
     }
     
     const unsigned char *TagByteArray::getValues() const
@@ -50,8 +93,12 @@ namespace nbt
 
     void TagByteArray::setValues(unsigned char *values, unsigned int newSize)
     {
+        if (values != pValues && !inArena())
+            delete[] pValues;
+
         pValues = values;
         size = newSize;
+        markDirty();
     }
 
     unsigned int TagByteArray::getSize() const
@@ -66,20 +113,16 @@ namespace nbt
     }
 
 
-    ByteArray TagByteArray::toByteArray() const
+    void TagByteArray::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        //int32_t len = _value.size();
-        //uint8_t *split = reinterpret_cast<uint8_t *>(&len);
-
-        //for (int i = 3; i >= 0; --i)
-        //    ret.push_back(split[i]);
+        writer.writeInt(size);
+        writer.writeBytes(pValues, size);
+    }
 
-        //for (int i = 0; i < len; ++i)
-        //    ret.push_back(_value[i]);
 
-        return ret;
+    size_t TagByteArray::payloadSize() const
+    {
+        return 4 + size;
     }
 
 
@@ -113,4 +156,10 @@ namespace nbt
     {
         return new TagByteArray(*this);
     }
+
+
+    Tag* TagByteArray::moveClone()
+    {
+        return new TagByteArray(std::move(*this));
+    }
 }
@@ -22,30 +22,99 @@ namespace nbt
 {
     TagCompound::TagCompound(const std::string &name)
         : Tag(name)
+        , _body(NbtArena::newObject<Body>())
     {
+        _body->acquire(this);
     }
 
 
-    TagCompound::TagCompound(const TagCompound &t) : Tag(t.getName())
+    TagCompound::TagCompound(const TagCompound &t)
+        : Tag(t.getName())
+        , _body(NULL)
     {
-        for (auto tagItr : t._value)
+        // Copies within one arena share the entries, see the class comment
+        if (_arena == t._arena)
         {
-            insert(tagItr.second->clone());
+            _body = t._body;
+            _body->acquire(this);
+            return;
         }
-   }
+
+        _body = NbtArena::newObject<Body>();
+        _body->acquire(this);
+        _body->value.reserve(t._body->value.size());
+
+        for (const auto &tagItr : t._body->value)
+            insert(tagItr.second->clone());
+    }
+
+
+    TagCompound::TagCompound(TagCompound &&t)
+        : Tag(t.getName())
+        , _body(NbtArena::newObject<Body>())
+    {
+        _body->acquire(this);
+        *this = std::move(t);
+    }
 
 
     TagCompound::~TagCompound()
     {
-        for (auto tagItr : _value)
-            delete tagItr.second;
-        _value.clear();
+        releaseBody();
+    }
+
+
+    TagCompound &TagCompound::operator=(const TagCompound &t)
+    {
+        if (this == &t)
+            return *this;
+
+        Tag::operator=(t);
+
+        if (_arena == t._arena)
+        {
+            t._body->acquire(this);
+            releaseBody();
+            _body = t._body;
+            return *this;
+        }
+
+        // Children are cloned into wherever this compound lives
+        NbtArena::Scope scope(_arena);
+
+        clear();
+        _body->value.reserve(t._body->value.size());
+
+        for (const auto &tagItr : t._body->value)
+            insert(tagItr.second->clone());
+
+        return *this;
+    }
+
+
+    TagCompound &TagCompound::operator=(TagCompound &&t)
+    {
+        // Children only change hands between compounds in the same arena
+        if (_arena != t._arena)
+            return *this = t;
+
+        if (this == &t)
+            return *this;
+
+        Tag::operator=(t);
+
+        std::swap(_body, t._body);
+        _body->replace(&t, this);
+        t._body->replace(this, &t);
+        t.clear();
+
+        return *this;
     }
 
 
-    const std::map<std::string, Tag *>& TagCompound::getValue() const
+    const TagCompound::Map& TagCompound::getValue() const
     {
-        return _value;
+        return _body->value;
     }
 
 
@@ -58,44 +127,223 @@ namespace nbt
 
     void TagCompound::insert(const Tag &tag)
     {
-        _value[tag.getName()] = tag.clone();
+        insert(tag.clone());
+    }
+
+    void TagCompound::insert(Tag &&tag)
+    {
+        insert(tag.moveClone());
     }
 
     void TagCompound::insert(Tag *tag)
     {
-        _value[tag->getName()] = tag;
+        detach();
+
+        Tag *old = _body->value.insert(tag->_name, tag);
+        if (old != tag)
+        {
+            if (old != NULL)
+            {
+                _body->disown(old);
+                Tag::destroy(old);
+            }
+
+            _body->adopt(tag);
+        }
+
+        markDirty();
+    }
+
+    void TagCompound::insert(std::unique_ptr<Tag> tag)
+    {
+        insert(tag.release());
+    }
+
+    void TagCompound::remove(const Key &key)
+    {
+        if (!hasKey(key))
+            return;
+
+        detach();
+
+        auto tagItr = find(key);
+        Tag *tag = tagItr->second;
+        _body->value.erase(tagItr);
+
+        _body->disown(tag);
+        Tag::destroy(tag);
+        markDirty();
+    }
+
+    void TagCompound::clear()
+    {
+        if (!ownsBody())
+        {
+            // Leave the shared entries to the other copies
+            NbtArena::Scope scope(_arena);
+            Body *body = NbtArena::newObject<Body>();
+            body->acquire(this);
+            releaseBody();
+            _body = body;
+        }
+        else
+        {
+            for (const auto &tagItr : _body->value)
+            {
+                _body->disown(tagItr.second);
+                Tag::destroy(tagItr.second);
+            }
+            _body->value.clear();
+        }
+
+        markDirty();
     }
 
-    void TagCompound::remove(const std::string &name)
+    Tag *TagCompound::edit(const Key &key)
     {
-        _value.erase(name);
+        Tag *tag = privateChild(key, true);
+
+        // The caller is about to change the child
+        if (tag != nullptr)
+            markDirty();
+
+        return tag;
+    }
+
+    Tag *TagCompound::privateChild(const Key &key, bool changing)
+    {
+        if (!hasKey(key))
+            return nullptr;
+
+        detach(changing);
+
+        auto tagItr = find(key);
+        Tag *tag = tagItr->second;
+        if (tag->isShared())
+        {
+            // Only this compound is private yet, so the child is copied too.
+            // Below it, the copy shares again until edited in turn.
+            NbtArena::Scope scope(_arena);
+            Tag *old = tag;
+            tag = tag->clone();
+            _body->value.insert(tagItr->first, tag);
+
+            _body->disown(old);
+            Tag::destroy(old);
+            _body->adopt(tag);
+        }
+
+        return tag;
+    }
+
+    void TagCompound::detach(bool changing)
+    {
+        if (ownsBody())
+            return;
+
+        // Copy the entry table only, the children become shared
+        NbtArena::Scope scope(_arena);
+        Body *body = NbtArena::newObject<Body>();
+        body->acquire(this);
+        body->value = _body->value;
+
+        for (const auto &tagItr : body->value)
+            body->adopt(tagItr.second->share());
+
+        if (!changing)
+            body->cache.store(_body->cache);
+
+        releaseBody();
+        _body = body;
+    }
+
+    void TagCompound::releaseBody()
+    {
+        if (!_body->release(this))
+            return;
+
+        for (const auto &tagItr : _body->value)
+        {
+            _body->disown(tagItr.second);
+            Tag::destroy(tagItr.second);
+        }
+
+        // Arena bodies go with the arena, like the tags
+        if (!inArena())
+            delete _body;
+    }
+
+    bool TagCompound::ownsBody() const
+    {
+        return _body->owners.load(std::memory_order_acquire) == 1;
+    }
+
+    void TagCompound::dropCache()
+    {
+        // A shared body stays valid for the other copies
+        if (ownsBody())
+            _body->cache.drop(true);
+    }
+
+    void TagCompound::reserve(size_t size)
+    {
+        detach(false);
+        _body->value.reserve(size);
     }
 
     std::vector<std::string> TagCompound::getKeys() const
     {
         std::vector<std::string> ret;
 
-        for (auto tagItr : _value)
-            ret.push_back(tagItr.first);
+        for (const auto &tagItr : _body->value)
+            ret.push_back(tagItr.first.str());
 
         return ret;
     }
 
-    std::vector<Tag *> TagCompound::getValues() const
+    std::vector<Tag *> TagCompound::getValues()
     {
         std::vector<Tag *> ret;
+        ret.reserve(_body->value.size());
+
+        std::vector<std::string> keys = getKeys();
+        for (size_t i = 0; i < keys.size(); ++i)
+            ret.push_back(privateChild(keys[i], false));
 
-        for (auto tagItr : _value)
+        return ret;
+    }
+
+
+    std::vector<const Tag *> TagCompound::getValues() const
+    {
+        std::vector<const Tag *> ret;
+
+        for (const auto &tagItr : _body->value)
             ret.push_back(tagItr.second);
 
         return ret;
     }
 
 
-    Tag *TagCompound::getValueAt(const std::string &key) const
+    Tag *TagCompound::getValueAt(const Key &key)
     {
-        auto tagItr = _value.find(key);
-        return tagItr->second;
+        // The encoding stays, as the child has not changed yet
+        return privateChild(key, false);
+    }
+
+
+    const Tag *TagCompound::getValueAt(const Key &key) const
+    {
+        auto tagItr = find(key);
+        if (tagItr != _body->value.end())
+            return tagItr->second;
+        return nullptr;
+    }
+
+
+    TagCompound::Map::const_iterator TagCompound::find(const Key &key) const
+    {
+        return _body->value.find(key);
     }
 
 
@@ -105,19 +353,38 @@ namespace nbt
     }
 
 
-    ByteArray TagCompound::toByteArray() const
+    void TagCompound::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        for (auto tagItr : _value)
+        // Unchanged since the last write, see EncodingCache
+        const ByteArray *cached = _body->cache.get();
+        if (cached != NULL)
         {
-            ByteArray tmp = tagItr.second->toByteArray();
-
-            for (size_t i = 0; i < tmp.size(); ++i)
-                ret.push_back(tmp[i]);
+            writer.writeBytes(cached->data(), cached->size());
+            return;
         }
 
-        ret.push_back((char)TAG_END);
+        NbtWriter::Encoding encoding(writer);
+
+        for (const auto &tagItr : _body->value)
+            tagItr.second->write(writer);
+
+        writer.writeByte(TAG_END);
+
+        // Arena trees keep no encodings
+        encoding.keep(inArena() ? NULL : &_body->cache, ownsBody());
+    }
+
+
+    size_t TagCompound::payloadSize() const
+    {
+        const ByteArray *cached = _body->cache.get();
+        if (cached != NULL)
+            return cached->size();
+
+        size_t ret = 1; // Trailing TAG_End
+
+        for (const auto &tagItr : _body->value)
+            ret += tagItr.second->serializedSize();
 
         return ret;
     }
@@ -131,10 +398,10 @@ namespace nbt
         if (!_name.empty())
             ret << "(\"" << _name << "\")";
 
-        ret << ": " << _value.size() << " entries" << std::endl
+        ret << ": " << _body->value.size() << " entries" << std::endl
             << "{" << std::endl;
 
-        for (auto tagItr : _value)
+        for (const auto &tagItr : _body->value)
         {
             ret << "  " 
                 << string_replace(tagItr.second->toString(), "\n", "\n  ")
@@ -148,19 +415,18 @@ namespace nbt
 
     Tag *TagCompound::clone() const
     {
-        TagCompound *ret = new TagCompound(_name);
+        return new TagCompound(*this);
+    }
 
-        for (auto tagItr : _value)
-        {
-            ret->insert(tagItr.second->clone());
-        }
 
-        return ret;
+    Tag *TagCompound::moveClone()
+    {
+        return new TagCompound(std::move(*this));
     }
 
-    int TagCompound::getInt(const std::string& key) const
+    int TagCompound::getInt(const Key& key) const
     {
-        nbt::TagInt* tag = getValueAt<nbt::TagInt>(key);
+        const nbt::TagInt* tag = getValueAt<nbt::TagInt>(key);
         if (tag)
         {
             return tag->getValue();
@@ -168,9 +434,9 @@ namespace nbt
         return 0;
     }
 
-    short TagCompound::getShort(const std::string& key) const
+    short TagCompound::getShort(const Key& key) const
     {
-        nbt::TagShort* tag = getValueAt<nbt::TagShort>(key);
+        const nbt::TagShort* tag = getValueAt<nbt::TagShort>(key);
         if (tag)
         {
             return tag->getValue();
@@ -178,9 +444,9 @@ namespace nbt
         return 0;
     }
 
-    char TagCompound::getByte(const std::string& key) const
+    char TagCompound::getByte(const Key& key) const
     {
-        nbt::TagByte* tag = getValueAt<nbt::TagByte>(key);
+        const nbt::TagByte* tag = getValueAt<nbt::TagByte>(key);
         if (tag)
         {
             return tag->getValue() != 0;
@@ -188,9 +454,9 @@ namespace nbt
         return 0;
     }
 
-    bool TagCompound::getBool(const std::string& key) const
+    bool TagCompound::getBool(const Key& key) const
     {
-        nbt::TagByte* tag = getValueAt<nbt::TagByte>(key);
+        const nbt::TagByte* tag = getValueAt<nbt::TagByte>(key);
         if (tag)
         {
             return tag->getValue();
@@ -198,9 +464,9 @@ namespace nbt
         return false;
     }
 
-    float TagCompound::getFloat(const std::string& key) const
+    float TagCompound::getFloat(const Key& key) const
     {
-        nbt::TagFloat* tag = getValueAt<nbt::TagFloat>(key);
+        const nbt::TagFloat* tag = getValueAt<nbt::TagFloat>(key);
         if (tag)
         {
             return tag->getValue();
@@ -208,9 +474,9 @@ namespace nbt
         return 0;
     }
 
-    double TagCompound::getDouble(const std::string& key) const
+    double TagCompound::getDouble(const Key& key) const
     {
-        nbt::TagDouble* tag = getValueAt<nbt::TagDouble>(key);
+        const nbt::TagDouble* tag = getValueAt<nbt::TagDouble>(key);
         if (tag)
         {
             return tag->getValue();
@@ -218,9 +484,9 @@ namespace nbt
         return 0;
     }
 
-    std::string TagCompound::getString(const std::string& key) const
+    std::string TagCompound::getString(const Key& key) const
     {
-        nbt::TagString* tag = getValueAt<nbt::TagString>(key);
+        const nbt::TagString* tag = getValueAt<nbt::TagString>(key);
         if (tag)
         {
             return tag->getValue();
@@ -228,8 +494,8 @@ namespace nbt
         return "";
     }
 
-    bool TagCompound::hasKey(const std::string& key) const
+    bool TagCompound::hasKey(const Key& key) const
     {
-        return _value.find(key) != _value.end();
+        return find(key) != _body->value.end();
     }
 }
@@ -41,6 +41,7 @@ namespace nbt
     void TagDouble::setValue(const double &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,16 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagDouble::toByteArray() const
+    void TagDouble::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        const uint8_t *split = reinterpret_cast<const uint8_t *>(&_value);
+        writer.writeDouble(_value);
+    }
 
-        for (int i = 7; i >= 0; --i)
-            ret.push_back(split[i]);
 
-        return ret;
+    size_t TagDouble::payloadSize() const
+    {
+        return sizeof(double);
     }
 
 
@@ -79,6 +79,13 @@ namespace nbt
 
     Tag *TagDouble::clone() const
     {
-        return new TagDouble(_name, _value);
+        return new TagDouble(getName(), _value);
+    }
+
+
+    Tag *TagDouble::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
@@ -38,6 +38,19 @@ namespace nbt
     }
 
 
+    void TagEnd::write(NbtWriter &writer) const
+    {
+        // TAG_End is a lone type byte, it carries neither name nor payload
+        writer.writeByte(TAG_END);
+    }
+
+
+    size_t TagEnd::serializedSize() const
+    {
+        return 1;
+    }
+
+
     std::string TagEnd::toString() const
     {
         return "TAG_End";
@@ -47,4 +60,11 @@ namespace nbt
     {
         return new TagEnd();
     }
+
+
+    Tag *TagEnd::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
+    }
 }
@@ -41,6 +41,7 @@ namespace nbt
     void TagFloat::setValue(const float &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,16 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagFloat::toByteArray() const
+    void TagFloat::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        const uint8_t *split = reinterpret_cast<const uint8_t *>(&_value);
+        writer.writeFloat(_value);
+    }
 
-        for (int i = 3; i >= 0; --i)
-            ret.push_back(split[i]);
 
-        return ret;
+    size_t TagFloat::payloadSize() const
+    {
+        return sizeof(float);
     }
 
 
@@ -79,6 +79,13 @@ namespace nbt
 
     Tag *TagFloat::clone() const
     {
-        return new TagFloat(_name, _value);
+        return new TagFloat(getName(), _value);
+    }
+
+
+    Tag *TagFloat::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
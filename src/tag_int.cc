@@ -41,6 +41,7 @@ namespace nbt
     void TagInt::setValue(const int32_t &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,16 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagInt::toByteArray() const
+    void TagInt::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        const uint8_t *split = reinterpret_cast<const uint8_t *>(&_value);
+        writer.writeInt(_value);
+    }
 
-        for (int i = 3; i >= 0; --i)
-            ret.push_back(split[i]);
 
-        return ret;
+    size_t TagInt::payloadSize() const
+    {
+        return sizeof(int32_t);
     }
 
 
@@ -79,6 +79,13 @@ namespace nbt
 
     Tag *TagInt::clone() const
     {
-        return new TagInt(_name, _value);
+        return new TagInt(getName(), _value);
+    }
+
+
+    Tag *TagInt::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
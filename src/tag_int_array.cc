@@ -33,24 +33,77 @@ namespace nbt
         , _values(0)
         , _size(t._size)
     {
-        _values = new int[_size];
-        memcpy(_values, t._values, _size);
+        _values = NbtArena::newArray<int>(_size);
+        memcpy(_values, t._values, _size * sizeof(int));
     }
 
     TagIntArray::~TagIntArray()
     {
-        delete[] _values;
+        if (!inArena())
+            delete[] _values;
     }
 
-    int* TagIntArray::getValues() const
+    TagIntArray::TagIntArray(TagIntArray &&t)
+        : Tag(t.getName())
+        , _values(0)
+        , _size(0)
+    {
+        *this = std::move(t);
+    }
+
+    TagIntArray &TagIntArray::operator=(const TagIntArray &t)
+    {
+        if (this != &t)
+        {
+            Tag::operator=(t);
+
+            // The copy belongs to wherever this tag lives
+            NbtArena::Scope scope(_arena);
+            int *values = NbtArena::newArray<int>(t._size);
+            memcpy(values, t._values, t._size * sizeof(int));
+            setValues(values, t._size);
+        }
+
+        return *this;
+    }
+
+    TagIntArray &TagIntArray::operator=(TagIntArray &&t)
+    {
+        // Buffers only change hands between tags in the same arena
+        if (_arena != t._arena)
+            return *this = t;
+
+        if (this != &t)
+        {
+            Tag::operator=(t);
+            setValues(t._values, t._size);
+
+            t._values = 0;
+            t._size = 0;
+        }
+
+        return *this;
+    }
+
+    const int *TagIntArray::getValues() const
     {
         return _values;
     }
 
+    int *TagIntArray::editValues()
+    {
+        markDirty();
+        return _values;
+    }
+
     void TagIntArray::setValues(int *values, unsigned int newSize)
     {
+        if (values != _values && !inArena())
+            delete[] _values;
+
         _values = values;
         _size = newSize;
+        markDirty();
     }
 
     unsigned int TagIntArray::getSize() const
@@ -60,22 +113,20 @@ namespace nbt
 
     uint8_t TagIntArray::getType() const
     {
-        return TAG_BYTE_ARRAY;
+        return TAG_INT_ARRAY;
     }
 
 
-    ByteArray TagIntArray::toByteArray() const
+    void TagIntArray::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        ret.push_back(htobe32(_size));
+        writer.writeInt(_size);
+        writer.writeInts(_values, _size);
+    }
 
-        for (size_t k = 0; k < _size; ++k)
-        {
-            ret.push_back(htobe32(_values[k]));
-        }
 
-        return ret;
+    size_t TagIntArray::payloadSize() const
+    {
+        return 4 + _size * sizeof(int32_t);
     }
 
 
@@ -109,4 +160,10 @@ namespace nbt
     {
         return new TagIntArray(*this);
     }
+
+
+    Tag* TagIntArray::moveClone()
+    {
+        return new TagIntArray(std::move(*this));
+    }
 }
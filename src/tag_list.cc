@@ -20,12 +20,93 @@
 
 namespace nbt
 {
+    namespace
+    {
+        // Gathers the values of a numeric list a chunk at a time, so they
+        // are converted in bulk without a heap buffer
+        template <typename TagType, typename Bits>
+        void writeNumeric(NbtWriter &writer, const TagList::Vector &value,
+                          void (NbtWriter::*writeArray)(const Bits *, size_t))
+        {
+            Bits chunk[64];
+            size_t count = 0;
+
+            TagList::Vector::const_iterator i;
+            for (i = value.begin(); i != value.end(); ++i)
+            {
+                auto val = static_cast<const TagType *>(*i)->getValue();
+                memcpy(&chunk[count++], &val, sizeof(Bits));
+
+                if (count == 64)
+                {
+                    (writer.*writeArray)(chunk, count);
+                    count = 0;
+                }
+            }
+
+            (writer.*writeArray)(chunk, count);
+        }
+
+
+        // Copies the value of a primitive tag to out, in native byte order
+        void packValue(const Tag &tag, uint8_t *out)
+        {
+            switch (tag.getType())
+            {
+                case TAG_BYTE:
+                {
+                    int8_t val = static_cast<const TagByte &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+
+                case TAG_SHORT:
+                {
+                    int16_t val = static_cast<const TagShort &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+
+                case TAG_INT:
+                {
+                    int32_t val = static_cast<const TagInt &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+
+                case TAG_LONG:
+                {
+                    int64_t val = static_cast<const TagLong &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+
+                case TAG_FLOAT:
+                {
+                    float val = static_cast<const TagFloat &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+
+                case TAG_DOUBLE:
+                {
+                    double val = static_cast<const TagDouble &>(tag).getValue();
+                    memcpy(out, &val, sizeof(val));
+                    break;
+                }
+            }
+        }
+    }
+
     TagList::TagList(const uint8_t &type,
                      const std::string &name,
                      const std::vector<Tag *> &value)
         : Tag(name)
+        , _body(NbtArena::newObject<Body>())
     {
+        _body->acquire(this);
         _childType = type;
+        _body->packed = getPayloadSize(type) != 0;
 
         std::vector<Tag *>::const_iterator i;
 
@@ -34,30 +115,132 @@ namespace nbt
     }
 
 
-    TagList::TagList(const TagList &t) : Tag(t.getName())
+    TagList::TagList(const TagList &t)
+        : Tag(t.getName())
+        , _childType(t._childType)
+        , _body(NULL)
     {
-        _childType = t.getChildType();
+        // Copies within one arena share the elements, like compounds
+        if (_arena == t._arena)
+        {
+            _body = t._body;
+            _body->acquire(this);
+            return;
+        }
 
-        std::vector<Tag *>::const_iterator i;
-        std::vector<Tag *> value = t.getValue();
+        _body = NbtArena::newObject<Body>();
+        _body->acquire(this);
+        _body->packed = t._body->packed;
 
-        for (i = value.begin(); i != value.end(); ++i)
+        if (_body->packed)
+        {
+            _body->packedValues.assign(t._body->packedValues.begin(), t._body->packedValues.end());
+            return;
+        }
+
+        _body->value.reserve(t._body->value.size());
+
+        Vector::const_iterator i;
+        for (i = t._body->value.begin(); i != t._body->value.end(); ++i)
             append(**i);
     }
 
 
+    TagList::TagList(TagList &&t)
+        : Tag(t.getName())
+        , _childType(t._childType)
+        , _body(NbtArena::newObject<Body>())
+    {
+        _body->acquire(this);
+        *this = std::move(t);
+    }
+
+
     TagList::~TagList()
     {
-        std::vector<Tag *>::iterator it;
+        releaseBody();
+    }
+
+
+    TagList &TagList::operator=(const TagList &t)
+    {
+        if (this == &t)
+            return *this;
+
+        Tag::operator=(t);
+
+        _childType = t._childType;
+
+        if (_arena == t._arena)
+        {
+            t._body->acquire(this);
+            releaseBody();
+            _body = t._body;
+            return *this;
+        }
+
+        // Children are cloned into wherever this list lives
+        NbtArena::Scope scope(_arena);
+
+        clear();
+        _body->packed = t._body->packed;
+
+        if (_body->packed)
+        {
+            _body->packedValues.assign(t._body->packedValues.begin(), t._body->packedValues.end());
+            return *this;
+        }
+
+        _body->value.reserve(t._body->value.size());
+
+        Vector::const_iterator i;
+        for (i = t._body->value.begin(); i != t._body->value.end(); ++i)
+        {
+            _body->value.push_back((*i)->clone());
+            _body->adopt(_body->value.back());
+        }
 
-        for (it = _value.begin(); it != _value.end(); ++it)
-            delete *it;
+        return *this;
     }
 
 
-    std::vector<Tag *> TagList::getValue() const
+    TagList &TagList::operator=(TagList &&t)
     {
-        return _value;
+        // Children only change hands between lists in the same arena
+        if (_arena != t._arena)
+            return *this = t;
+
+        if (this == &t)
+            return *this;
+
+        Tag::operator=(t);
+
+        _childType = t._childType;
+        std::swap(_body, t._body);
+        _body->replace(&t, this);
+        t._body->replace(this, &t);
+        t.clear();
+
+        return *this;
+    }
+
+
+    std::vector<Tag *> TagList::getValue()
+    {
+        std::vector<Tag *> ret;
+        ret.reserve(size());
+
+        for (size_t i = 0; i < size(); ++i)
+            ret.push_back(privateElement(i, false));
+
+        return ret;
+    }
+
+
+    std::vector<const Tag *> TagList::getValue() const
+    {
+        const Vector &elements = readElements();
+        return std::vector<const Tag *>(elements.begin(), elements.end());
     }
 
 
@@ -84,50 +267,97 @@ namespace nbt
 
     void TagList::append(const Tag &value)
     {
-        if (value.getType() == _childType)
-            _value.push_back(value.clone());
+        if (value.getType() != _childType)
+            return;
+
+        detach();
+
+        if (_body->packed)
+        {
+            size_t pos = _body->packedValues.size();
+            _body->packedValues.resize(pos + getPayloadSize(_childType));
+            packValue(value, &_body->packedValues[pos]);
+            dropReadView();
+        }
+        else
+        {
+            _body->value.push_back(value.clone());
+            _body->adopt(_body->value.back());
+        }
 
+        markDirty();
     }
 
 
-    void TagList::append(Tag *value)
+    void TagList::append(Tag &&value)
     {
-        if (value->getType() == _childType)
-            _value.push_back(value);
+        if (value.getType() != _childType || _body->packed)
+        {
+            append(static_cast<const Tag &>(value));
+            return;
+        }
 
+        detach();
+        _body->value.push_back(value.moveClone());
+        _body->adopt(_body->value.back());
+        markDirty();
     }
 
 
-    void TagList::removeFirst()
+    void TagList::append(Tag *value)
     {
-        if (_value.size() > 0)
+        if (value->getType() != _childType)
         {
-            delete *(_value.begin());
-            _value.erase(_value.begin());
+            Tag::destroy(value);
+            return;
         }
+
+        // The caller may hold on to the tag, so it has to stay in the list
+        unpack();
+        detach();
+        _body->value.push_back(value);
+        _body->adopt(value);
+        markDirty();
+    }
+
+
+    void TagList::append(std::unique_ptr<Tag> value)
+    {
+        append(value.release());
+    }
+
+
+    void TagList::reserve(size_t size)
+    {
+        detach(false);
+
+        if (_body->packed)
+            _body->packedValues.reserve(size * getPayloadSize(_childType));
+        else
+            _body->value.reserve(size);
+    }
+
+
+    void TagList::removeFirst()
+    {
+        remove(static_cast<size_t>(0));
     }
 
 
     void TagList::removeLast()
     {
-        if (_value.size() > 0)
-        {
-            delete *(_value.end() - 1);
-            _value.erase(_value.end() - 1);
-        }
+        if (size() > 0)
+            remove(size() - 1);
     }
 
 
     void TagList::remove(Tag *tag)
     {
-        std::vector<Tag *>::iterator i;
-        for (i = _value.begin(); i < _value.end(); ++i)
+        for (size_t i = 0; i < _body->value.size(); ++i)
         {
-            if (*i == tag)
+            if (_body->value[i] == tag)
             {
-                delete *i;
-                _value.erase(i);
-
+                remove(i);
                 break;
             }
         }
@@ -136,53 +366,551 @@ namespace nbt
 
     void TagList::remove(size_t i)
     {
-        if (_value.size() > 0 && i < _value.size())
+        if (i >= size())
+            return;
+
+        detach();
+
+        if (_body->packed)
         {
-            std::vector<Tag *>::iterator it = _value.begin() + i;
-            delete *it;
-            _value.erase(it);
+            size_t childSize = getPayloadSize(_childType);
+            Packed::iterator it = _body->packedValues.begin() + i * childSize;
+            _body->packedValues.erase(it, it + childSize);
+            dropReadView();
         }
+        else
+        {
+            Vector::iterator it = _body->value.begin() + i;
+            _body->disown(*it);
+            Tag::destroy(*it);
+            _body->value.erase(it);
+        }
+
+        markDirty();
     }
 
 
     void TagList::clear()
     {
-        std::vector<Tag *>::iterator i;
-        for (i = _value.begin(); i < _value.end(); ++i)
+        if (!ownsBody())
+        {
+            // Leave the shared elements to the other copies
+            NbtArena::Scope scope(_arena);
+            Body *body = NbtArena::newObject<Body>();
+            body->acquire(this);
+            body->packed = getPayloadSize(_childType) != 0;
+            releaseBody();
+            _body = body;
+        }
+        else
+        {
+            Vector::iterator i;
+            for (i = _body->value.begin(); i < _body->value.end(); ++i)
+            {
+                _body->disown(*i);
+                Tag::destroy(*i);
+            }
+
+            _body->value.clear();
+            _body->packedValues.clear();
+            _body->packed = getPayloadSize(_childType) != 0;
+            dropReadView();
+        }
+
+        markDirty();
+    }
+
+
+    void TagList::splice(size_t start, size_t count, const std::vector<Tag *> &values)
+    {
+        start = std::min(start, size());
+        count = std::min(count, size() - start);
+
+        std::vector<Tag *> kept;
+        kept.reserve(values.size());
+
+        std::vector<Tag *>::const_iterator i;
+        for (i = values.begin(); i != values.end(); ++i)
+        {
+            if ((*i)->getType() == _childType)
+                kept.push_back(*i);
+            else
+                Tag::destroy(*i);
+        }
+
+        detach();
+
+        if (_body->packed)
+        {
+            size_t childSize = getPayloadSize(_childType);
+            Packed::iterator it = _body->packedValues.begin() + start * childSize;
+            it = _body->packedValues.erase(it, it + count * childSize);
+            _body->packedValues.insert(it, kept.size() * childSize, 0);
+
+            for (size_t j = 0; j < kept.size(); ++j)
+            {
+                packValue(*kept[j], &_body->packedValues[(start + j) * childSize]);
+                Tag::destroy(kept[j]);
+            }
+
+            dropReadView();
+        }
+        else
         {
-            delete *i;
-            _value.erase(i);
+            Vector::iterator it = _body->value.begin() + start;
+            for (size_t j = 0; j < count; ++j)
+            {
+                _body->disown(it[j]);
+                Tag::destroy(it[j]);
+            }
+
+            it = _body->value.erase(it, it + count);
+            _body->value.insert(it, kept.begin(), kept.end());
+
+            for (i = kept.begin(); i != kept.end(); ++i)
+                _body->adopt(*i);
         }
+
+        markDirty();
     }
 
 
-    Tag *TagList::at(size_t i) const
+    Tag *TagList::edit(size_t i)
     {
-        if (_value.size() > 0)
-            return _value.at(i);
+        if (i >= size())
+            return nullptr;
+
+        Tag *tag = privateElement(i, true);
+
+        // The caller is about to change the element
+        markDirty();
+
+        return tag;
+    }
+
+
+    Tag *TagList::privateElement(size_t i, bool changing)
+    {
+        unpack();
+        detach(changing);
+
+        Tag *tag = _body->value[i];
+        if (tag->isShared())
+        {
+            // As in TagCompound::edit(), the copy shares below itself
+            NbtArena::Scope scope(_arena);
+            _body->value[i] = tag->clone();
+            _body->disown(tag);
+            Tag::destroy(tag);
+            _body->adopt(_body->value[i]);
+        }
+
+        return _body->value[i];
+    }
+
+
+    Tag *TagList::at(size_t i)
+    {
+        if (size() == 0)
+            return nullptr;
+        if (i >= size())
+            throw std::out_of_range("TagList::at");
+
+        // As for TagCompound::getValueAt(), the element is made private
+        return privateElement(i, false);
+    }
+
+
+    const Tag *TagList::at(size_t i) const
+    {
+        const Vector &elements = readElements();
+        if (elements.size() > 0)
+            return elements.at(i);
         return nullptr;
     }
 
 
-    Tag *TagList::back() const
+    Tag *TagList::back()
     {
-        if (_value.size() > 0)
-            return _value.back();
+        if (size() > 0)
+            return at(size() - 1);
         return nullptr;
     }
 
 
-    Tag *TagList::front() const
+    const Tag *TagList::back() const
     {
-        if (_value.size() > 0)
-            return _value.front();
+        const Vector &elements = readElements();
+        if (elements.size() > 0)
+            return elements.back();
+        return nullptr;
+    }
+
+
+    Tag *TagList::front()
+    {
+        return at(0);
+    }
+
+
+    const Tag *TagList::front() const
+    {
+        const Vector &elements = readElements();
+        if (elements.size() > 0)
+            return elements.front();
         return nullptr;
     }
 
 
     size_t TagList::size() const
     {
-        return _value.size();
+        if (_body->packed)
+            return _body->packedValues.size() / getPayloadSize(_childType);
+
+        return _body->value.size();
+    }
+
+
+    bool TagList::isPacked() const
+    {
+        return _body->packed;
+    }
+
+
+    ArrayView<int8_t> TagList::getBytes() const
+    {
+        return packedValues<int8_t>(TAG_BYTE, NULL);
+    }
+
+
+    ArrayView<int8_t> TagList::getBytes(std::vector<int8_t> &storage) const
+    {
+        return packedValues<int8_t>(TAG_BYTE, &storage);
+    }
+
+
+    ArrayView<int16_t> TagList::getShorts() const
+    {
+        return packedValues<int16_t>(TAG_SHORT, NULL);
+    }
+
+
+    ArrayView<int16_t> TagList::getShorts(std::vector<int16_t> &storage) const
+    {
+        return packedValues<int16_t>(TAG_SHORT, &storage);
+    }
+
+
+    ArrayView<int32_t> TagList::getInts() const
+    {
+        return packedValues<int32_t>(TAG_INT, NULL);
+    }
+
+
+    ArrayView<int32_t> TagList::getInts(std::vector<int32_t> &storage) const
+    {
+        return packedValues<int32_t>(TAG_INT, &storage);
+    }
+
+
+    ArrayView<int64_t> TagList::getLongs() const
+    {
+        return packedValues<int64_t>(TAG_LONG, NULL);
+    }
+
+
+    ArrayView<int64_t> TagList::getLongs(std::vector<int64_t> &storage) const
+    {
+        return packedValues<int64_t>(TAG_LONG, &storage);
+    }
+
+
+    ArrayView<float> TagList::getFloats() const
+    {
+        return packedValues<float>(TAG_FLOAT, NULL);
+    }
+
+
+    ArrayView<float> TagList::getFloats(std::vector<float> &storage) const
+    {
+        return packedValues<float>(TAG_FLOAT, &storage);
+    }
+
+
+    ArrayView<double> TagList::getDoubles() const
+    {
+        return packedValues<double>(TAG_DOUBLE, NULL);
+    }
+
+
+    ArrayView<double> TagList::getDoubles(std::vector<double> &storage) const
+    {
+        return packedValues<double>(TAG_DOUBLE, &storage);
+    }
+
+
+    void TagList::setValues(const int8_t *values, size_t count)
+    {
+        setPackedValues(TAG_BYTE, values, count);
+    }
+
+
+    void TagList::setValues(const int16_t *values, size_t count)
+    {
+        setPackedValues(TAG_SHORT, values, count);
+    }
+
+
+    void TagList::setValues(const int32_t *values, size_t count)
+    {
+        setPackedValues(TAG_INT, values, count);
+    }
+
+
+    void TagList::setValues(const int64_t *values, size_t count)
+    {
+        setPackedValues(TAG_LONG, values, count);
+    }
+
+
+    void TagList::setValues(const float *values, size_t count)
+    {
+        setPackedValues(TAG_FLOAT, values, count);
+    }
+
+
+    void TagList::setValues(const double *values, size_t count)
+    {
+        setPackedValues(TAG_DOUBLE, values, count);
+    }
+
+
+    template <typename T>
+    void TagList::setPackedValues(uint8_t type, const T *values, size_t count)
+    {
+        if (_childType != type)
+            return;
+
+        clear();
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(values);
+        _body->packedValues.assign(bytes, bytes + count * sizeof(T));
+    }
+
+
+    Tag *TagList::createChild(size_t i) const
+    {
+        const uint8_t *pos = &_body->packedValues[i * getPayloadSize(_childType)];
+
+        switch (_childType)
+        {
+            case TAG_BYTE:
+            {
+                int8_t val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagByte("", val);
+            }
+
+            case TAG_SHORT:
+            {
+                int16_t val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagShort("", val);
+            }
+
+            case TAG_INT:
+            {
+                int32_t val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagInt("", val);
+            }
+
+            case TAG_LONG:
+            {
+                int64_t val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagLong("", val);
+            }
+
+            case TAG_FLOAT:
+            {
+                float val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagFloat("", val);
+            }
+
+            case TAG_DOUBLE:
+            {
+                double val;
+                memcpy(&val, pos, sizeof(val));
+                return new TagDouble("", val);
+            }
+
+            default:
+                return NULL;
+        }
+    }
+
+
+    void TagList::packChildren(uint8_t *out) const
+    {
+        size_t childSize = getPayloadSize(_childType);
+        for (size_t i = 0; i < _body->value.size(); ++i)
+            packValue(*_body->value[i], out + i * childSize);
+    }
+
+
+    void TagList::pack()
+    {
+        size_t childSize = getPayloadSize(_childType);
+        if (_body->packed || childSize == 0)
+            return;
+
+        // Same elements, so the encoding stays as it is
+        detach(false);
+
+        _body->packedValues.resize(_body->value.size() * childSize);
+        packChildren(_body->packedValues.data());
+
+        Vector::iterator i;
+        for (i = _body->value.begin(); i != _body->value.end(); ++i)
+        {
+            _body->disown(*i);
+            Tag::destroy(*i);
+        }
+
+        _body->value.clear();
+        _body->packed = true;
+    }
+
+
+    void TagList::unpack()
+    {
+        if (!_body->packed)
+            return;
+
+        detach(false);
+
+        // Children live wherever the list itself does
+        NbtArena::Scope scope(_arena);
+
+        size_t count = size();
+        _body->value.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            _body->value.push_back(createChild(i));
+            _body->adopt(_body->value.back());
+        }
+
+        _body->packedValues.clear();
+        _body->packed = false;
+        dropReadView();
+    }
+
+
+    const TagList::Vector &TagList::readElements() const
+    {
+        if (!_body->packed)
+            return _body->value;
+
+        Vector *view = _body->readView.load(std::memory_order_acquire);
+        if (view != NULL)
+            return *view;
+
+        // Built once for all readers of the body; it is only replaced by
+        // the changes that need a private body anyway
+        static std::mutex lock;
+        std::lock_guard<std::mutex> guard(lock);
+
+        view = _body->readView.load(std::memory_order_relaxed);
+        if (view == NULL)
+        {
+            NbtArena::Scope scope(_arena);
+            view = NbtArena::newObject<Vector>();
+
+            size_t count = size();
+            view->reserve(count);
+            for (size_t i = 0; i < count; ++i)
+                view->push_back(createChild(i));
+
+            _body->readView.store(view, std::memory_order_release);
+        }
+
+        return *view;
+    }
+
+
+    void TagList::dropReadView() const
+    {
+        Vector *view = _body->readView.exchange(NULL, std::memory_order_acq_rel);
+        if (view == NULL)
+            return;
+
+        Vector::iterator i;
+        for (i = view->begin(); i != view->end(); ++i)
+            Tag::destroy(*i);
+
+        if (!inArena())
+            delete view;
+    }
+
+
+    void TagList::detach(bool changing)
+    {
+        if (ownsBody())
+            return;
+
+        // Copy the element table only, the children become shared
+        NbtArena::Scope scope(_arena);
+        Body *body = NbtArena::newObject<Body>();
+        body->acquire(this);
+        body->packed = _body->packed;
+        body->value = _body->value;
+        body->packedValues = _body->packedValues;
+
+        Vector::const_iterator i;
+        for (i = body->value.begin(); i != body->value.end(); ++i)
+            body->adopt((*i)->share());
+
+        if (!changing)
+            body->cache.store(_body->cache);
+
+        releaseBody();
+        _body = body;
+    }
+
+
+    void TagList::releaseBody() const
+    {
+        if (!_body->release(this))
+            return;
+
+        Vector::iterator i;
+        for (i = _body->value.begin(); i != _body->value.end(); ++i)
+        {
+            _body->disown(*i);
+            Tag::destroy(*i);
+        }
+
+        dropReadView();
+
+        // Arena bodies go with the arena, like the tags
+        if (!inArena())
+            delete _body;
+    }
+
+
+    bool TagList::ownsBody() const
+    {
+        return _body->owners.load(std::memory_order_acquire) == 1;
+    }
+
+
+    void TagList::dropCache()
+    {
+        // Same rules as TagCompound::dropCache()
+        if (ownsBody())
+            _body->cache.drop(true);
     }
 
 
@@ -191,35 +919,103 @@ namespace nbt
         return TAG_LIST;
     }
 
-    ByteArray TagList::toByteArray() const
+    void TagList::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
+        // Unchanged since the last write, see EncodingCache
+        const ByteArray *cached = _body->cache.get();
+        if (cached != NULL)
+        {
+            writer.writeBytes(cached->data(), cached->size());
+            return;
+        }
 
-        ret.push_back(getChildType());
+        NbtWriter::Encoding encoding(writer);
 
-        int32_t len = _value.size();
-        uint8_t *split = reinterpret_cast<uint8_t *>(&len);
+        writeElements(writer);
 
-        for (int i = 3; i >= 0; --i)
-            ret.push_back(split[i]);
+        // Arena trees keep no encodings
+        encoding.keep(inArena() ? NULL : &_body->cache, ownsBody());
+    }
 
-        std::vector<Tag *>::const_iterator i;
-        for (i = _value.begin(); i != _value.end(); ++i)
+
+    void TagList::writeElements(NbtWriter &writer) const
+    {
+        writer.writeByte(_childType);
+        writer.writeInt(size());
+
+        if (_body->packed)
         {
-            ByteArray tmp = (*i)->toByteArray();
-            uint8_t len_parts[2];
+            const uint8_t *data = _body->packedValues.data();
+            size_t count = size();
 
-            len_parts[0] = tmp.at(2);
-            len_parts[1] = tmp.at(1);
+            switch (_childType)
+            {
+                case TAG_BYTE:
+                    writer.writeBytes(data, count);
+                    return;
+
+                case TAG_SHORT:
+                    writer.writeShorts(reinterpret_cast<const int16_t *>(data), count);
+                    return;
+
+                case TAG_INT:
+                case TAG_FLOAT:
+                    writer.writeInts(reinterpret_cast<const int32_t *>(data), count);
+                    return;
+
+                case TAG_LONG:
+                case TAG_DOUBLE:
+                    writer.writeLongs(reinterpret_cast<const int64_t *>(data), count);
+                    return;
+            }
+        }
+
+        switch (_childType)
+        {
+            case TAG_SHORT:
+                writeNumeric<TagShort, int16_t>(writer, _body->value, &NbtWriter::writeShorts);
+                return;
 
-            int16_t *len = reinterpret_cast<int16_t*>(len_parts);
+            case TAG_INT:
+                writeNumeric<TagInt, int32_t>(writer, _body->value, &NbtWriter::writeInts);
+                return;
 
-            tmp.erase(tmp.begin(), tmp.begin() + 3 + *len);
+            case TAG_LONG:
+                writeNumeric<TagLong, int64_t>(writer, _body->value, &NbtWriter::writeLongs);
+                return;
 
-            for (size_t j = 0; j < tmp.size(); ++j)
-                ret.push_back(tmp[j]);
+            case TAG_FLOAT:
+                writeNumeric<TagFloat, int32_t>(writer, _body->value, &NbtWriter::writeInts);
+                return;
+
+            case TAG_DOUBLE:
+                writeNumeric<TagDouble, int64_t>(writer, _body->value, &NbtWriter::writeLongs);
+                return;
         }
 
+        Vector::const_iterator i;
+        for (i = _body->value.begin(); i != _body->value.end(); ++i)
+            (*i)->writePayload(writer);
+    }
+
+
+    size_t TagList::payloadSize() const
+    {
+        const ByteArray *cached = _body->cache.get();
+        if (cached != NULL)
+            return cached->size();
+
+        size_t ret = 1 + 4; // Child type and length
+
+        // Fixed-width children need no walk
+        size_t childSize = getPayloadSize(_childType);
+        if (childSize != 0)
+            return ret + size() * childSize;
+
+        Vector::const_iterator i;
+        for (i = _body->value.begin(); i != _body->value.end(); ++i)
+            ret += (*i)->payloadSize();
+
         return ret;
     }
 
@@ -233,14 +1029,30 @@ namespace nbt
         if (!_name.empty())
             ret << "(\"" << _name << "\")";
 
-        ret << ": " << _value.size() << " entries of type " 
+        ret << ": " << size() << " entries of type " 
                     << getTypeName(_childType) << std::endl 
                     << "{" << std::endl;
 
-        for (size_t i = 0; i < _value.size(); ++i)
+        for (size_t i = 0; i < size(); ++i)
+        {
+            std::string child;
+            if (_body->packed)
+            {
+                // A throwaway heap tag formats the value, the list stays packed
+                NbtArena::Scope scope(NULL);
+                Tag *tag = createChild(i);
+                child = tag->toString();
+                delete tag;
+            }
+            else
+            {
+                child = _body->value[i]->toString();
+            }
+
             ret << "  "
-                << string_replace(_value[i]->toString(), "\n", "\n  ")
+                << string_replace(child, "\n", "\n  ")
                 << std::endl;
+        }
 
         ret << "}";
 
@@ -249,16 +1061,22 @@ namespace nbt
 
     Tag *TagList::clone() const
     {
-        TagList *ret = new TagList(_childType, _name);
+        return new TagList(*this);
+    }
 
-        std::vector<Tag *>::const_iterator t;
-        for (t = _value.begin(); t != _value.end(); ++t)
-            ret->append(**t);
 
-        return ret;
+    Tag *TagList::moveClone()
+    {
+        return new TagList(std::move(*this));
     }
 
-    Tag *TagList::operator[](size_t index) const
+    Tag *TagList::operator[](size_t index)
+    {
+        return at(index);
+    }
+
+
+    const Tag *TagList::operator[](size_t index) const
     {
         return at(index);
     }
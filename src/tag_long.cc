@@ -41,6 +41,7 @@ namespace nbt
     void TagLong::setValue(const int64_t &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,16 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagLong::toByteArray() const
+    void TagLong::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        const uint8_t *split = reinterpret_cast<const uint8_t *>(&_value);
+        writer.writeLong(_value);
+    }
 
-        for (int i = 7; i >= 0; --i)
-            ret.push_back(split[i]);
 
-        return ret;
+    size_t TagLong::payloadSize() const
+    {
+        return sizeof(int64_t);
     }
 
 
@@ -79,6 +79,13 @@ namespace nbt
 
     Tag *TagLong::clone() const
     {
-        return new TagLong(_name, _value);
+        return new TagLong(getName(), _value);
+    }
+
+
+    Tag *TagLong::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
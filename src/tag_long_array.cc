@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2012 Scott Atkins
+ *
+ * This file is part of cppNBT
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cppnbt.h"
+#include <cstring>
+
+namespace nbt
+{
+    TagLongArray::TagLongArray(const std::string &name, int64_t *values, size_t size)
+        : Tag(name)
+        , _values(values)
+        , _size(size)
+    {
+    }
+
+    TagLongArray::TagLongArray(const TagLongArray &t)
+        : Tag(t.getName())
+        , _values(0)
+        , _size(t._size)
+    {
+        _values = NbtArena::newArray<int64_t>(_size);
+        memcpy(_values, t._values, _size * sizeof(int64_t));
+    }
+
+    TagLongArray::~TagLongArray()
+    {
+        if (!inArena())
+            delete[] _values;
+    }
+
+    TagLongArray::TagLongArray(TagLongArray &&t)
+        : Tag(t.getName())
+        , _values(0)
+        , _size(0)
+    {
+        *this = std::move(t);
+    }
+
+    TagLongArray &TagLongArray::operator=(const TagLongArray &t)
+    {
+        if (this != &t)
+        {
+            Tag::operator=(t);
+
+            // The copy belongs to wherever this tag lives
+            NbtArena::Scope scope(_arena);
+            int64_t *values = NbtArena::newArray<int64_t>(t._size);
+            memcpy(values, t._values, t._size * sizeof(int64_t));
+            setValues(values, t._size);
+        }
+
+        return *this;
+    }
+
+    TagLongArray &TagLongArray::operator=(TagLongArray &&t)
+    {
+        // Buffers only change hands between tags in the same arena
+        if (_arena != t._arena)
+            return *this = t;
+
+        if (this != &t)
+        {
+            Tag::operator=(t);
+            setValues(t._values, t._size);
+
+            t._values = 0;
+            t._size = 0;
+        }
+
+        return *this;
+    }
+
+    const int64_t *TagLongArray::getValues() const
+    {
+        return _values;
+    }
+
+    int64_t *TagLongArray::editValues()
+    {
+        markDirty();
+        return _values;
+    }
+
+    void TagLongArray::setValues(int64_t *values, size_t newSize)
+    {
+        if (values != _values && !inArena())
+            delete[] _values;
+
+        _values = values;
+        _size = newSize;
+        markDirty();
+    }
+
+    size_t TagLongArray::getSize() const
+    {
+        return _size;
+    }
+
+    uint8_t TagLongArray::getType() const
+    {
+        return TAG_LONG_ARRAY;
+    }
+
+
+    void TagLongArray::writePayload(NbtWriter &writer) const
+    {
+        writer.writeInt(_size);
+        writer.writeLongs(_values, _size);
+    }
+
+
+    size_t TagLongArray::payloadSize() const
+    {
+        return 4 + _size * sizeof(int64_t);
+    }
+
+
+    std::string TagLongArray::toString() const
+    {
+        std::stringstream ret;
+
+        ret << "TAG_Long_Array";
+
+        if (!_name.empty())
+            ret << "(\"" << _name << "\")";
+
+        ret << ": ";
+
+        ret << _size << " longs";
+
+        return ret.str();
+    }
+
+
+    Tag* TagLongArray::clone() const
+    {
+        return new TagLongArray(*this);
+    }
+
+
+    Tag* TagLongArray::moveClone()
+    {
+        return new TagLongArray(std::move(*this));
+    }
+}
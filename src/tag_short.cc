@@ -41,6 +41,7 @@ namespace nbt
     void TagShort::setValue(const int16_t &value)
     {
         _value = value;
+        markDirty();
     }
 
 
@@ -50,16 +51,15 @@ namespace nbt
     }
 
 
-    ByteArray TagShort::toByteArray() const
+    void TagShort::writePayload(NbtWriter &writer) const
     {
-        ByteArray ret = Tag::toByteArray();
-
-        const uint8_t *split = reinterpret_cast<const uint8_t *>(&_value);
+        writer.writeShort(_value);
+    }
 
-        for (int i = 1; i >= 0; --i)
-            ret.push_back(split[i]);
 
-        return ret;
+    size_t TagShort::payloadSize() const
+    {
+        return sizeof(int16_t);
     }
 
 
@@ -79,6 +79,13 @@ namespace nbt
 
     Tag *TagShort::clone() const
     {
-        return new TagShort(_name, _value);
+        return new TagShort(getName(), _value);
+    }
+
+
+    Tag *TagShort::moveClone()
+    {
+        // Nothing to take over from a single value
+        return clone();
     }
 }
@@ -21,49 +21,122 @@
 namespace nbt
 {
     TagString::TagString(const std::string &name, const std::string &value) 
-        : Tag(name), _value(value)
+        : Tag(name)
     {
+        _value.assign(value.data(), value.length());
     }
 
 
     TagString::TagString(const TagString &t)
-        : Tag(t.getName()), _value(t.getValue())
+        : Tag(t)
+        , _interned(t._interned)
     {
+        _value.assign(t._value.data(), t._value.length());
+    }
+
+
+    TagString::TagString(TagString &&t)
+        : Tag(t)
+    {
+        *this = std::move(t);
+    }
+
+
+    TagString &TagString::operator=(const TagString &t)
+    {
+        if (this != &t)
+        {
+            Tag::operator=(t);
+            _value.assign(t._value.data(), t._value.length());
+            _interned = t._interned;
+        }
+
+        return *this;
+    }
+
+
+    TagString &TagString::operator=(TagString &&t)
+    {
+        if (this != &t)
+        {
+            // The allocator stays put, so a value from another arena is copied
+            Tag::operator=(t);
+            _value = std::move(t._value);
+            _interned = t._interned;
+
+            t._value.clear();
+            t._interned = InternedString();
+        }
+
+        return *this;
     }
 
 
     std::string TagString::getValue() const
     {
-        return _value;
+        return value().str();
     }
 
 
-    void TagString::setValue(const std::string &value)
+    void TagString::setValue(const StringView &value)
     {
-        _value = value;
+        _value.assign(value.data(), value.size());
+        _interned = InternedString();
+        markDirty();
     }
 
 
-    uint8_t TagString::getType() const
+    void TagString::setValue(const InternedString &value)
     {
-        return TAG_STRING;
+        _value.clear();
+        _interned = value;
+        markDirty();
     }
 
 
-    ByteArray TagString::toByteArray() const
+    void TagString::intern()
     {
-        ByteArray ret = Tag::toByteArray();
+        if (!isInterned())
+            setValue(NbtStringPool::intern(_value));
+    }
 
-        int16_t len = _value.length();
-        uint8_t *split = reinterpret_cast<uint8_t *>(&len);
 
-        for (int i = 1; i >= 0; --i)
-            ret.push_back(split[i]);
+    bool TagString::isInterned() const
+    {
+        return _value.empty();
+    }
 
-        for (int i = 0; i < len; ++i)
-            ret.push_back(_value[i]);
 
-        return ret;
+    const InternedString &TagString::getInternedValue() const
+    {
+        return _interned;
+    }
+
+
+    StringView TagString::value() const
+    {
+        if (_value.empty())
+            return _interned;
+
+        return _value;
+    }
+
+
+    uint8_t TagString::getType() const
+    {
+        return TAG_STRING;
+    }
+
+
+    void TagString::writePayload(NbtWriter &writer) const
+    {
+        writer.writeString(value());
+    }
+
+
+    size_t TagString::payloadSize() const
+    {
+        return 2 + value().size();
     }
 
 
@@ -76,13 +149,19 @@ namespace nbt
         if (!_name.empty())
             ret << "(\"" << _name << "\")";
         
-        ret << ": " << _value;
+        ret << ": " << value();
 
         return ret.str();
     }
 
     Tag *TagString::clone() const
     {
-        return new TagString(_name, _value);
+        return new TagString(*this);
+    }
+
+
+    Tag *TagString::moveClone()
+    {
+        return new TagString(std::move(*this));
     }
 }
@@ -17,6 +17,11 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "src/cppnbt.h"
 
@@ -38,16 +43,2186 @@ void dumpTag(Tag *t)
     cout << endl;
 }
 
+// Self-checks run by "nbttest --check", one function per feature
+int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(bool ok, const char *what, int line)
+{
+    if (ok)
+        return;
+
+    std::cerr << "test.cc:" << line << ": check failed: " << what << std::endl;
+    ++failures;
+}
+
+
+TagCompound *makeTree()
+{
+    TagCompound *root = new TagCompound("root");
+    root->insert(TagInt("count", 1));
+    root->insert(TagString("name", "tree"));
+
+    TagCompound inner("inner");
+    inner.insert(TagDouble("x", 1.5));
+    inner.insert(TagLong("id", 42));
+    root->insert(inner);
+
+    TagList *items = new TagList(TAG_COMPOUND, "items");
+    for (int i = 0; i < 4; ++i)
+    {
+        TagCompound item("");
+        item.insert(TagShort("slot", i));
+        items->append(item);
+    }
+    root->insert(items);
+
+    TagList *ints = new TagList(TAG_INT, "ints");
+    for (int i = 0; i < 8; ++i)
+        ints->append(TagInt("", i * i));
+    root->insert(ints);
+
+    return root;
+}
+
+
+// Same tree encoded without any cached bytes: trees in an arena keep none
+ByteArray encodeUncached(const Tag &tag)
+{
+    NbtArena arena;
+    NbtArena::Scope scope(&arena);
+
+    return tag.clone()->toByteArray();
+}
+
+
+void checkWriter()
+{
+    // The "hello world" example from the NBT specification
+    const uint8_t hello[] = {
+        TAG_COMPOUND, 0, 11, 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd',
+        TAG_STRING, 0, 4, 'n', 'a', 'm', 'e',
+        0, 9, 'B', 'a', 'n', 'a', 'n', 'r', 'a', 'm', 'a',
+        TAG_END
+    };
+    TagCompound root("hello world");
+    root.insert(TagString("name", "Bananrama"));
+    CHECK(root.toByteArray() == ByteArray(hello, hello + sizeof(hello)));
+
+    // Trees go after whatever the writer already holds
+    NbtWriter writer;
+    writer.writeShort(0x1234);
+    root.write(writer);
+    root.write(writer);
+    CHECK(writer.size() == 2 + 2 * sizeof(hello));
+    CHECK(writer.data()[0] == 0x12 && writer.data()[1] == 0x34);
+    CHECK(memcmp(writer.data() + 2 + sizeof(hello), hello, sizeof(hello)) == 0);
+
+    // Numbers are big-endian, written one at a time or in bulk
+    const int16_t shorts[2] = {0x0102, -2};
+    const int32_t ints[1] = {0x01020304};
+    const int64_t longs[1] = {0x0102030405060708LL};
+    const uint8_t numbers[] = {
+        1, 2, 0xff, 0xfe,
+        1, 2, 3, 4,
+        1, 2, 3, 4, 5, 6, 7, 8,
+        0x3f, 0xf0, 0, 0, 0, 0, 0, 0,
+        0xc0, 0, 0, 0
+    };
+    writer.clear();
+    writer.writeShorts(shorts, 2);
+    writer.writeInts(ints, 1);
+    writer.writeLongs(longs, 1);
+    writer.writeDouble(1.0);
+    writer.writeFloat(-2.0f);
+    CHECK(writer.getBuffer() == ByteArray(numbers, numbers + sizeof(numbers)));
+
+    // Deep nesting is written in one pass, each level once
+    TagList *deep = new TagList(TAG_INT, "");
+    for (int i = 0; i < 1000; ++i)
+    {
+        TagList *outer = new TagList(TAG_LIST, "");
+        outer->append(deep);
+        deep = outer;
+    }
+
+    ByteArray nested = deep->toByteArray();
+    CHECK(nested.size() == 3 + 1001 * 5);
+    CHECK(nested[3] == TAG_LIST && nested[7] == 1 && nested[nested.size() - 5] == TAG_INT);
+    delete deep;
+}
+
+
+// One tag of every type, with lists both packed and of child tags
+TagCompound *makeEveryType()
+{
+    TagCompound *root = new TagCompound("every");
+    root->insert(TagByte("byte", -1));
+    root->insert(TagShort("short", 300));
+    root->insert(TagInt("int", -70000));
+    root->insert(TagLong("long", 1LL << 40));
+    root->insert(TagFloat("float", 0.5f));
+    root->insert(TagDouble("double", -2.25));
+    root->insert(TagString("string", "\xc3\xa9t\xc3\xa9"));
+    root->insert(TagByteArray("bytes", new unsigned char[3] {1, 2, 255}, 3));
+    root->insert(TagIntArray("ints", new int32_t[2] {-1, 1 << 20}, 2));
+    root->insert(TagLongArray("longs", new int64_t[2] {-1, 1LL << 50}, 2));
+
+    TagList shorts(TAG_SHORT, "shorts");
+    for (int i = 0; i < 5; ++i)
+        shorts.append(TagShort("", i - 2));
+    root->insert(shorts);
+
+    TagList lists(TAG_LIST, "lists");
+    lists.append(TagList(TAG_STRING, ""));
+    lists.append(shorts);
+    root->insert(lists);
+
+    TagList empty(TAG_END, "empty");
+    root->insert(empty);
+
+    return root;
+}
+
+
+// Writes data to a fresh temporary file, whose path goes to path
+bool writeTempFile(const ByteArray &data, char *path)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return false;
+
+    bool ok = ::write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    ::close(fd);
+    return ok;
+}
+
+
+// Reads a file through NbtFile; NULL when it fails
+Tag *readFile(const char *path, size_t maxLength = 0)
+{
+    NbtFile file;
+    if (maxLength != 0)
+        file.setMaxLength(maxLength);
+
+    try
+    {
+        file.open(path);
+        file.read();
+    }
+    catch (const GzipIOException &)
+    {
+        return NULL;
+    }
+
+    // The file deletes its root on close
+    return file.getRoot()->clone();
+}
+
+
+// serializedSize() of tag and each of its children matches what is written
+bool sizesMatch(const Tag &tag)
+{
+    if (tag.serializedSize() != tag.toByteArray().size())
+        return false;
+
+    if (tag.getType() == TAG_COMPOUND)
+    {
+        std::vector<const Tag *> children = static_cast<const TagCompound &>(tag).getValues();
+        for (size_t i = 0; i < children.size(); ++i)
+            if (!sizesMatch(*children[i]))
+                return false;
+    }
+    else if (tag.getType() == TAG_LIST)
+    {
+        std::vector<const Tag *> children = static_cast<const TagList &>(tag).getValue();
+        for (size_t i = 0; i < children.size(); ++i)
+            if (!sizesMatch(*children[i]))
+                return false;
+    }
+
+    return true;
+}
+
+
+void checkSerializedSize()
+{
+    TagCompound *every = makeEveryType();
+    CHECK(sizesMatch(*every));
+
+    // Multi-byte names and values count in bytes
+    TagCompound text("\xe2\x82\xac");
+    text.insert(TagString("", ""));
+    text.insert(TagString("\xf0\x9f\x8c\x8d", "\xc3\xa9\xe2\x82\xac"));
+    CHECK(sizesMatch(text));
+    CHECK(text.serializedSize() == 3 + 3 + (3 + 0 + 2) + (3 + 4 + 2 + 5) + 1);
+
+    // Unpacked lists, empty containers and changed trees
+    TagList *shorts = every->getValueAt<TagList>("shorts");
+    shorts->at(0);
+    CHECK(!shorts->isPacked() && sizesMatch(*shorts));
+    every->getValueAt<TagList>("lists")->clear();
+    every->insert(TagCompound("none"));
+    every->getValueAt<TagIntArray>("ints")->setValues(new int32_t[5](), 5);
+    CHECK(sizesMatch(*every));
+
+    // The writer is sized once and never grows
+    NbtWriter writer(every->serializedSize());
+    every->write(writer);
+    CHECK(writer.size() == every->serializedSize());
+    CHECK(writer.getBuffer().capacity() == writer.size());
+
+    delete every;
+}
+
+
+// Number of tags in view and below it, reading every value on the way
+size_t walkView(const NbtView &view)
+{
+    size_t count = 1;
+    view.getLong();
+    view.getDouble();
+    view.getString();
+    view.getIntAt(0);
+
+    if (view.getType() == TAG_COMPOUND || view.getType() == TAG_LIST)
+    {
+        NbtCursor cursor = view.children();
+        while (cursor.next())
+            count += walkView(*cursor);
+    }
+
+    return count;
+}
+
+
+void checkView()
+{
+    TagCompound *every = makeEveryType();
+    ByteArray data = every->toByteArray();
+
+    NbtView root(data.data(), data.size());
+    CHECK(root.isValid() && root.getType() == TAG_COMPOUND);
+    CHECK(root.getName() == StringView("every"));
+    CHECK(root.size() == every->getKeys().size());
+
+    CHECK(root.getByte("byte") == -1 && root.getShort("short") == 300);
+    CHECK(root.getInt("int") == -70000 && root.getLong("long") == 1LL << 40);
+    CHECK(root.getFloat("float") == 0.5f && root.getDouble("double") == -2.25);
+    CHECK(root.getString("string") == StringView("\xc3\xa9t\xc3\xa9"));
+
+    // Values are read in place from the buffer
+    StringView string = root.getString("string");
+    CHECK(string.data() > reinterpret_cast<const char *>(data.data())
+          && string.data() < reinterpret_cast<const char *>(data.data() + data.size()));
+
+    NbtView bytes = root["bytes"];
+    CHECK(bytes.size() == 3 && bytes.getByteArray()[2] == 255);
+    CHECK(root["ints"].getIntAt(1) == 1 << 20 && root["longs"].getLongAt(1) == 1LL << 50);
+
+    NbtView shorts = root["shorts"];
+    CHECK(shorts.getChildType() == TAG_SHORT && shorts.size() == 5);
+    CHECK(shorts.at(4).getShort() == 2 && shorts[0].getShort() == -2);
+    CHECK(root["lists"][1][3].getShort() == 1);
+    CHECK(root["empty"].size() == 0);
+
+    // Missing keys and mismatched types read as nothing
+    CHECK(!root["missing"].isValid() && !root.hasKey("missing"));
+    CHECK(root.getInt("missing") == 0 && root.getInt("string") == 0);
+    CHECK(!shorts.at(5).isValid());
+
+    // Every tag is reached once, and cut data is never read past its end
+    size_t tags = walkView(root);
+    CHECK(tags == 1 + 13 + 5 + 2 + 5);
+    bool bounded = true;
+    for (size_t cut = 0; cut < data.size(); ++cut)
+    {
+        ByteArray part(data.begin(), data.begin() + cut);
+        NbtView view(part.data(), part.size());
+        if (view.isValid() && walkView(view) > tags)
+            bounded = false;
+    }
+    CHECK(bounded);
+    CHECK(!NbtView(data.data(), 0).isValid());
+
+    delete every;
+}
+
+
+void checkArena()
+{
+    TagCompound *every = makeEveryType();
+    ByteArray data = every->toByteArray();
+
+    NbtArena arena(512);
+    Tag *kept = NULL;
+    {
+        NbtBuffer buffer;
+        buffer.setArena(&arena);
+        CHECK(buffer.getArena() == &arena);
+        CHECK(buffer.read(data.data(), data.size()));
+
+        // The whole tree lives in the arena, edits to it included
+        TagCompound *root = static_cast<TagCompound *>(buffer.getRoot());
+        CHECK(root != NULL && root->inArena());
+        if (root == NULL)
+            return;
+
+        CHECK(root->getValueAt("lists")->inArena());
+        CHECK(arena.getBytesAllocated() > data.size() && arena.getBlockCount() > 1);
+        CHECK(root->toByteArray() == data);
+
+        size_t before = arena.getBytesAllocated();
+        {
+            NbtArena::Scope scope(&arena);
+            root->insert(TagString("added", "in the arena"));
+        }
+        CHECK(root->getValueAt("added")->inArena());
+        CHECK(arena.getBytesAllocated() > before);
+
+        // A clone outside any scope is an ordinary heap tree
+        CHECK(NbtArena::current() == NULL);
+        kept = root->clone();
+        CHECK(!kept->inArena());
+
+        // The buffer leaves the tree to the arena when it goes
+    }
+
+    // Scopes nest, and end back where they started
+    NbtArena inner;
+    {
+        NbtArena::Scope outerScope(&arena);
+        {
+            NbtArena::Scope innerScope(&inner);
+            CHECK(NbtArena::current() == &inner);
+        }
+        CHECK(NbtArena::current() == &arena);
+    }
+    CHECK(NbtArena::current() == NULL);
+
+    arena.reset();
+    CHECK(arena.getBytesAllocated() == 0);
+    static_cast<TagCompound *>(kept)->remove("added");
+    CHECK(kept->toByteArray() == data);
+
+    delete kept;
+    delete every;
+}
+
+
+// data compressed with codec
+ByteArray compress(const ByteArray &data, const NbtCodec &codec)
+{
+    ByteArray ret(codec.bound(data.size()));
+    size_t size = ret.size();
+    if (!codec.compress(data.data(), data.size(), ret.data(), size))
+        return ByteArray();
+
+    ret.resize(size);
+    return ret;
+}
+
+
+void checkFile()
+{
+    // Many small payloads around a few larger than a read block
+    TagCompound root("blocks");
+    TagList items(TAG_COMPOUND, "items");
+    for (int i = 0; i < 4000; ++i)
+    {
+        TagCompound item("");
+        item.insert(TagInt("i", i));
+        item.insert(TagString("s", std::string(i % 50, 'a' + i % 26)));
+        items.append(item);
+    }
+    root.insert(items);
+
+    unsigned char *bytes = new unsigned char[200000];
+    for (size_t i = 0; i < 200000; ++i)
+        bytes[i] = static_cast<unsigned char>(i * 7);
+    root.insert(TagByteArray("big", bytes, 200000));
+    root.insert(TagIntArray("tail", new int32_t[3] {1, 2, 3}, 3));
+    ByteArray data = root.toByteArray();
+
+    // Written by NbtFile, read back gzipped and uncompressed
+    char gzPath[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(ByteArray(), gzPath));
+    try
+    {
+        NbtFile out;
+        out.open(gzPath, "w");
+        out.setRoot(root);
+        out.write();
+    }
+    catch (const GzipIOException &)
+    {
+        CHECK(!"NbtFile::write() failed");
+    }
+
+    Tag *read = readFile(gzPath);
+    CHECK(read != NULL && read->toByteArray() == data);
+    delete read;
+
+    char rawPath[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(data, rawPath));
+    read = readFile(rawPath);
+    CHECK(read != NULL && read->toByteArray() == data);
+    delete read;
+
+    // A file opened again is read from the start
+    try
+    {
+        NbtFile file(rawPath);
+        file.read();
+        file.open(gzPath);
+        file.read();
+        CHECK(file.getRoot()->toByteArray() == data);
+    }
+    catch (const GzipIOException &)
+    {
+        CHECK(!"reading a reopened NbtFile failed");
+    }
+
+    // Cut files fail, whichever block they end in
+    ByteArray gz = compress(data, NbtCodec(NbtCodec::GZIP));
+    const size_t cuts[4] = {1, 100, gz.size() / 2, gz.size() * 9 / 10};
+    for (int i = 0; i < 4; ++i)
+    {
+        char cutPath[] = "/tmp/nbttest-XXXXXX";
+        CHECK(writeTempFile(ByteArray(gz.begin(), gz.begin() + cuts[i]), cutPath));
+        CHECK(readFile(cutPath) == NULL);
+        unlink(cutPath);
+    }
+
+    char shortPath[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(ByteArray(data.begin(), data.end() - 70000), shortPath));
+    CHECK(readFile(shortPath) == NULL);
+
+    unlink(shortPath);
+    unlink(rawPath);
+    unlink(gzPath);
+}
+
+
+void checkDecoder()
+{
+    TagCompound *every = makeEveryType();
+    ByteArray data = every->toByteArray();
+
+    // Memory and streamed sources decode the same tree
+    NbtBuffer buffer;
+    ByteArray copy = data;
+    CHECK(buffer.read(copy.data(), copy.size()));
+    CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == data);
+
+    char path[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(data, path));
+    Tag *read = readFile(path);
+    CHECK(read != NULL && read->toByteArray() == data);
+    delete read;
+    unlink(path);
+
+    // A list of compounds longer than the input fails on either source
+    // instead of allocating for its declared length
+    const uint8_t list[] = {
+        TAG_COMPOUND, 0, 0,
+        TAG_LIST, 0, 1, 'l', TAG_COMPOUND, 0, 0, 0, 3,
+        TAG_END, TAG_END, TAG_END,
+        TAG_END
+    };
+    ByteArray small(list, list + sizeof(list));
+    copy = small;
+    CHECK(buffer.read(copy.data(), copy.size()));
+    CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == small);
+
+    small[8] = 0x03;
+    copy = small;
+    CHECK(!buffer.read(copy.data(), copy.size()));
+
+    char hugePath[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(small, hugePath));
+    CHECK(readFile(hugePath) == NULL);
+    CHECK(readFile(hugePath, 1 << 30) == NULL);
+    unlink(hugePath);
+
+    delete every;
+}
+
+
+// convert of count width-byte values from src + offset, against swapping
+// each value on its own with flipBytes(), both into another buffer and
+// in place
+template <typename T>
+bool convertsLikeFlipBytes(void (*convert)(void *, const void *, size_t),
+                           size_t count, size_t offset)
+{
+    ByteArray src(count * sizeof(T) + offset + 1);
+    for (size_t i = 0; i < src.size(); ++i)
+        src[i] = static_cast<uint8_t>(i * 37 + count);
+
+    ByteArray expected = src;
+    for (size_t i = 0; i < count && !is_big_endian(); ++i)
+    {
+        T value;
+        memcpy(&value, &src[offset + i * sizeof(T)], sizeof(T));
+        flipBytes(value);
+        memcpy(&expected[offset + i * sizeof(T)], &value, sizeof(T));
+    }
+
+    ByteArray out = src;
+    convert(&out[offset], &src[offset], count);
+    ByteArray inPlace = src;
+    convert(&inPlace[offset], &inPlace[offset], count);
+
+    // Bytes around the values are left alone
+    return out == expected && inPlace == expected;
+}
+
+
+void checkByteSwap()
+{
+    // Counts around every vector width, at every alignment, cover the
+    // vector bodies and the scalar tails
+    bool ok16 = true, ok32 = true, ok64 = true;
+    for (size_t count = 0; count < 70; ++count)
+    {
+        for (size_t offset = 0; offset < 8; ++offset)
+        {
+            ok16 = ok16 && convertsLikeFlipBytes<uint16_t>(convertBigEndian16, count, offset);
+            ok32 = ok32 && convertsLikeFlipBytes<uint32_t>(convertBigEndian32, count, offset);
+            ok64 = ok64 && convertsLikeFlipBytes<uint64_t>(convertBigEndian64, count, offset);
+        }
+    }
+    CHECK(ok16);
+    CHECK(ok32);
+    CHECK(ok64);
+    CHECK(convertsLikeFlipBytes<uint32_t>(convertBigEndian32, 100003, 1));
+
+    // Known values, whatever the host order
+    const uint8_t big[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    uint16_t s;
+    uint32_t i;
+    uint64_t l;
+    convertBigEndian16(&s, big, 1);
+    convertBigEndian32(&i, big, 1);
+    convertBigEndian64(&l, big, 1);
+    CHECK(s == 0x0102 && i == 0x01020304 && l == 0x0102030405060708ULL);
+}
+
+
+void checkLongArray()
+{
+    const int64_t values[3] = {-1, 0x0102030405060708LL, INT64_MIN};
+    TagCompound root("");
+    root.insert(TagLongArray("longs", new int64_t[3] {values[0], values[1], values[2]}, 3));
+    root.insert(TagLongArray("none", NULL, 0));
+
+    const TagLongArray *longs = root.getValueAt<TagLongArray>("longs");
+    CHECK(longs != NULL && longs->getType() == TAG_LONG_ARRAY && longs->getType() == 12);
+    CHECK(Tag::getTypeName(TAG_LONG_ARRAY) == "Long Array");
+    CHECK(longs->toString() == "TAG_Long_Array(\"longs\"): 3 longs");
+
+    // Type 12, a count and big-endian values
+    const uint8_t expected[] = {
+        TAG_LONG_ARRAY, 0, 5, 'l', 'o', 'n', 'g', 's', 0, 0, 0, 3,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        1, 2, 3, 4, 5, 6, 7, 8,
+        0x80, 0, 0, 0, 0, 0, 0, 0
+    };
+    CHECK(longs->toByteArray() == ByteArray(expected, expected + sizeof(expected)));
+
+    ByteArray data = root.toByteArray();
+
+    // Back through the decoder, a view and the push parser
+    NbtBuffer buffer;
+    CHECK(buffer.read(data.data(), data.size()));
+    const TagCompound *read = static_cast<const TagCompound *>(buffer.getRoot());
+    const TagLongArray *readLongs = read ? read->getValueAt<TagLongArray>("longs") : NULL;
+    CHECK(readLongs != NULL && readLongs->getSize() == 3);
+    if (readLongs != NULL)
+        CHECK(std::equal(values, values + 3, readLongs->getValues()));
+    CHECK(read != NULL && read->getValueAt<TagLongArray>("none")->getSize() == 0);
+
+    NbtView view(data.data(), data.size());
+    CHECK(view["longs"].size() == 3 && view["longs"].getLongAt(2) == INT64_MIN);
+
+    NbtPushParser parser;
+    CHECK(parser.feed(data.data(), data.size()) == NbtPushParser::COMPLETE);
+    CHECK(parser.getRoot() != NULL && parser.getRoot()->toByteArray() == data);
+
+    // Copies own their values
+    TagLongArray copy(*longs);
+    copy.editValues()[0] = 5;
+    CHECK(longs->getValues()[0] == -1);
+
+    TagLongArray assigned("", NULL, 0);
+    assigned = copy;
+    copy.setValues(new int64_t[1] {9}, 1);
+    CHECK(assigned.getSize() == 3 && assigned.getValues()[0] == 5);
+
+    TagLongArray moved(std::move(assigned));
+    CHECK(moved.getSize() == 3 && moved.getValues()[1] == values[1]);
+}
+
+
+void checkPackedList()
+{
+    const double values[4] = {0.5, -1.0, 1e300, 3.0};
+    TagList doubles(TAG_DOUBLE, "doubles");
+    doubles.setValues(values, 4);
+    CHECK(doubles.isPacked() && doubles.size() == 4);
+
+    TagCompound root("");
+    root.insert(doubles);
+    ByteArray data = root.toByteArray();
+
+    // Decoded lists come back packed, with the same values
+    NbtBuffer buffer;
+    CHECK(buffer.read(data.data(), data.size()));
+    const TagCompound *read = static_cast<const TagCompound *>(buffer.getRoot());
+    const TagList *list = read ? read->getValueAt<TagList>("doubles") : NULL;
+    CHECK(list != NULL && list->isPacked());
+    if (list == NULL)
+        return;
+
+    ArrayView<double> view = list->getDoubles();
+    CHECK(view.size() == 4 && std::equal(view.begin(), view.end(), values));
+
+    // Reading element tags leaves a const list packed
+    const TagDouble *third = static_cast<const TagDouble *>(list->at(2));
+    CHECK(third->getValue() == 1e300);
+    CHECK(list->at(2) == third && list->back() == list->at(3));
+    CHECK(list->getValue().size() == 4);
+    CHECK(list->isPacked());
+    CHECK(read->toByteArray() == data);
+
+    // A non-const one hands out real children and packs back the same
+    TagList *edited = static_cast<TagCompound *>(buffer.getRoot())->getValueAt<TagList>("doubles");
+    static_cast<TagDouble *>(edited->at(0))->setValue(8.0);
+    CHECK(!edited->isPacked());
+    CHECK(static_cast<const TagDouble *>(static_cast<const TagList *>(edited)->at(0))->getValue() == 8.0);
+    edited->pack();
+    CHECK(edited->isPacked() && edited->getDoubles()[0] == 8.0);
+
+    // Changes to the values reach elements read afterwards
+    edited->append(TagDouble("", 4.0));
+    edited->remove(static_cast<size_t>(1));
+    const TagList *constEdited = edited;
+    CHECK(constEdited->size() == 4);
+    CHECK(static_cast<const TagDouble *>(constEdited->at(1))->getValue() == 1e300);
+    CHECK(static_cast<const TagDouble *>(constEdited->back())->getValue() == 4.0);
+    CHECK(edited->isPacked());
+}
+
+
+// Compound of count TagInts named k0, k1, ..., each holding its number
+TagCompound makeKeys(int count)
+{
+    TagCompound ret("keys");
+    for (int i = 0; i < count; ++i)
+    {
+        std::stringstream key;
+        key << "k" << i;
+        ret.insert(TagInt(key.str(), i));
+    }
+
+    return ret;
+}
+
+
+// Every key of compound is found, in insertion order, through each key
+// type, and keys it does not have are not
+bool lookupsMatch(const TagCompound &compound, int count)
+{
+    std::vector<std::string> keys = compound.getKeys();
+    if (keys.size() != static_cast<size_t>(count))
+        return false;
+
+    for (int i = 0; i < count; ++i)
+    {
+        std::stringstream key;
+        key << "k" << i;
+        std::string name = key.str();
+
+        if (keys[i] != name || compound.getInt(name) != i
+            || compound.getInt(name.c_str()) != i
+            || compound.getValueAt<TagInt>(StringView(name))->getValue() != i)
+            return false;
+    }
+
+    return !compound.hasKey("k") && !compound.hasKey("K0")
+        && !compound.hasKey(StringView("k0\0", 3)) && !compound.hasKey("missing");
+}
+
+
+void checkCompoundLookup()
+{
+    // Either side of the size at which lookups switch to the index
+    const int sizes[] = {0, 1, 15, 16, 17, 18, 33, 64, 200};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        CHECK(lookupsMatch(makeKeys(sizes[i]), sizes[i]));
+
+    // Replacing keeps the place of the key, removing keeps the order
+    TagCompound compound = makeKeys(40);
+    compound.insert(TagInt("k20", 20));
+    CHECK(lookupsMatch(compound, 40));
+    for (int i = 39; i >= 10; --i)
+    {
+        std::stringstream key;
+        key << "k" << i;
+        compound.remove(key.str());
+        if (i == 17 || i == 16 || i == 10)
+            CHECK(lookupsMatch(compound, i));
+    }
+
+    // And grows back past the threshold
+    TagCompound grown = makeKeys(10);
+    for (int i = 10; i < 30; ++i)
+    {
+        std::stringstream key;
+        key << "k" << i;
+        grown.insert(TagInt(key.str(), i));
+    }
+    CHECK(lookupsMatch(grown, 30));
+
+    // Decoded compounds and copies are indexed the same
+    ByteArray data = makeKeys(100).toByteArray();
+    NbtBuffer buffer;
+    CHECK(buffer.read(data.data(), data.size()));
+    CHECK(lookupsMatch(*static_cast<const TagCompound *>(buffer.getRoot()), 100));
+    TagCompound copy = *static_cast<const TagCompound *>(buffer.getRoot());
+    copy.remove("k0");
+    CHECK(lookupsMatch(*static_cast<const TagCompound *>(buffer.getRoot()), 100));
+    CHECK(copy.getKeys().size() == 99 && copy.getInt("k99") == 99);
+}
+
+
+void checkStringPool()
+{
+    // One entry per distinct string, with the hash lookups use
+    InternedString a = NbtStringPool::intern("pooled-a");
+    InternedString again = NbtStringPool::intern(std::string("pooled-a"));
+    InternedString b = NbtStringPool::intern("pooled-b");
+    CHECK(a.data() == again.data() && a.getId() == again.getId() && a.getId() != 0);
+    CHECK(a.getId() != b.getId() && a != b);
+    CHECK(a.getHash() == NbtStringPool::hash("pooled-a") && a.str() == "pooled-a");
+    CHECK(NbtStringPool::intern("").getId() == 0 && NbtStringPool::intern("").empty());
+
+    // Names share the pooled characters
+    TagInt first("pooled-name", 1);
+    TagCompound second("pooled-name");
+    CHECK(first.getInternedName().data() == second.getInternedName().data());
+
+    // Decoded string values only when asked to
+    TagCompound root("");
+    root.insert(TagString("s", "pooled-value"));
+    root.insert(TagString("t", "pooled-value"));
+    ByteArray data = root.toByteArray();
+
+    NbtBuffer buffer;
+    CHECK(buffer.read(data.data(), data.size()));
+    const TagCompound *read = static_cast<const TagCompound *>(buffer.getRoot());
+    CHECK(!read->getValueAt<TagString>("s")->isInterned());
+
+    buffer.setInternStrings(true);
+    CHECK(buffer.read(data.data(), data.size()));
+    read = static_cast<const TagCompound *>(buffer.getRoot());
+    const TagString *s = read->getValueAt<TagString>("s");
+    const TagString *t = read->getValueAt<TagString>("t");
+    CHECK(s->isInterned() && t->isInterned());
+    CHECK(s->getInternedValue().data() == t->getInternedValue().data());
+    CHECK(read->toByteArray() == data);
+
+    // Past the limit strings become private copies that still compare equal
+    size_t limit = NbtStringPool::getLimit();
+    NbtStringPool::setLimit(NbtStringPool::getBytesAllocated());
+    size_t count = NbtStringPool::getCount();
+    InternedString over = NbtStringPool::intern("pooled-over-the-limit");
+    InternedString overAgain = NbtStringPool::intern("pooled-over-the-limit");
+    CHECK(over.getId() == 0 && over == overAgain && over.str() == "pooled-over-the-limit");
+    CHECK(NbtStringPool::getCount() == count);
+    CHECK(NbtStringPool::intern("pooled-a").data() == a.data());
+    NbtStringPool::setLimit(limit);
+
+    // Threads interning the same strings agree on them
+    std::vector<uint32_t> ids[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        std::vector<uint32_t> *out = &ids[i];
+        threads.push_back(std::thread([out]()
+        {
+            for (int j = 0; j < 500; ++j)
+            {
+                std::stringstream str;
+                str << "pooled-thread-" << j;
+                out->push_back(NbtStringPool::intern(str.str()).getId());
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    CHECK(ids[0] == ids[1] && ids[0] == ids[2] && ids[0] == ids[3]);
+}
+
+
+// Chunk-like tree: a Level with sections and entities, beside a version
+TagCompound makeLevel()
+{
+    TagCompound level("Level");
+    level.insert(TagInt("xPos", 3));
+
+    TagList sections(TAG_COMPOUND, "Sections");
+    for (int y = 0; y < 4; ++y)
+    {
+        TagCompound section("");
+        section.insert(TagByte("Y", y));
+        unsigned char *blocks = new unsigned char[4096];
+        memset(blocks, y, 4096);
+        section.insert(TagByteArray("Blocks", blocks, 4096));
+        sections.append(section);
+    }
+    level.insert(sections);
+
+    TagList entities(TAG_COMPOUND, "Entities");
+    TagCompound entity("");
+    entity.insert(TagString("id", "pig"));
+    entities.append(entity);
+    level.insert(entities);
+
+    TagCompound root("");
+    root.insert(level);
+    root.insert(TagInt("DataVersion", 1343));
+    return root;
+}
+
+
+// data read through buffer with only paths selected
+const TagCompound *readPaths(NbtBuffer &buffer, ByteArray data, const NbtPathSet &paths)
+{
+    if (!buffer.read(data.data(), data.size(), paths))
+        return NULL;
+
+    return static_cast<const TagCompound *>(buffer.getRoot());
+}
+
+
+void checkPathFilter()
+{
+    ByteArray data = makeLevel().toByteArray();
+    NbtBuffer buffer;
+
+    // Every Y and the version; the way there holds nothing else
+    const TagCompound *root = readPaths(buffer, data, {"Level.Sections[*].Y", "DataVersion"});
+    CHECK(root != NULL);
+    if (root == NULL)
+        return;
+
+    CHECK(root->getKeys().size() == 2 && root->getInt("DataVersion") == 1343);
+    const TagCompound *level = root->getValueAt<TagCompound>("Level");
+    CHECK(level != NULL && level->getKeys() == std::vector<std::string>(1, "Sections"));
+    const TagList *sections = level ? level->getValueAt<TagList>("Sections") : NULL;
+    CHECK(sections != NULL && sections->size() == 4);
+    bool onlyY = sections != NULL;
+    for (size_t i = 0; onlyY && i < sections->size(); ++i)
+    {
+        const TagCompound *section = static_cast<const TagCompound *>(sections->at(i));
+        onlyY = section->getKeys().size() == 1
+            && section->getValueAt<TagByte>("Y")->getValue() == (int8_t)i;
+    }
+    CHECK(onlyY);
+
+    // A selected subtree comes whole, other list elements not at all
+    root = readPaths(buffer, data, {"Level.Sections[2]", "Level.Entities"});
+    level = root ? root->getValueAt<TagCompound>("Level") : NULL;
+    sections = level ? level->getValueAt<TagList>("Sections") : NULL;
+    CHECK(sections != NULL && sections->size() == 1);
+    if (sections != NULL && sections->size() == 1)
+    {
+        const TagCompound *section = static_cast<const TagCompound *>(sections->at(0));
+        CHECK(section->getValueAt<TagByte>("Y")->getValue() == 2);
+        CHECK(section->getValueAt<TagByteArray>("Blocks")->getSize() == 4096);
+    }
+    CHECK(level != NULL && level->getValueAt<TagList>("Entities")->size() == 1);
+    CHECK(level != NULL && !level->hasKey("xPos"));
+
+    // Paths that select nothing leave an empty root
+    root = readPaths(buffer, data, {"Level.Missing", "DataVersion.Deeper", "Level.Sections[9]"});
+    level = root ? root->getValueAt<TagCompound>("Level") : NULL;
+    CHECK(root != NULL && !root->hasKey("DataVersion"));
+    CHECK(level == NULL || level->getValueAt<TagList>("Sections") == NULL
+          || level->getValueAt<TagList>("Sections")->size() == 0);
+
+    // The same through NbtFile
+    char path[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(data, path));
+    try
+    {
+        NbtFile file(path);
+        file.read(NbtPathSet {"Level.xPos"});
+        const TagCompound *fileRoot = static_cast<const TagCompound *>(file.getRoot());
+        CHECK(fileRoot->getKeys().size() == 1);
+        CHECK(fileRoot->getValueAt<TagCompound>("Level")->getInt("xPos") == 3);
+    }
+    catch (const GzipIOException &)
+    {
+        CHECK(!"NbtFile::read(paths) failed");
+    }
+    unlink(path);
+
+    // Malformed paths are rejected up front
+    const char *bad[] = {"", ".a", "a.", "a..b", "a[", "a[]", "a[x]", "a[-1]", "[0]", "a[0]b"};
+    int rejected = 0;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    {
+        try
+        {
+            NbtPathSet paths;
+            paths.add(bad[i]);
+        }
+        catch (const InvalidPathException &)
+        {
+            ++rejected;
+        }
+    }
+    CHECK(rejected == sizeof(bad) / sizeof(bad[0]));
+}
+
+
+// Writes each event as a line, and skips or stops at the named containers
+class RecordingVisitor : public NbtVisitor
+{
+    public:
+        RecordingVisitor(const std::string &skip = "", const std::string &stop = "")
+            : skip(skip), stop(stop) {}
+
+        std::string events;
+
+        virtual Action onBeginCompound(const StringView &name)
+        {
+            return begin("compound " + name.str(), name);
+        }
+
+        virtual void onEndCompound() { events += "end compound\n"; }
+
+        virtual Action onBeginList(const StringView &name, uint8_t childType, int32_t size)
+        {
+            std::stringstream str;
+            str << "list " << name.str() << " " << (int)childType << " " << size;
+            return begin(str.str(), name);
+        }
+
+        virtual void onEndList() { events += "end list\n"; }
+
+        virtual void onByte(const StringView &name, int8_t value) { add("byte", name, (int)value); }
+        virtual void onShort(const StringView &name, int16_t value) { add("short", name, value); }
+        virtual void onInt(const StringView &name, int32_t value) { add("int", name, value); }
+        virtual void onLong(const StringView &name, int64_t value) { add("long", name, value); }
+        virtual void onFloat(const StringView &name, float value) { add("float", name, value); }
+        virtual void onDouble(const StringView &name, double value) { add("double", name, value); }
+
+        virtual void onString(const StringView &name, const StringView &value)
+        {
+            add("string", name, value.str());
+        }
+
+        virtual void onByteArray(const StringView &name, const ArrayView<uint8_t> &values)
+        {
+            add("bytes", name, values.size() == 1 ? (int)values[0] : -1);
+        }
+
+        virtual void onIntArray(const StringView &name, const ArrayView<int32_t> &values)
+        {
+            add("ints", name, values.size() == 2 ? values[0] + values[1] : -1);
+        }
+
+        virtual void onLongArray(const StringView &name, const ArrayView<int64_t> &values)
+        {
+            add("longs", name, values.size() == 1 ? values[0] : -1);
+        }
+
+    private:
+        Action begin(const std::string &event, const StringView &name)
+        {
+            events += event + "\n";
+            if (!skip.empty() && name == StringView(skip))
+                return SKIP;
+            if (!stop.empty() && name == StringView(stop))
+                return STOP;
+            return CONTINUE;
+        }
+
+        template <typename T>
+        void add(const char *type, const StringView &name, const T &value)
+        {
+            std::stringstream str;
+            str << type << " " << name.str() << " " << value << "\n";
+            events += str.str();
+        }
+
+        std::string skip;
+        std::string stop;
+};
+
+
+void checkVisitor()
+{
+    TagCompound root("root");
+    root.insert(TagByte("b", -3));
+    TagList shorts(TAG_SHORT, "l");
+    shorts.append(TagShort("", 10));
+    shorts.append(TagShort("", 11));
+    root.insert(shorts);
+    TagCompound inner("c");
+    inner.insert(TagString("s", "x y"));
+    inner.insert(TagLong("L", -5));
+    root.insert(inner);
+    root.insert(TagFloat("f", 0.5f));
+    root.insert(TagDouble("d", 0.25));
+    root.insert(TagByteArray("ba", new unsigned char[1] {9}, 1));
+    root.insert(TagIntArray("ia", new int32_t[2] {3, 4}, 2));
+    root.insert(TagLongArray("la", new int64_t[1] {1LL << 40}, 1));
+    TagList nested(TAG_LIST, "n");
+    nested.append(TagList(TAG_INT, ""));
+    root.insert(nested);
+    root.insert(TagInt("i", 6));
+    ByteArray data = root.toByteArray();
+
+    const std::string all =
+        "compound root\n"
+        "byte b -3\n"
+        "list l 2 2\nshort  10\nshort  11\nend list\n"
+        "compound c\nstring s x y\nlong L -5\nend compound\n"
+        "float f 0.5\n"
+        "double d 0.25\n"
+        "bytes ba 9\n"
+        "ints ia 7\n"
+        "longs la 1099511627776\n"
+        "list n 9 1\nlist  3 0\nend list\nend list\n"
+        "int i 6\n"
+        "end compound\n";
+
+    NbtBuffer buffer;
+    RecordingVisitor visitor;
+    CHECK(buffer.visit(data.data(), data.size(), visitor));
+    CHECK(visitor.events == all);
+
+    // Skipped containers get no further events, stopping ends the walk
+    RecordingVisitor skipping("c");
+    CHECK(buffer.visit(data.data(), data.size(), skipping));
+    CHECK(skipping.events.find("compound c\nfloat f") != std::string::npos);
+    CHECK(skipping.events.find("string s") == std::string::npos);
+
+    RecordingVisitor stopping("", "l");
+    CHECK(buffer.visit(data.data(), data.size(), stopping));
+    CHECK(stopping.events == "compound root\nbyte b -3\nlist l 2 2\n");
+
+    // Files stream the same events, cut data fails the walk
+    char path[] = "/tmp/nbttest-XXXXXX";
+    CHECK(writeTempFile(compress(data, NbtCodec(NbtCodec::GZIP)), path));
+    RecordingVisitor fromFile;
+    try
+    {
+        NbtFile file(path);
+        file.visit(fromFile);
+    }
+    catch (const GzipIOException &)
+    {
+        CHECK(!"NbtFile::visit() failed");
+    }
+    CHECK(fromFile.events == all);
+    unlink(path);
+
+    RecordingVisitor cut;
+    ByteArray part(data.begin(), data.begin() + data.size() / 2);
+    CHECK(!buffer.visit(part.data(), part.size(), cut));
+    CHECK(cut.events.size() < all.size());
+}
+
+
+void checkInflate()
+{
+    // Compresses over a hundredfold, far past any ratio estimate
+    TagCompound root("inflate");
+    root.insert(TagByteArray("zeros", new unsigned char[1 << 20](), 1 << 20));
+    root.insert(TagString("after", "tail"));
+    ByteArray data = root.toByteArray();
+
+    ByteArray gz = compress(data, NbtCodec(NbtCodec::GZIP));
+    ByteArray zlib = compress(data, NbtCodec(NbtCodec::ZLIB));
+    CHECK(gz.size() * 100 < data.size());
+
+    NbtBuffer buffer;
+    CHECK(buffer.read(gz.data(), gz.size()));
+    CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == data);
+    CHECK(buffer.read(zlib.data(), zlib.size()));
+    CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == data);
+
+    // Size hints only size the first buffer, wrong ones still work
+    const size_t hints[3] = {1, data.size(), 64 << 20};
+    for (int i = 0; i < 3; ++i)
+    {
+        buffer.setSizeHint(hints[i]);
+        CHECK(buffer.getSizeHint() == hints[i]);
+        CHECK(buffer.read(zlib.data(), zlib.size()));
+        CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == data);
+    }
+    buffer.setSizeHint(0);
+
+    ByteArray inflated;
+    size_t size = 0;
+    const uint8_t *out = NbtCodec(NbtCodec::ZLIB).decompress(zlib.data(), zlib.size(), inflated, size, 16);
+    CHECK(out != NULL && size == data.size() && memcmp(out, data.data(), size) == 0);
+
+    // A small tree after a big one on the same thread
+    ByteArray small = makeKeys(3).toByteArray();
+    ByteArray smallGz = compress(small, NbtCodec(NbtCodec::GZIP));
+    CHECK(buffer.read(smallGz.data(), smallGz.size()));
+    CHECK(buffer.getRoot() != NULL && buffer.getRoot()->toByteArray() == small);
+
+    // Cut or corrupted streams fail instead of handing out a tree
+    ByteArray cut(gz.begin(), gz.begin() + gz.size() / 2);
+    CHECK(!buffer.read(cut.data(), cut.size()) && buffer.getRoot() == NULL);
+
+    ByteArray badCrc = gz;
+    badCrc[badCrc.size() - 8] ^= 0xff;
+    CHECK(!buffer.read(badCrc.data(), badCrc.size()));
+
+    ByteArray badAdler = zlib;
+    badAdler[zlib.size() - 1] ^= 0x55;
+    CHECK(!buffer.read(badAdler.data(), badAdler.size()));
+}
+
+
+void checkCodec()
+{
+    TagCompound *every = makeEveryType();
+    every->insert(makeLevel());
+    ByteArray data = every->toByteArray();
+    CHECK(NbtCodec::sniff(data.data(), data.size()) == NbtCodec::NONE);
+
+    // Every format and strategy sniffs back to itself and reads back
+    const NbtCodec::Format formats[4] = {NbtCodec::NONE, NbtCodec::ZLIB, NbtCodec::GZIP, NbtCodec::RAW};
+    const int strategies[5] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+    bool sniffed = true, read = true;
+    for (int f = 0; f < 4; ++f)
+    {
+        for (int level = 0; level <= 9; level += 3)
+        {
+            for (int s = 0; s < 5; ++s)
+            {
+                NbtCodec codec(formats[f], level, strategies[s]);
+                unsigned long length;
+                char *out = NbtBuffer().write(every, length, codec);
+                if (out == NULL)
+                {
+                    read = false;
+                    continue;
+                }
+
+                uint8_t *bytes = reinterpret_cast<uint8_t *>(out);
+                sniffed = sniffed && NbtCodec::sniff(bytes, length) == formats[f];
+
+                NbtBuffer buffer;
+                read = read && buffer.read(bytes, length)
+                    && buffer.getRoot()->toByteArray() == data;
+                delete[] out;
+            }
+        }
+    }
+    CHECK(sniffed);
+    CHECK(read);
+
+    // Levels trade size as zlib does
+    NbtCodec fast(NbtCodec::ZLIB, 1), best(NbtCodec::ZLIB, 9), stored(NbtCodec::ZLIB, 0);
+    CHECK(compress(data, best).size() <= compress(data, fast).size());
+    CHECK(compress(data, stored).size() > data.size());
+    CHECK(compress(data, stored).size() <= stored.bound(data.size()));
+    CHECK(best.getLevel() == 9 && best.getFormat() == NbtCodec::ZLIB);
+
+    // NbtFile writes with its codec and sniffs it back when reading
+    for (int f = 0; f < 4; ++f)
+    {
+        char path[] = "/tmp/nbttest-XXXXXX";
+        CHECK(writeTempFile(ByteArray(), path));
+        try
+        {
+            NbtFile file;
+            file.setCodec(NbtCodec(formats[f], 6, Z_FILTERED));
+            CHECK(file.getCodec().getStrategy() == Z_FILTERED);
+            file.open(path, "w");
+            file.setRoot(*every);
+            file.write();
+        }
+        catch (const GzipIOException &)
+        {
+            CHECK(!"NbtFile::write() failed");
+        }
+
+        Tag *back = readFile(path);
+        CHECK(back != NULL && back->toByteArray() == data);
+        delete back;
+        unlink(path);
+    }
+
+    delete every;
+}
+
+
+// Region holding payload for chunk (x, z) at sector 2, as count sectors
+// with length as the length field; header entries for the other chunks
+// are left empty
+ByteArray makeRegion(int x, int z, const ByteArray &payload, uint8_t count,
+                     uint32_t length, uint8_t compression)
+{
+    ByteArray ret(RegionFile::HEADER_SIZE + count * RegionFile::SECTOR_SIZE);
+    size_t entry = ((x & 31) + (z & 31) * 32) * 4;
+    const uint8_t location[4] = {0, 0, 2, count};
+    const uint8_t timestamp[4] = {0x12, 0x34, 0x56, 0x78};
+    memcpy(&ret[entry], location, 4);
+    memcpy(&ret[RegionFile::SECTOR_SIZE + entry], timestamp, 4);
+
+    uint8_t *chunk = &ret[RegionFile::HEADER_SIZE];
+    const uint8_t header[5] = {
+        static_cast<uint8_t>(length >> 24), static_cast<uint8_t>(length >> 16),
+        static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length), compression
+    };
+    memcpy(chunk, header, 5);
+    memcpy(chunk + 5, payload.data(), std::min(payload.size(), ret.size() - RegionFile::HEADER_SIZE - 5));
+    return ret;
+}
+
+
+// region written to a temporary file, then opened; false when opening
+// throws
+bool openRegion(const ByteArray &region, RegionFile &file)
+{
+    char path[] = "/tmp/nbttest-XXXXXX";
+    if (!writeTempFile(region, path))
+        return false;
+
+    bool ok = true;
+    try
+    {
+        file.open(path);
+    }
+    catch (const RegionIOException &)
+    {
+        ok = false;
+    }
+
+    // The mapping outlives the name
+    unlink(path);
+    return ok;
+}
+
+
+void checkRegionRead()
+{
+    TagCompound chunk = makeLevel();
+    ByteArray zlib = compress(chunk.toByteArray(), NbtCodec(NbtCodec::ZLIB));
+    uint32_t length = zlib.size() + 1;
+    uint8_t sectors = (length + 4 + RegionFile::SECTOR_SIZE - 1) / RegionFile::SECTOR_SIZE;
+
+    RegionFile region;
+    CHECK(!region.isOpen());
+    CHECK(openRegion(makeRegion(3, 5, zlib, sectors, length, RegionFile::COMPRESSION_ZLIB), region));
+    CHECK(region.isOpen());
+    CHECK(region.hasChunk(3, 5) && !region.hasChunk(5, 3) && !region.hasChunk(0, 0));
+    CHECK(region.getSectorOffset(3, 5) == 2 && region.getSectorCount(3, 5) == sectors);
+    CHECK(region.getTimestamp(3, 5) == 0x12345678);
+    CHECK(region.getCompression(3, 5) == RegionFile::COMPRESSION_ZLIB);
+    CHECK(region.getChunkData(3, 5).size() == zlib.size());
+
+    // Coordinates are taken within the region, as world chunk positions
+    CHECK(region.hasChunk(3 + 32, 5 - 64) && region.hasChunk(-29, -27));
+
+    NbtBuffer buffer;
+    CHECK(region.readChunk(3, 5, buffer) && buffer.getRoot()->toByteArray() == chunk.toByteArray());
+    CHECK(!region.readChunk(0, 0, buffer));
+
+    // Short files, bad header entries and bad payloads read as missing
+    const size_t shortSizes[3] = {0, 100, RegionFile::HEADER_SIZE - 1};
+    for (int i = 0; i < 3; ++i)
+    {
+        ByteArray whole = makeRegion(0, 0, zlib, sectors, length, 2);
+        RegionFile cut;
+        CHECK(openRegion(ByteArray(whole.begin(), whole.begin() + shortSizes[i]), cut));
+        CHECK(!cut.hasChunk(0, 0) && cut.getChunkData(0, 0).empty() && !cut.readChunk(0, 0, buffer));
+    }
+
+    struct
+    {
+        uint8_t count;
+        uint32_t length;
+        uint8_t compression;
+        size_t cut;
+    } bad[] = {
+        {sectors, length, 2, RegionFile::HEADER_SIZE + 3},  // payload past the end of the file
+        {sectors, length, 2, RegionFile::HEADER_SIZE + length},  // ends one byte short
+        {sectors, 0, 2, 0},  // no compression byte
+        {sectors, sectors * RegionFile::SECTOR_SIZE - 3, 2, 0},  // longer than its sectors
+        {sectors, length, 0x82, 0},  // kept in an external file
+        {sectors, length / 2, 2, 0}  // inflates only halfway
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    {
+        ByteArray image = makeRegion(1, 1, zlib, bad[i].count, bad[i].length, bad[i].compression);
+        if (bad[i].cut != 0)
+            image.resize(bad[i].cut);
+
+        RegionFile file;
+        NbtBuffer fresh;
+        CHECK(openRegion(image, file));
+        if (i < 5)
+            CHECK(file.getChunkData(1, 1).empty());
+        CHECK(!file.readChunk(1, 1, fresh) && fresh.getRoot() == NULL);
+    }
+
+    // A header entry before the header itself
+    ByteArray image = makeRegion(1, 1, zlib, sectors, length, 2);
+    image[(1 + 32) * 4 + 2] = 1;
+    RegionFile early;
+    CHECK(openRegion(image, early));
+    CHECK(early.getChunkData(1, 1).empty());
+
+    RegionFile missing;
+    bool threw = false;
+    try
+    {
+        missing.open("/nonexistent/r.0.0.mca");
+    }
+    catch (const RegionIOException &)
+    {
+        threw = true;
+    }
+    CHECK(threw && !missing.isOpen());
+}
+
+
+void checkDecodePool()
+{
+    NbtDecodePool pool(3);
+    CHECK(pool.getThreadCount() == 3);
+    CHECK(NbtDecodePool().getThreadCount() >= 1);
+
+    // Mixed codecs decode into their own slots, a corrupt one to NULL
+    std::vector<ByteArray> inputs;
+    std::vector<ByteArray> expected;
+    const NbtCodec codecs[3] = {NbtCodec(NbtCodec::GZIP), NbtCodec(NbtCodec::ZLIB), NbtCodec(NbtCodec::NONE)};
+    for (int i = 0; i < 40; ++i)
+    {
+        ByteArray data = makeKeys(i).toByteArray();
+        expected.push_back(data);
+        inputs.push_back(compress(data, codecs[i % 3]));
+    }
+    inputs[17].resize(inputs[17].size() / 2);
+
+    std::vector<ArrayView<uint8_t> > buffers;
+    for (size_t i = 0; i < inputs.size(); ++i)
+        buffers.push_back(ArrayView<uint8_t>(inputs[i].data(), inputs[i].size()));
+
+    std::vector<Tag *> roots = pool.decode(buffers);
+    bool matched = roots.size() == inputs.size();
+    for (size_t i = 0; matched && i < roots.size(); ++i)
+        matched = i == 17 ? roots[i] == NULL : roots[i] != NULL && roots[i]->toByteArray() == expected[i];
+    CHECK(matched);
+    for (size_t i = 0; i < roots.size(); ++i)
+        delete roots[i];
+
+    // Each buffer is called back once, possibly from several threads
+    std::mutex lock;
+    std::vector<int> calls(buffers.size());
+    pool.decode(buffers, [&](size_t index, Tag *root)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ++calls[index];
+        delete root;
+    });
+    CHECK(std::count(calls.begin(), calls.end(), 1) == (int)calls.size());
+
+    // The first exception of a batch comes out of run() once every job ran
+    std::atomic<int> ran(0);
+    bool caught = false;
+    try
+    {
+        pool.run(100, [&](size_t i)
+        {
+            ++ran;
+            if (i == 7)
+                throw std::runtime_error("job 7");
+        });
+    }
+    catch (const std::runtime_error &e)
+    {
+        caught = std::string(e.what()) == "job 7";
+    }
+    CHECK(caught && ran == 100);
+
+    caught = false;
+    try
+    {
+        pool.decode(buffers, [](size_t index, Tag *root)
+        {
+            delete root;
+            if (index == 3)
+                throw std::logic_error("callback");
+        });
+    }
+    catch (const std::logic_error &)
+    {
+        caught = true;
+    }
+    CHECK(caught);
+
+    // Jobs may run batches of their own, which then run inline
+    std::atomic<int> inner(0);
+    pool.run(6, [&](size_t)
+    {
+        pool.run(5, [&](size_t) { ++inner; });
+    });
+    CHECK(inner == 30);
+
+    // Batches from several threads take turns
+    std::atomic<int> total(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(std::thread([&]()
+        {
+            for (int r = 0; r < 10; ++r)
+                pool.run(20, [&](size_t) { ++total; });
+        }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    CHECK(total == 4 * 10 * 20);
+
+    // Every chunk of a region, with its coordinates
+    ByteArray zlib = compress(makeLevel().toByteArray(), NbtCodec(NbtCodec::ZLIB));
+    RegionFile region;
+    CHECK(openRegion(makeRegion(4, 9, zlib, 16, zlib.size() + 1, 2), region));
+    int chunks = 0;
+    pool.decode(region, [&](int x, int z, Tag *root)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        chunks += x == 4 && z == 9 && root != NULL ? 1 : 100;
+        delete root;
+    });
+    CHECK(chunks == 1);
+}
+
+
+// Touches every value below view, as a reader of a corrupt image might
+size_t walkImage(const NbtImageView &view)
+{
+    size_t visited = 1 + view.getName().size() + view.getString().size() + view.getByteArray().size()
+        + view.getIntArray().size() + view.getLongArray().size() + view.getShorts().size();
+    for (size_t i = 0; i < view.size() && i < 1000; ++i)
+        visited += walkImage(view.at(i));
+    return visited;
+}
+
+
+// Attaches length bytes of image, with its header size patched to match
+// when resize is set, and reads the tree back; NULL when either fails
+Tag *readImage(const ByteArray &image, size_t length, bool resize, bool &attached)
+{
+    std::vector<uint64_t> aligned((image.size() + 7) / 8);
+    memcpy(aligned.data(), image.data(), image.size());
+    if (resize)
+    {
+        uint32_t size = length;
+        memcpy(reinterpret_cast<uint8_t *>(aligned.data()) + 8, &size, sizeof(size));
+    }
+
+    NbtImage loaded;
+    attached = loaded.attach(aligned.data(), length);
+    if (!attached)
+        return NULL;
+
+    walkImage(loaded.getRoot());
+    return loaded.getRoot().toTag();
+}
+
+
+// The error code NbtImage::open() throws for fname, 0 if it opens
+int imageError(const std::string &fname)
+{
+    NbtImage image;
+    try
+    {
+        image.open(fname);
+    }
+    catch (ImageIOException &e)
+    {
+        return image.isValid() ? -1 : e.getCode();
+    }
+    return 0;
+}
+
+
+void checkImage()
+{
+    TagCompound *every = makeEveryType();
+    ByteArray image = NbtImage::compile(*every);
+    CHECK(!image.empty());
+
+    // Compound entries come back in key order, so compare images
+    bool attached;
+    Tag *root = readImage(image, image.size(), false, attached);
+    CHECK(root != NULL && NbtImage::compile(*root) == image);
+    delete root;
+
+    std::vector<uint64_t> aligned((image.size() + 7) / 8);
+    memcpy(aligned.data(), image.data(), image.size());
+    NbtImage loaded;
+    CHECK(loaded.attach(aligned.data(), image.size()));
+    NbtImageView view = loaded.getRoot();
+    CHECK(view.getName() == "every" && view.getInt("int") == -70000 && view.getString("string") == "\xc3\xa9t\xc3\xa9");
+    CHECK(view["shorts"].getShorts().size() == 5 && view["shorts"][0].getShort() == -2);
+    CHECK(view["lists"][1].getShorts()[4] == 2 && view["lists"][0].size() == 0);
+
+    // Missing keys, wrong types and indexes past the end read as empty
+    CHECK(!view["missing"].isValid() && view.getInt("missing") == 0 && !view.hasKey("missing"));
+    CHECK(view.getInt("string") == 0 && view["int"].getString().empty());
+    CHECK(view["ints"].getLongArray().empty() && view["shorts"].getInts().empty());
+    CHECK(!view["shorts"].at(5).isValid() && !view.at(view.size()).isValid());
+    CHECK(!NbtImageView().isValid() && NbtImageView().toTag() == NULL);
+
+    // Headers that do not describe an image in this memory
+    CHECK(!loaded.attach(NULL, image.size()) && !loaded.isValid());
+    CHECK(!loaded.attach(reinterpret_cast<uint8_t *>(aligned.data()) + 4, image.size() - 4));
+    CHECK(!loaded.attach(aligned.data(), 31));
+    const size_t headerBytes[4] = {0, 3, 4, 6};  // magic, version, byte order
+    for (int i = 0; i < 4; ++i)
+    {
+        ByteArray bad = image;
+        bad[headerBytes[i]] ^= 0x5a;
+        Tag *tag = readImage(bad, bad.size(), false, attached);
+        CHECK(!attached && tag == NULL);
+    }
+    CHECK(readImage(image, image.size() - 1, false, attached) == NULL && !attached);
+
+    // Cut short with a matching header size: whatever lies past the cut
+    // reads as corrupt, never as empty values or off the end
+    bool cutsHeld = true;
+    for (size_t length = 0; length < image.size(); ++length)
+    {
+        Tag *tag = readImage(image, length, true, attached);
+        if (tag != NULL && NbtImage::compile(*tag) != image)
+            cutsHeld = false;
+        delete tag;
+    }
+    CHECK(cutsHeld);
+    CHECK(readImage(image, image.size() / 2, true, attached) == NULL);
+
+    // Any byte flipped: reads stay inside the image and trees that come
+    // back are whole
+    bool flipsHeld = true;
+    for (size_t i = 0; i < image.size(); ++i)
+    {
+        for (int bit = 0; bit < 8; bit += 3)
+        {
+            ByteArray bad = image;
+            bad[i] ^= 1 << bit;
+            Tag *tag = readImage(bad, bad.size(), false, attached);
+            if (tag != NULL)
+                flipsHeld = flipsHeld && tag->serializedSize() == tag->toByteArray().size();
+            delete tag;
+        }
+    }
+    CHECK(flipsHeld);
+
+    // Files that are missing, empty, truncated or not images at all
+    char path[] = "/tmp/cppnbt-image-XXXXXX";
+    CHECK(writeTempFile(ByteArray(), path));
+    NbtImage::compile(*every, path);
+    NbtImage fromFile(path);
+    CHECK(fromFile.isValid() && fromFile.getRoot().getLong("long") == 1LL << 40);
+    unlink(path);
+
+    CHECK(imageError("/nonexistent/image") == ENOENT);
+    strcpy(path, "/tmp/cppnbt-image-XXXXXX");
+    CHECK(writeTempFile(ByteArray(), path) && imageError(path) == EINVAL);
+    unlink(path);
+    strcpy(path, "/tmp/cppnbt-image-XXXXXX");
+    CHECK(writeTempFile(ByteArray(image.begin(), image.end() - 8), path) && imageError(path) == EINVAL);
+    unlink(path);
+    strcpy(path, "/tmp/cppnbt-image-XXXXXX");
+    CHECK(writeTempFile(every->toByteArray(), path) && imageError(path) == EINVAL);
+    unlink(path);
+
+    delete every;
+}
+
+
+// The error code NbtImage::openShared() throws for name, 0 if it opens
+int sharedError(const std::string &name)
+{
+    NbtImage image;
+    try
+    {
+        image.openShared(name);
+    }
+    catch (ImageIOException &e)
+    {
+        return image.isValid() ? -1 : e.getCode();
+    }
+    return 0;
+}
+
+
+void checkSharedImage()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/cppnbt-check-%d", (int)getpid());
+    NbtImage::unlinkShared(name);
+    CHECK(sharedError(name) == ENOENT);
+
+    TagCompound *every = makeEveryType();
+    NbtImage::publishShared(*every, name);
+
+    // Each attach maps the segment somewhere else and reads the same
+    NbtImage first;
+    NbtImage second;
+    first.openShared(name);
+    second.openShared(name);
+    CHECK(first.isValid() && second.isValid() && first.data() != second.data());
+    CHECK(first.size() == NbtImage::compile(*every).size());
+    CHECK(first.getRoot().getInt("int") == -70000 && second.getRoot()["longs"].getLongArray()[1] == 1LL << 50);
+    Tag *copy = second.getRoot().toTag();
+    CHECK(copy != NULL && NbtImage::compile(*copy) == NbtImage::compile(*every));
+    delete copy;
+
+    // Another process attaches by name alone
+    pid_t child = fork();
+    if (child == 0)
+    {
+        NbtImage image;
+        try
+        {
+            image.openShared(name);
+        }
+        catch (...)
+        {
+            _exit(2);
+        }
+        _exit(image.getRoot().getString("string") == "\xc3\xa9t\xc3\xa9" ? 0 : 1);
+    }
+    int status = -1;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Republishing leaves images already attached alone
+    every->edit<TagInt>("int")->setValue(5);
+    NbtImage::publishShared(*every, name);
+    NbtImage third;
+    third.openShared(name);
+    CHECK(first.getRoot().getInt("int") == -70000 && third.getRoot().getInt("int") == 5);
+
+    // So does unlinking, after which the name is gone
+    NbtImage::unlinkShared(name);
+    CHECK(sharedError(name) == ENOENT);
+    CHECK(third.getRoot().getInt("int") == 5 && second.getRoot().getShort("short") == 300);
+    first.close();
+    CHECK(!first.isValid() && first.getRoot().getInt("int") == 0);
+
+    // A segment that is empty, or still being filled, does not attach
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    CHECK(fd >= 0);
+    CHECK(sharedError(name) == EINVAL);
+
+    ByteArray image = NbtImage::compile(*every);
+    CHECK(ftruncate(fd, image.size()) == 0);
+    uint8_t *segment = static_cast<uint8_t *>(mmap(NULL, image.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+    CHECK(segment != MAP_FAILED);
+    memcpy(segment + 4, image.data() + 4, image.size() - 4);
+    CHECK(sharedError(name) == EINVAL);
+    memcpy(segment, image.data(), 4);
+    CHECK(sharedError(name) == 0);
+
+    munmap(segment, image.size());
+    NbtImage::unlinkShared(name);
+    delete every;
+}
+
+
+void checkOwnership()
+{
+    // Moves hand buffers and children over and leave the source empty
+    TagIntArray ints("ints", new int32_t[3] {1, 2, 3}, 3);
+    const int *values = static_cast<const TagIntArray &>(ints).getValues();
+    TagIntArray movedInts(std::move(ints));
+    CHECK(movedInts.getValues() == values && movedInts.getSize() == 3 && movedInts.getName() == "ints");
+    CHECK(ints.getSize() == 0);
+
+    TagString text("text", std::string(100, 'x'));
+    TagString movedText("other");
+    movedText = std::move(text);
+    CHECK(movedText.getValue() == std::string(100, 'x') && movedText.getName() == "text");
+
+    TagCompound *every = makeEveryType();
+    ByteArray expected = every->toByteArray();
+    const Tag *lists = static_cast<const TagCompound *>(every)->getValueAt("lists");
+    TagCompound movedEvery(std::move(*every));
+    CHECK(static_cast<const TagCompound &>(movedEvery).getValueAt("lists") == lists);
+    CHECK(movedEvery.toByteArray() == expected && every->getValue().empty());
+
+    // Moving over a compound that shares its children leaves the copy be
+    TagCompound shared = movedEvery;
+    TagCompound replacement("replacement");
+    replacement.insert(TagInt("only", 1));
+    movedEvery = std::move(replacement);
+    CHECK(shared.toByteArray() == expected && movedEvery.getValue().size() == 1);
+    CHECK(replacement.getValue().empty() && movedEvery.getName() == "replacement");
+
+    // Moved-from tags take new contents as usual
+    every->insert(TagInt("again", 2));
+    CHECK(every->getValue().size() == 1 && every->getInt("again") == 2);
+    delete every;
+
+    TagList list(TAG_STRING, "list");
+    list.append(TagString("", "a"));
+    const Tag *first = static_cast<const TagList &>(list).at(0);
+    TagList movedList(TAG_END, "");
+    movedList = std::move(list);
+    CHECK(movedList.getChildType() == TAG_STRING && static_cast<const TagList &>(movedList).at(0) == first);
+    CHECK(list.size() == 0);
+
+    // Across arenas contents are copied, so neither side frees the other's
+    NbtArena arena;
+    TagByteArray *inArena;
+    {
+        NbtArena::Scope scope(&arena);
+        inArena = new TagByteArray("bytes", NbtArena::newArray<unsigned char>(4), 4);
+    }
+    TagByteArray onHeap(std::move(*inArena));
+    CHECK(inArena->inArena() && !onHeap.inArena() && onHeap.getSize() == 4);
+    CHECK(onHeap.getValues() != static_cast<const TagByteArray *>(inArena)->getValues());
+    Tag::destroy(inArena);
+
+    // Owning pointers go in as they are; rejected or replaced tags are freed
+    TagCompound owner("owner");
+    std::unique_ptr<Tag> child(new TagLong("long", 7));
+    Tag *raw = child.get();
+    owner.insert(std::move(child));
+    CHECK(child.get() == NULL && static_cast<const TagCompound &>(owner).getValueAt("long") == raw);
+    owner.insert(std::unique_ptr<Tag>(new TagShort("long", 8)));
+    CHECK(owner.getValue().size() == 1 && owner.getShort("long") == 8);
+    owner.insert(TagString("moved", std::string(50, 'y')));
+    CHECK(owner.getString("moved") == std::string(50, 'y'));
+
+    TagList doubles(TAG_DOUBLE, "doubles");
+    doubles.append(std::unique_ptr<Tag>(new TagDouble("", 1.5)));
+    doubles.append(std::unique_ptr<Tag>(new TagFloat("", 2.5f)));
+    doubles.append(TagDouble("", 3.5));
+    CHECK(doubles.size() == 2 && doubles.emplace<TagFloat>("", 1.0f) == NULL && doubles.size() == 2);
+
+    TagList compounds(TAG_COMPOUND, "compounds");
+    TagCompound *emplaced = compounds.emplace<TagCompound>("");
+    CHECK(emplaced != NULL && static_cast<const TagList &>(compounds).at(0) == emplaced);
+    TagInt *counter = owner.emplace<TagInt>("counter", 3);
+    CHECK(static_cast<const TagCompound &>(owner).getValueAt("counter") == counter);
+
+    // Buffers hand roots in and back out without copying
+    NbtBuffer buffer;
+    std::unique_ptr<Tag> root(new TagCompound("root"));
+    raw = root.get();
+    buffer.setRoot(std::move(root));
+    CHECK(buffer.getRoot() == raw);
+    buffer.setRoot(TagCompound("replaced"));
+    CHECK(buffer.getRoot()->getName() == "replaced");
+    std::unique_ptr<Tag> released(buffer.release());
+    CHECK(buffer.getRoot() == NULL && released->getName() == "replaced");
+
+    NbtFile file;
+    file.setRoot(std::move(released));
+    CHECK(released.get() == NULL && file.getRoot()->getName() == "replaced");
+}
+
+
+void checkCopyOnWrite()
+{
+    TagCompound *original = makeTree();
+    ByteArray before = original->toByteArray();
+
+    TagCompound *copy = static_cast<TagCompound *>(original->clone());
+    CHECK(copy->toByteArray() == before);
+
+    // Changes through the copy, at every depth, leave the original alone
+    copy->edit<TagInt>("count")->setValue(2);
+    copy->edit<TagCompound>("inner")->edit<TagDouble>("x")->setValue(-3.0);
+    copy->edit<TagList>("items")->edit<TagCompound>(2)->insert(TagByte("new", 1));
+    copy->edit<TagList>("ints")->removeLast();
+    copy->remove("name");
+
+    CHECK(original->toByteArray() == before);
+    CHECK(original->getValueAt<TagCompound>("inner")->getValueAt<TagDouble>("x")->getValue() == 1.5);
+    CHECK(copy->getValueAt<TagCompound>("inner")->getValueAt<TagDouble>("x")->getValue() == -3.0);
+    CHECK(copy->toByteArray() != before);
+
+    // And the other way around
+    ByteArray changed = copy->toByteArray();
+    original->edit<TagList>("items")->clear();
+    CHECK(copy->toByteArray() == changed);
+
+    delete original;
+    CHECK(copy->toByteArray() == changed);
+    delete copy;
+
+    // Plain accessors and setters must not reach through to a copy either
+    original = makeTree();
+    original->toByteArray();
+    copy = static_cast<TagCompound *>(original->clone());
+    copy->toByteArray();
+
+    original->getValueAt<TagInt>("count")->setValue(9);
+    original->getValueAt<TagCompound>("inner")->insert(TagByte("extra", 1));
+    static_cast<TagInt *>(original->getValueAt<TagList>("ints")->at(1))->setValue(77);
+    static_cast<TagCompound *>(copy->getValueAt<TagList>("items")->front())
+        ->insert(TagString("tag", "copy"));
+
+    CHECK(copy->getInt("count") == 1);
+    CHECK(!copy->getValueAt<TagCompound>("inner")->hasKey("extra"));
+    CHECK(original->getValueAt<TagCompound>("inner")->hasKey("extra"));
+    CHECK(static_cast<const TagInt *>(copy->getValueAt<TagList>("ints")->at(1))->getValue() == 1);
+    CHECK(!static_cast<TagCompound *>(original->getValueAt<TagList>("items")->at(0))->hasKey("tag"));
+    CHECK(original->toByteArray() == encodeUncached(*original));
+    CHECK(copy->toByteArray() == encodeUncached(*copy));
+
+    // A tag inserted from the original is a copy of it as well
+    copy->insert(*original->getValueAt("inner"));
+    original->getValueAt<TagCompound>("inner")->remove("extra");
+    CHECK(copy->getValueAt<TagCompound>("inner")->hasKey("extra"));
+    CHECK(copy->toByteArray() == encodeUncached(*copy));
+
+    delete copy;
+    delete original;
+}
+
+
+void checkEncodingCache()
+{
+    TagCompound *root = makeTree();
+    root->toByteArray();
+
+    // Setters on private tags reach every cached encoding above them
+    root->getValueAt<TagCompound>("inner")->getValueAt<TagLong>("id")->setValue(7);
+    CHECK(root->toByteArray() == encodeUncached(*root));
+
+    root->getValueAt<TagList>("items")->at(1)->setName("renamed");
+    CHECK(root->toByteArray() == encodeUncached(*root));
+
+    root->getValueAt<TagList>("ints")->at(3)->markDirty();
+    root->getValueAt<TagList>("ints")->append(TagInt("", -1));
+    CHECK(root->toByteArray() == encodeUncached(*root));
+
+    // A copy that changed and went away leaves exact bookkeeping behind
+    TagCompound *copy = static_cast<TagCompound *>(root->clone());
+    copy->edit<TagCompound>("inner")->insert(TagString("s", "copy"));
+    CHECK(copy->toByteArray() == encodeUncached(*copy));
+    delete copy;
+
+    root->toByteArray();
+    root->getValueAt<TagCompound>("inner")->getValueAt<TagDouble>("x")->setValue(9.0);
+    CHECK(!root->getValueAt<TagCompound>("inner")->isShared());
+    CHECK(root->toByteArray() == encodeUncached(*root));
+
+    // Both sides of a clone encoded before a setter on either of them
+    copy = static_cast<TagCompound *>(root->clone());
+    ByteArray copied = copy->toByteArray();
+    root->getValueAt<TagCompound>("inner")->getValueAt<TagLong>("id")->setValue(-5);
+    CHECK(root->toByteArray() == encodeUncached(*root));
+    CHECK(copy->toByteArray() == copied);
+    copy->getValueAt<TagInt>("count")->setValue(3);
+    CHECK(copy->toByteArray() == encodeUncached(*copy));
+    CHECK(root->getInt("count") == 1);
+    delete copy;
+
+    // Array values changed in place
+    root->insert(TagIntArray("a", new int32_t[3] {1, 2, 3}, 3));
+    root->insert(TagLongArray("l", new int64_t[2] {1, 2}, 2));
+    root->toByteArray();
+    root->getValueAt<TagIntArray>("a")->editValues()[0] = 5;
+    CHECK(root->toByteArray() == encodeUncached(*root));
+    root->getValueAt<TagLongArray>("l")->editValues()[1] = -7;
+    CHECK(root->getValueAt<TagLongArray>("l")->getValues()[1] == -7);
+    CHECK(root->toByteArray() == encodeUncached(*root));
+
+    // No cache at all gives the same bytes
+    size_t limit = EncodingCache::getLimit();
+    EncodingCache::setLimit(0);
+    TagCompound *fresh = makeTree();
+    CHECK(fresh->toByteArray() == encodeUncached(*fresh));
+    EncodingCache::setLimit(limit);
+
+    delete fresh;
+    delete root;
+}
+
+
+void checkPatch()
+{
+    TagCompound *base = makeTree();
+    ByteArray before = base->toByteArray();
+
+    TagCompound *target = static_cast<TagCompound *>(base->clone());
+    CHECK(NbtPatch::diff(*base, *target).empty());
+
+    int32_t values[3] = {5, 6, 7};
+    target->edit<TagInt>("count")->setValue(100);
+    target->edit<TagCompound>("inner")->remove("id");
+    target->edit<TagCompound>("inner")->insert(TagFloat("f", 0.25f));
+    target->edit<TagList>("items")->edit<TagCompound>(0)->edit<TagShort>("slot")->setValue(9);
+    target->edit<TagList>("items")->removeLast();
+    target->edit<TagList>("ints")->setValues(values, 3);
+    target->insert(TagIntArray("array", new int32_t[2] {1, 2}, 2));
+
+    ByteArray patch = NbtPatch::diff(*base, *target);
+    CHECK(!patch.empty());
+
+    Tag *patched = NbtPatch::apply(*base, patch);
+    CHECK(patched != NULL);
+    if (patched != NULL)
+        CHECK(patched->toByteArray() == target->toByteArray());
+    Tag::destroy(patched);
+    CHECK(base->toByteArray() == before);
+
+    // Cut anywhere, a patch is rejected rather than half applied
+    bool rejected = true;
+    for (size_t size = 1; size < patch.size(); ++size)
+    {
+        Tag *cut = NbtPatch::apply(*base, patch.data(), size);
+        if (cut != NULL)
+        {
+            rejected = false;
+            Tag::destroy(cut);
+        }
+    }
+    CHECK(rejected);
+
+    delete target;
+    delete base;
+}
+
+
+// Feeds data to a fresh parser in two pieces split at every offset, and
+// checks each split ends in the same tree
+bool parsesAtEverySplit(const ByteArray &data, bool compressed, const ByteArray &expected)
+{
+    for (size_t split = 0; split <= data.size(); ++split)
+    {
+        NbtPushParser parser(compressed);
+
+        NbtPushParser::Status status = parser.feed(data.data(), split);
+        if (split < data.size())
+        {
+            if (status != NbtPushParser::NEED_MORE)
+                return false;
+
+            status = parser.feed(data.data() + split, data.size() - split);
+        }
+
+        if (status != NbtPushParser::COMPLETE || parser.getUnconsumed() != 0
+            || parser.getRoot()->toByteArray() != expected)
+            return false;
+    }
+
+    return true;
+}
+
+
+void checkPushParser()
+{
+    TagCompound *root = makeTree();
+    root->insert(TagByteArray("bytes", new unsigned char[5] {1, 2, 3, 4, 5}, 5));
+    root->insert(TagLongArray("longs", new int64_t[3] {-1, 0, 1}, 3));
+    ByteArray data = root->toByteArray();
+
+    CHECK(parsesAtEverySplit(data, false, data));
+
+    // One byte at a time
+    NbtPushParser parser;
+    NbtPushParser::Status status = NbtPushParser::NEED_MORE;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        CHECK(status == NbtPushParser::NEED_MORE);
+        status = parser.feed(&data[i], 1);
+    }
+    CHECK(status == NbtPushParser::COMPLETE);
+    CHECK(parser.getRoot() != NULL && parser.getRoot()->toByteArray() == data);
+
+    // Bytes after the end of the tree are left over
+    ByteArray trailing = data;
+    trailing.push_back(0xAB);
+    trailing.push_back(0xCD);
+    parser.reset();
+    CHECK(parser.feed(trailing.data(), trailing.size()) == NbtPushParser::COMPLETE);
+    CHECK(parser.getUnconsumed() == 2);
+
+    // Compressed input splits inside the deflate stream as well
+    NbtCodec codec(NbtCodec::GZIP);
+    ByteArray compressed(codec.bound(data.size()));
+    size_t compressedSize = compressed.size();
+    CHECK(codec.compress(data.data(), data.size(), compressed.data(), compressedSize));
+    compressed.resize(compressedSize);
+    CHECK(parsesAtEverySplit(compressed, true, data));
+
+    // A bad tag type fails for good
+    ByteArray bad = data;
+    bad[0] = 0x7F;
+    parser.reset();
+    CHECK(parser.feed(bad.data(), bad.size()) == NbtPushParser::FAILED);
+    CHECK(parser.feed(data.data(), data.size()) == NbtPushParser::FAILED);
+
+    delete root;
+}
+
+
+// Chunk of about kib KiB that does not compress, to span several sectors
+TagCompound *makeChunk(int id, size_t kib)
+{
+    size_t size = kib * 1024;
+    unsigned char *noise = new unsigned char[size];
+
+    uint32_t state = id * 2654435761u + 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+        state = state * 1103515245u + 12345u;
+        noise[i] = state >> 24;
+    }
+
+    TagCompound *chunk = new TagCompound("");
+    chunk->insert(TagInt("id", id));
+    chunk->insert(TagByteArray("noise", noise, size));
+    return chunk;
+}
+
+
+bool chunkMatches(const RegionFile &region, int x, int z, const Tag &expected)
+{
+    NbtBuffer buffer;
+    return region.readChunk(x, z, buffer)
+        && buffer.getRoot()->toByteArray() == expected.toByteArray();
+}
+
+
+void checkRegionWriter()
+{
+    char path[] = "/tmp/nbttest-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    ::close(fd);
+
+    TagCompound *a = makeChunk(1, 14);
+    TagCompound *b = makeChunk(2, 2);
+    TagCompound *c = makeChunk(3, 6);
+    TagCompound *d = makeChunk(4, 1);
+
+    RegionWriter writer(path);
+    writer.writeChunk(0, 0, a);
+    writer.writeChunk(1, 0, b);
+    writer.writeChunk(2, 0, c);
+    writer.writeChunk(31, 31, d);
+
+    // Rewritten chunks take the first hole that fits them, removed ones
+    // leave one behind
+    TagCompound *bigger = makeChunk(5, 12);
+    writer.writeChunk(1, 0, bigger);
+    TagCompound *smaller = makeChunk(6, 1);
+    writer.writeChunk(2, 0, smaller);
+    writer.removeChunk(0, 0);
+
+    // The holes before the last chunks are large enough to take them
+    size_t sectors = writer.getSectorCount();
+    CHECK(writer.getFreeSectorCount() > 0);
+    size_t reclaimed = writer.compact();
+    CHECK(reclaimed > 0);
+    CHECK(writer.getSectorCount() == sectors - reclaimed);
+    CHECK(writer.getFreeSectorCount() == 0);
+
+    uint8_t raw[3] = {1, 2, 3};
+    writer.writeChunk(5, 7, raw, sizeof(raw), RegionFile::COMPRESSION_NONE, 12345);
+    writer.close();
+
+    RegionFile region(path);
+    CHECK(!region.hasChunk(0, 0));
+    CHECK(chunkMatches(region, 1, 0, *bigger));
+    CHECK(chunkMatches(region, 2, 0, *smaller));
+    CHECK(chunkMatches(region, 31, 31, *d));
+    CHECK(region.getTimestamp(5, 7) == 12345);
+    CHECK(region.getChunkData(5, 7).size() == sizeof(raw)
+          && memcmp(region.getChunkData(5, 7).data(), raw, sizeof(raw)) == 0);
+    region.close();
+
+    // Reopened, the writer sees the same layout
+    writer.open(path);
+    CHECK(writer.getFreeSectorCount() == 0);
+    CHECK(writer.compact() == 0);
+    writer.close();
+
+    unlink(path);
+    delete a;
+    delete b;
+    delete c;
+    delete d;
+    delete bigger;
+    delete smaller;
+}
+
+
+int runChecks()
+{
+    checkWriter();
+    checkSerializedSize();
+    checkView();
+    checkArena();
+    checkFile();
+    checkDecoder();
+    checkByteSwap();
+    checkLongArray();
+    checkPackedList();
+    checkCompoundLookup();
+    checkStringPool();
+    checkPathFilter();
+    checkVisitor();
+    checkInflate();
+    checkCodec();
+    checkRegionRead();
+    checkDecodePool();
+    checkImage();
+    checkSharedImage();
+    checkOwnership();
+    checkCopyOnWrite();
+    checkEncodingCache();
+    checkPatch();
+    checkPushParser();
+    checkRegionWriter();
+
+    if (failures == 0)
+        std::cout << "all checks passed" << std::endl;
+
+    return failures == 0 ? 0 : 1;
+}
+
+
 int main(int argc, char **argv)
 {
     NbtFile f;
 
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <nbtfile>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <nbtfile>" << std::endl
+                  << "       " << argv[0] << " --check" << std::endl;
         return 1;
     }
 
+    if (std::string(argv[1]) == "--check")
+        return runChecks();
+
     try
     {
         f.open(argv[1]);